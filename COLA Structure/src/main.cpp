@@ -3,12 +3,27 @@
 #include <cstdint>
 #include <chrono>
 #include <random>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <iterator>
+#include <memory>
 
 #include "structure/basic_cola.h"
 #include "structure/deamortized_cola.h"
 #include "structure/lookahead_cola.h"
 #include "structure/avx_basic_cola.h"
 #include "structure/avx_deamortized_cola.h"
+#include "structure/growth_cola.h"
+#include "structure/dedup_cola.h"
+#include "structure/float_cola.h"
+#include "structure/string_cola.h"
+#include "structure/composite_cola.h"
+#include "structure/write_ahead_log.h"
+#include "structure/external_basic_cola.h"
+#include "structure/compressed_cola.h"
+#include "structure/file_util.h"
 
 template<typename T>
 static void insert(T& cola, int64_t value)
@@ -360,76 +375,825 @@ static void testAVXDeamortizedCola()
 	testContains(cola);
 }
 
+static void testDurableCola(const std::string& directory)
+{
+	// The directory should be backed by tmpfs (or similar) for testing
+	{
+		DurableCOLA<BasicCOLA> cola;
+		if (!cola.open(directory))
+		{
+			std::cout << "Could not open log in " << directory << std::endl;
+			return;
+		}
+
+		for (int i = 0; i < 1000; i++)
+			cola.add(i);
+
+		cola.checkpoint(directory);
+
+		std::cout << "Add elements 1000 to 1999 durably" << std::endl;
+		uint64_t sequence = 0;
+		for (int i = 1000; i < 2000; i++)
+			sequence = cola.add(i);
+		cola.waitDurable(sequence);
+
+		// Simulate a crash by not writing a checkpoint before closing
+	}
+
+	DurableCOLA<BasicCOLA> cola;
+	cola.recover(directory);
+
+	std::cout << "Recovered size: " << cola.size() << std::endl;
+	search(cola, 999);
+	search(cola, 1999);
+	search(cola, 2000);
+
+	testIterator(cola.cola());
+	testContains(cola.cola());
+}
+
+static size_t countFiles(const std::string& directory, const std::string& prefix, uint64_t last)
+{
+	// Spilled runs and checkpointed layers are numbered by generation
+	size_t count = 0;
+	for (uint64_t generation = 0; generation <= last; generation++)
+	{
+		FILE* file = openFile(joinPath(directory, prefix + std::to_string(generation) + ".bin"), "rb");
+		if (file != nullptr)
+		{
+			fclose(file);
+			count++;
+		}
+	}
+	return count;
+}
+
+template<typename T>
+static void testCheckpoint(const std::string& directory)
+{
+	// The directory should be backed by tmpfs (or similar) for testing
+	_Checkpoint_Manifest manifest;
+
+	{
+		T cola;
+		for (int i = 0; i < 1000; i++)
+			cola.add(i);
+
+		if (!cola.checkpoint(directory))
+		{
+			std::cout << "Could not write checkpoint to " << directory << std::endl;
+			return;
+		}
+
+		// Only the layers changed by these adds are written again
+		std::cout << "Add elements 1000 to 1099 and checkpoint again" << std::endl;
+		for (int i = 1000; i < 1100; i++)
+			cola.add(i);
+		cola.checkpoint(directory);
+
+		_Checkpoint_State::readManifest(directory, manifest);
+		std::cout << "Layers: " << manifest.m_Entries.size() << ", layer files: " << countFiles(directory, "layer_", manifest.m_Generation) << std::endl;
+	}
+
+	T cola;
+	cola.restore(directory);
+
+	std::cout << "Restored size: " << cola.size() << std::endl;
+	search(cola, 0);
+	search(cola, 999);
+	search(cola, 1099);
+	search(cola, 1100);
+
+	// Checkpoints of a restored cola reuse the layer files it was restored from
+	std::cout << "Add elements 1100 to 1199 and checkpoint" << std::endl;
+	for (int i = 1100; i < 1200; i++)
+		cola.add(i);
+	cola.checkpoint(directory);
+
+	_Checkpoint_State::readManifest(directory, manifest);
+	std::cout << "Layers: " << manifest.m_Entries.size() << ", layer files: " << countFiles(directory, "layer_", manifest.m_Generation) << std::endl;
+
+	T restored;
+	restored.restore(directory);
+	std::cout << "Restored size: " << restored.size() << std::endl;
+
+	for (int i = 0; i < 1200; i++)
+	{
+		if (!restored.contains(i))
+		{
+			std::cout << "Lost " << i << " in checkpoint!" << std::endl;
+			break;
+		}
+	}
+
+	testIterator(restored);
+	testContains(restored);
+}
+
+static void testExternalCola(const std::string& directory)
+{
+	{
+		// Only the four smallest layers (15 elements) are kept in memory
+		ExternalBasicCOLA cola(directory, 15);
+
+		std::cout << "Add even elements 0 to 1998" << std::endl;
+		for (int i = 0; i < 1000; i++)
+		{
+			if (!cola.add(2 * i))
+			{
+				std::cout << "Could not spill a layer to " << directory << std::endl;
+				return;
+			}
+		}
+
+		std::cout << "Layers in memory: " << static_cast<int>(cola.memoryLayerCount()) << ", run files: " << countFiles(directory, "run_", 1000) << std::endl;
+
+		// Spilled
+		search(cola, 0);
+		search(cola, 1000);
+		// In memory
+		search(cola, 1998);
+		// Not contained
+		search(cola, 999);
+		search(cola, 2000);
+
+		for (int i = 0; i < 1000; i++)
+		{
+			if (!cola.contains(2 * i) || cola.contains(2 * i + 1))
+			{
+				std::cout << "External contains error at " << 2 * i << "!" << std::endl;
+				break;
+			}
+		}
+
+		if (!cola.good())
+			std::cout << "Reading or writing a run failed!" << std::endl;
+	}
+
+	std::cout << "Run files after destruction: " << countFiles(directory, "run_", 1000) << std::endl;
+}
+
+template<typename T>
+static void testCompressedCola(size_t threshold)
+{
+	CompressedCOLA<T> cola(threshold);
+	std::vector<T> keys;
+
+	const T min = std::numeric_limits<T>::min();
+	const T max = std::numeric_limits<T>::max();
+	keys.push_back(min);
+	keys.push_back(max);
+	keys.push_back(0);
+
+	// Dense keys are packed with few bits per key
+	for (int64_t i = 0; i < 1000; i++)
+		keys.push_back(static_cast<T>(i * 3));
+	// Equal keys form blocks with zero bits per key
+	for (int i = 0; i < 300; i++)
+		keys.push_back(42);
+	// Keys spread over the entire range. With 64-bit keys, their blocks
+	// span more than 32 bits and are stored uncompressed.
+	for (int64_t i = 1; i < 1000; i++)
+		keys.push_back(static_cast<T>(min + i * (max / 1024)));
+
+	std::cout << "Add " << keys.size() << " keys with threshold " << threshold << std::endl;
+	for (T key : keys)
+		cola.add(key);
+
+	search(cola, min);
+	search(cola, max);
+	search(cola, 42);
+	search(cola, 43);
+	search(cola, 2997);
+	search(cola, 2998);
+
+	for (T key : keys)
+	{
+		if (!cola.contains(key))
+		{
+			std::cout << "Compressed contains error at " << key << "!" << std::endl;
+			break;
+		}
+	}
+
+	for (T key : { static_cast<T>(min + 1), static_cast<T>(max - 1), static_cast<T>(1), static_cast<T>(3001) })
+	{
+		if (cola.contains(key))
+			std::cout << "Compressed contains " << key << ", which was never added!" << std::endl;
+	}
+
+	std::cout << "Size: " << cola.size() << ", bytes: " << cola.memoryUsage() << ", raw bytes: " << cola.size() * sizeof(T) << std::endl;
+}
+
+template<typename T>
+static void testClone()
+{
+	T cola;
+	for (int i = 0; i < 100; i++)
+		cola.add(2 * i);
+
+	// The clone shares the layers until either cola inserts
+	T copy = cola.clone();
+
+	std::cout << "Add odd elements 1 to 199 to the clone" << std::endl;
+	for (int i = 0; i < 100; i++)
+		copy.add(2 * i + 1);
+
+	std::cout << "Add elements 1000 to 1049 to the original" << std::endl;
+	for (int i = 1000; i < 1050; i++)
+		cola.add(i);
+
+	search(cola, 1);
+	search(copy, 1);
+	search(cola, 1000);
+	search(copy, 1000);
+	search(cola, 198);
+	search(copy, 198);
+	std::cout << "Size: " << cola.size() << ", clone size: " << copy.size() << std::endl;
+
+	for (int i = 0; i < 100; i++)
+	{
+		if (!cola.contains(2 * i) || !copy.contains(2 * i) || cola.contains(2 * i + 1) || !copy.contains(2 * i + 1))
+		{
+			std::cout << "Clone diverged incorrectly at " << 2 * i << "!" << std::endl;
+			break;
+		}
+	}
+
+	for (int i = 1000; i < 1050; i++)
+	{
+		if (copy.contains(i))
+		{
+			std::cout << "Clone contains " << i << " of the original!" << std::endl;
+			break;
+		}
+	}
+
+	testIterator(cola);
+	testContains(cola);
+	testIterator(copy);
+	testContains(copy);
+}
+
+template<typename T, typename V>
+static void testRankSelect()
+{
+	T cola;
+	std::vector<V> values;
+
+	// Multiples of three, with 300 stored three times
+	for (int i = 499; i >= 0; i--)
+		values.push_back(static_cast<V>(3 * i));
+	values.push_back(300);
+	values.push_back(300);
+
+	for (V value : values)
+		cola.add(value);
+	std::sort(values.begin(), values.end());
+
+	std::cout << "rank(300): " << cola.rank(300) << ", rank(301): " << cola.rank(301) << std::endl;
+	std::cout << "countRange(300, 600): " << cola.countRange(300, 600) << std::endl;
+
+	V result;
+	if (cola.select(100, result))
+		std::cout << "select(100): " << result << std::endl;
+	if (cola.quantile(0.5, result))
+		std::cout << "quantile(0.5): " << result << std::endl;
+	std::cout << "select(size()) fails: " << !cola.select(cola.size(), result) << std::endl;
+
+	for (size_t k = 0; k < values.size(); k++)
+	{
+		// The element of rank k is the k-th element of the sorted values, and
+		// its rank is that of its first copy.
+		const size_t first = std::lower_bound(values.begin(), values.end(), values[k]) - values.begin();
+		if (!cola.select(k, result) || result != values[k] || cola.rank(result) != first ||
+			!cola.select(cola.rank(result), result) || result != values[k])
+		{
+			std::cout << "select(rank(x)) error at rank " << k << "!" << std::endl;
+			break;
+		}
+	}
+
+	for (V lo = -2; lo < 1600; lo += 7)
+	{
+		const V hi = lo + 100;
+		const size_t expected = std::upper_bound(values.begin(), values.end(), hi) - std::lower_bound(values.begin(), values.end(), lo);
+		if (cola.countRange(lo, hi) != expected)
+		{
+			std::cout << "countRange(" << lo << ", " << hi << ") error!" << std::endl;
+			break;
+		}
+	}
+}
+
+static void testFreezeThaw()
+{
+	AVXBasicCOLA cola;
+	std::vector<int32_t> values;
+
+	for (int32_t i = 0; i < 1000; i++)
+	{
+		values.push_back((i * 7919) % 2000);
+		cola.add(values.back());
+	}
+	std::sort(values.begin(), values.end());
+
+	std::cout << "Freeze " << cola.size() << " elements" << std::endl;
+	cola.freeze();
+	std::cout << "isFrozen(): " << cola.isFrozen() << std::endl;
+
+	search(cola, values.front());
+	search(cola, values.back());
+	search(cola, 2001);
+
+	int32_t result;
+	if (cola.successor(1001, result))
+		std::cout << "successor(1001): " << result << std::endl;
+	std::cout << "rank(1000): " << cola.rank(1000) << std::endl;
+
+	for (int32_t value = -1; value <= 2001; value++)
+	{
+		if (cola.contains(value) != std::binary_search(values.begin(), values.end(), value))
+		{
+			std::cout << "Frozen contains error at " << value << "!" << std::endl;
+			break;
+		}
+	}
+
+	testIterator(cola);
+	testContains(cola);
+
+	cola.thaw();
+	std::cout << "Thaw, isFrozen(): " << cola.isFrozen() << std::endl;
+
+	std::cout << "Add elements 5000 to 5099" << std::endl;
+	for (int32_t i = 5000; i < 5100; i++)
+		cola.add(i);
+
+	// Inserting into a frozen cola thaws it first
+	cola.freeze();
+	insert(cola, 6000);
+	std::cout << "isFrozen(): " << cola.isFrozen() << std::endl;
+
+	search(cola, 5050);
+	search(cola, 6000);
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	for (int32_t value : values)
+	{
+		if (!cola.contains(value))
+		{
+			std::cout << "Lost " << value << " after thaw!" << std::endl;
+			break;
+		}
+	}
+
+	testIterator(cola);
+	testContains(cola);
+}
+
+template<typename Cursor>
+static std::vector<int64_t> collect(Cursor cursor)
+{
+	std::vector<int64_t> values;
+	for (; cursor.valid(); cursor.next())
+		values.push_back(cursor.value());
+	return values;
+}
+
+static void testSetOperations()
+{
+	BasicCOLA a, b;
+	std::vector<int64_t> aValues, bValues;
+
+	// Multiples of two and of three, with some elements stored twice
+	for (int64_t i = 0; i < 300; i++)
+		aValues.push_back(2 * i);
+	for (int64_t i = 0; i < 200; i++)
+		bValues.push_back(3 * i);
+	aValues.push_back(6);
+	bValues.push_back(6);
+	bValues.push_back(12);
+
+	for (int64_t value : aValues)
+		a.add(value);
+	for (int64_t value : bValues)
+		b.add(value);
+	std::sort(aValues.begin(), aValues.end());
+	std::sort(bValues.begin(), bValues.end());
+
+	std::vector<int64_t> expected;
+	if (collect(a.cursor()) != aValues)
+		std::cout << "Cursor error!" << std::endl;
+
+	std::set_intersection(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(expected));
+	const std::vector<int64_t> intersection = collect(a.intersect(b));
+	std::cout << "Intersection size: " << intersection.size() << ", first elements:";
+	for (size_t i = 0; i < 5 && i < intersection.size(); i++)
+		std::cout << " " << intersection[i];
+	std::cout << std::endl;
+	if (intersection != expected)
+		std::cout << "Intersection error!" << std::endl;
+
+	expected.clear();
+	std::set_difference(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(expected));
+	const std::vector<int64_t> difference = collect(a.difference(b));
+	std::cout << "Difference size: " << difference.size() << std::endl;
+	if (difference != expected)
+		std::cout << "Difference error!" << std::endl;
+
+	// The union keeps the elements of both, like std::merge
+	expected.clear();
+	std::merge(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(expected));
+	BasicCOLA merged = a.clone();
+	merged.merge(b);
+	std::cout << "Union size: " << merged.size() << std::endl;
+	if (collect(merged.cursor()) != expected)
+		std::cout << "Union error!" << std::endl;
+
+	search(merged, 297);
+	search(merged, 598);
+	search(merged, 599);
+
+	testIterator(merged);
+	testContains(merged);
+}
+
+static void testDedupCola()
+{
+	DedupCOLA cola(true);
+
+	insert(cola, 2);
+	insert(cola, 1);
+	insert(cola, 6);
+	insert(cola, 4);
+	insert(cola, 3);
+
+	search(cola, 1);
+	search(cola, 5);
+	search(cola, 10);
+	insert(cola, 10);
+	insert(cola, 10);
+	search(cola, 10);
+	std::cout << "count(10): " << cola.count(10) << std::endl;
+
+	std::cout << "Add elements 10 to 999 twice" << std::endl;
+	for (int i = 10; i < 1000; i++)
+	{
+		cola.add(i);
+		cola.add(i);
+	}
+
+	search(cola, 100);
+	search(cola, 999);
+	std::cout << "count(10): " << cola.count(10) << ", count(999): " << cola.count(999) << std::endl;
+	std::cout << "Stored keys: " << cola.size() << std::endl;
+
+	testIterator(cola);
+	testContains(cola);
+}
+
+template<typename T>
+static void testAppendSorted()
+{
+	T cola;
+
+	// Layers filled by unsorted adds overlap, so appends must still merge them
+	insert(cola, 5);
+	insert(cola, 3);
+	insert(cola, 4);
+
+	std::cout << "appendSorted(10) to appendSorted(39)" << std::endl;
+	for (int i = 10; i < 40; i++)
+		cola.appendSorted(i);
+
+	insert(cola, 100);
+	insert(cola, 99);
+	insert(cola, 98);
+
+	std::cout << "appendSorted(200) to appendSorted(299)" << std::endl;
+	for (int i = 200; i < 300; i++)
+		cola.appendSorted(i);
+
+	search(cola, 3);
+	search(cola, 5);
+	search(cola, 98);
+	search(cola, 200);
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	for (int value : { 3, 4, 5, 98, 99, 100 })
+	{
+		if (!cola.contains(value))
+			std::cout << "Lost " << value << " after appendSorted!" << std::endl;
+	}
+
+	testIterator(cola);
+	testContains(cola);
+}
+
+static void testFloatCola()
+{
+	FloatCOLA<AVXBasicCOLA, float> cola;
+
+	for (float value : { 0.5f, -2.25f, 1e30f, -0.0f, std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN() })
+	{
+		std::cout << "add(" << value << ")" << std::endl;
+		cola.add(value);
+	}
+
+	for (float value : { 0.0f, -0.0f, 0.25f, std::numeric_limits<float>::quiet_NaN() })
+		std::cout << "contains(" << value << "): " << cola.contains(value) << std::endl;
+
+	float result;
+	if (cola.strictPredecessor(0.0f, result))
+		std::cout << "strictPredecessor(0): " << result << std::endl;
+	if (cola.strictSuccessor(std::numeric_limits<float>::infinity(), result))
+		std::cout << "strictSuccessor(inf): " << result << std::endl;
+	if (cola.nearest(0.3f, result))
+		std::cout << "nearest(0.3): " << result << std::endl;
+
+	std::cout << "Add scores -1000 to 999 in steps of 0.5" << std::endl;
+	for (int i = -2000; i < 2000; i++)
+		cola.add(i * 0.5f);
+
+	std::cout << "countRange(-1, 1): " << cola.countRange(-1.0f, 1.0f) << std::endl;
+	if (cola.quantile(0.5, result))
+		std::cout << "quantile(0.5): " << result << std::endl;
+
+	testIterator(cola);
+	testContains(cola);
+}
+
+static void testStringCola()
+{
+	StringCOLA cola;
+
+	for (const char* key : { "https://example.com/b", "user42", "https://example.com/a", "", "user7" })
+	{
+		std::cout << "add(\"" << key << "\")" << std::endl;
+		cola.add(key);
+	}
+
+	for (const char* key : { "user42", "user4", "https://example.com/a", "" })
+		std::cout << "contains(\"" << key << "\"): " << cola.contains(key) << std::endl;
+
+	std::string result;
+	if (cola.successor("https://example.com/aa", result))
+		std::cout << "successor(\"https://example.com/aa\"): " << result << std::endl;
+	if (cola.strictPredecessor("user7", result))
+		std::cout << "strictPredecessor(\"user7\"): " << result << std::endl;
+
+	std::cout << "Add user0 to user999" << std::endl;
+	for (int i = 0; i < 1000; i++)
+		cola.add("user" + std::to_string(i));
+
+	std::cout << "Keys: " << cola.size() << ", arena bytes: " << cola.arenaSize() << std::endl;
+
+	testIterator(cola);
+	testContains(cola);
+}
+
+static void testCompositeCola()
+{
+	// (tenant, timestamp) pairs, with timestamps beyond 32 bits
+	CompositeCOLA<2> cola;
+
+	const int64_t t0 = static_cast<int64_t>(1) << 40;
+	for (int64_t tenant = 1; tenant <= 3; tenant++)
+	{
+		for (int64_t t = 0; t < 100; t++)
+			cola.add({ tenant, t0 + t * 10 });
+	}
+
+	std::cout << "contains(2, t0 + 50): " << cola.contains({ 2, t0 + 50 }) << std::endl;
+	std::cout << "contains(2, t0 + 55): " << cola.contains({ 2, t0 + 55 }) << std::endl;
+
+	std::cout << "Entries of tenant 2 from t0 + 100 to t0 + 200:";
+	cola.forEachInRange({ 2, t0 + 100 }, { 2, t0 + 200 }, [](const CompositeCOLA<2>::Key& key) { std::cout << " " << key[1] - t0; });
+	std::cout << std::endl;
+
+	std::cout << "Entries of tenant 3: " << cola.countRange({ 3, std::numeric_limits<int64_t>::min() }, { 3, std::numeric_limits<int64_t>::max() }) << std::endl;
+
+	CompositeCOLA<2>::Key result;
+	if (cola.strictSuccessor({ 1, std::numeric_limits<int64_t>::max() }, result))
+		std::cout << "First entry after tenant 1: (" << result[0] << ", t0 + " << result[1] - t0 << ")" << std::endl;
+
+	testIterator(cola);
+}
+
+template<typename T, uint32_t MAX_LAYERS>
+void timeInsertSorted()
+{
+	T cola;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::chrono::nanoseconds times[MAX_LAYERS];
+
+	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	{
+		uint32_t s = nextPO2MinusOne(cola.size()) + 1;
+		while (cola.size() < s)
+			cola.add(cola.size());
+
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l] = end - start;
+	}
+
+	std::cout << "log2 N, avg. insert time" << std::endl;
+	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+		std::cout << times[l].count() << std::endl;
+
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	// Search for something at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cola.contains(16) << std::endl;
+}
+
+template<typename T, uint32_t MAX_LAYERS>
+void timeAppendSorted()
+{
+	T cola;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::chrono::nanoseconds times[MAX_LAYERS];
+
+	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	{
+		uint32_t s = nextPO2MinusOne(cola.size()) + 1;
+		while (cola.size() < s)
+			cola.appendSorted(cola.size());
+
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l] = end - start;
+	}
+
+	std::cout << "log2 N, avg. append time" << std::endl;
+	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+		std::cout << times[l].count() << std::endl;
+
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	// Search for something at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cola.contains(16) << std::endl;
+}
+
+template<typename T, uint32_t MAX_LAYERS>
+void timeInsertRandom()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	T cola;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::chrono::nanoseconds times[MAX_LAYERS];
+
+	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	{
+		uint32_t s = nextPO2MinusOne(cola.size()) + 1;
+		while (cola.size() < s)
+			cola.add(static_cast<int32_t>(dist(eng)));
+
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l] = end - start;
+	}
+
+	std::cout << "log2 N, avg. insert time" << std::endl;
+	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+		std::cout << times[l].count() << std::endl;
+
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	// Search for something at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cola.contains(16) << std::endl;
+}
+
+template<typename T, uint32_t MAX_LAYERS>
+void timeSearchRandom()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	T cola;
+
+	std::chrono::nanoseconds times[MAX_LAYERS];
+
+	size_t cntr = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+	{
+		uint32_t s = (1 << l) - 1;
+		while (cola.size() < s)
+			cola.add(static_cast<int32_t>(dist(eng)));
+		
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < 10000; i++) {
+			if (cola.contains(static_cast<int32_t>(dist(eng))))
+				cntr++;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l] = end - start;
+	}
+
+	std::cout << "log2(N + 1), avg. search time" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+		std::cout << times[l].count() << std::endl;
+
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
 template<typename T, uint32_t MAX_LAYERS>
-void timeInsertSorted()
+void timeSearchContained()
 {
 	T cola;
 
-	auto start = std::chrono::high_resolution_clock::now();
 	std::chrono::nanoseconds times[MAX_LAYERS];
 
-	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	size_t cntr = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
 	{
-		uint32_t s = nextPO2MinusOne(cola.size()) + 1;
+		uint32_t s = (1 << l) - 1;
 		while (cola.size() < s)
 			cola.add(cola.size());
 
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < 100000; i++) {
+			if (cola.contains(static_cast<uint64_t>(i) * cola.size() / 100000))
+				cntr++;
+		}
 		auto end = std::chrono::high_resolution_clock::now();
 		times[l] = end - start;
 	}
 
-	std::cout << "log2 N, avg. insert time" << std::endl;
-	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	std::cout << "log2(N + 1), avg. search time" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
 		std::cout << times[l].count() << std::endl;
 
 	std::cout << "Size: " << cola.size() << std::endl;
 
-	// Search for something at the end to ensure that the compiler
+	// Print cntr at the end to ensure that the compiler
 	// does not unwantingly optimise code away.
-	std::cout << cola.contains(16) << std::endl;
+	std::cout << cntr << std::endl;
 }
 
 template<typename T, uint32_t MAX_LAYERS>
-void timeInsertRandom()
+void timeSearchModel()
 {
 	std::default_random_engine eng(812938729);
 	std::uniform_int_distribution<uint32_t> dist;
 
 	T cola;
 
-	auto start = std::chrono::high_resolution_clock::now();
 	std::chrono::nanoseconds times[MAX_LAYERS];
 
-	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	size_t cntr = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
 	{
-		uint32_t s = nextPO2MinusOne(cola.size()) + 1;
+		uint32_t s = (1 << l) - 1;
 		while (cola.size() < s)
 			cola.add(static_cast<int32_t>(dist(eng)));
 
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < 10000; i++) {
+			if (cola.contains(static_cast<int32_t>(dist(eng))))
+				cntr++;
+		}
 		auto end = std::chrono::high_resolution_clock::now();
 		times[l] = end - start;
 	}
 
-	std::cout << "log2 N, avg. insert time" << std::endl;
-	for (uint32_t l = 0; l < MAX_LAYERS; l++)
+	std::cout << "log2(N + 1), avg. search time" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
 		std::cout << times[l].count() << std::endl;
 
+	// Layers of at least LAYER_MODEL_MIN_SIZE elements are searched with a
+	// model unless their keys can not be fitted within the error.
+	const _LayerModel_Stats stats = cola.modelStats();
+	std::cout << "Modelled layers: " << stats.m_ModelLayers << ", fallback layers: " << stats.m_FallbackLayers << std::endl;
+	std::cout << "Segments: " << stats.m_Segments << ", bytes: " << stats.m_Bytes << ", max. error: " << stats.m_MaxError << std::endl;
+
 	std::cout << "Size: " << cola.size() << std::endl;
 
-	// Search for something at the end to ensure that the compiler
+	// Print cntr at the end to ensure that the compiler
 	// does not unwantingly optimise code away.
-	std::cout << cola.contains(16) << std::endl;
+	std::cout << cntr << std::endl;
 }
 
-template<typename T, uint32_t MAX_LAYERS>
-void timeSearchRandom()
+template<class T, uint32_t MAX_LAYERS>
+void timeSearchPolicy()
 {
 	std::default_random_engine eng(812938729);
 	std::uniform_int_distribution<uint32_t> dist;
 
 	T cola;
 
-	std::chrono::nanoseconds times[MAX_LAYERS];
+	std::chrono::nanoseconds times[MAX_LAYERS][2];
 
 	size_t cntr = 0;
 	for (uint32_t l = 1; l < MAX_LAYERS; l++)
@@ -437,17 +1201,123 @@ void timeSearchRandom()
 		uint32_t s = (1 << l) - 1;
 		while (cola.size() < s)
 			cola.add(static_cast<int32_t>(dist(eng)));
-		
+
+		// Search the same cola with binary search and with interpolation
+		// search, which needs fewer probes on the uniform keys.
+		for (uint32_t policy = 0; policy < 2; policy++)
+		{
+			cola.setSearchPolicy(policy ? SearchPolicy::Interpolation : SearchPolicy::Default);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < 10000; i++) {
+				if (cola.contains(static_cast<int32_t>(dist(eng))))
+					cntr++;
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			times[l][policy] = end - start;
+		}
+	}
+
+	std::cout << "log2(N + 1), default search time, interpolation search time" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+		std::cout << l << ", " << times[l][0].count() << ", " << times[l][1].count() << std::endl;
+
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
+template<uint32_t MAX_LAYERS>
+void timeContainsBatch()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	AVXBasicCOLA cola;
+
+	// Sorted queries, like the inputs of a sort-merge join
+	std::vector<int32_t> values(10000);
+	std::unique_ptr<bool[]> results(new bool[values.size()]);
+
+	std::chrono::nanoseconds times[MAX_LAYERS][2];
+
+	size_t cntr = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+	{
+		uint32_t s = (1 << l) - 1;
+		while (cola.size() < s)
+			cola.add(static_cast<int32_t>(dist(eng)));
+
+		for (int32_t& value : values)
+			value = static_cast<int32_t>(dist(eng));
+		std::sort(values.begin(), values.end());
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int32_t value : values) {
+			if (cola.contains(value))
+				cntr++;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l][0] = end - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		cola.containsBatch(values.data(), values.size(), results.get());
+		for (size_t i = 0; i < values.size(); i++) {
+			if (results[i])
+				cntr++;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		times[l][1] = end - start;
+	}
+
+	std::cout << "log2(N + 1), contains time, batch time" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+		std::cout << l << ", " << times[l][0].count() << ", " << times[l][1].count() << std::endl;
+
+	std::cout << "Size: " << cola.size() << std::endl;
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
+template<class T, uint32_t MAX_LAYERS>
+void timeSearchRecent()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	T cola;
+
+	// Keys inserted last, which are looked up again
+	const uint32_t recentCount = 512;
+	std::vector<int32_t> recent(recentCount);
+
+	std::chrono::nanoseconds times[MAX_LAYERS];
+
+	size_t cntr = 0;
+	uint32_t r = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+	{
+		uint32_t s = (1 << l) - 1;
+		while (cola.size() < s)
+		{
+			recent[r++ % recentCount] = static_cast<int32_t>(dist(eng));
+			cola.add(recent[(r - 1) % recentCount]);
+		}
+
 		auto start = std::chrono::high_resolution_clock::now();
 		for (uint32_t i = 0; i < 10000; i++) {
-			if (cola.contains(static_cast<int32_t>(dist(eng))))
+			if (cola.contains(recent[(r - 1 - dist(eng) % std::min(r, recentCount)) % recentCount]))
 				cntr++;
 		}
 		auto end = std::chrono::high_resolution_clock::now();
 		times[l] = end - start;
 	}
 
-	std::cout << "log2(N + 1), avg. search time" << std::endl;
+	std::cout << "log2(N + 1), avg. recent search time" << std::endl;
 	for (uint32_t l = 1; l < MAX_LAYERS; l++)
 		std::cout << times[l].count() << std::endl;
 
@@ -458,32 +1328,306 @@ void timeSearchRandom()
 	std::cout << cntr << std::endl;
 }
 
+template<uint32_t MAX_LAYERS>
+void timeInsertDuplicates()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+	std::uniform_int_distribution<uint32_t> percent(0, 99);
+
+	BasicCOLA basic;
+	DedupCOLA set(false);
+
+	// Keys delivered at least once, where 30% of the keys are
+	// repeated from the last 1024 keys.
+	std::vector<int64_t> recent(1024);
+
+	std::chrono::nanoseconds times[MAX_LAYERS][2];
+	size_t sizes[MAX_LAYERS][2];
+
+	size_t n = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+	{
+		const size_t s = (static_cast<size_t>(1) << l) - 1;
+		std::vector<int64_t> values;
+		for (; n < s; n++)
+		{
+			const int64_t value = (n != 0 && percent(eng) < 30) ? recent[dist(eng) % std::min(n, recent.size())] : dist(eng);
+			recent[n % recent.size()] = value;
+			values.push_back(value);
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t value : values)
+			basic.add(value);
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l][0] = end - start;
+		sizes[l][0] = basic.capacity();
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int64_t value : values)
+			set.add(value);
+		end = std::chrono::high_resolution_clock::now();
+		times[l][1] = end - start;
+		sizes[l][1] = set.capacity();
+	}
+
+	std::cout << "log2(N + 1), basic insert time, set insert time, basic capacity, set capacity" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+		std::cout << l << ", " << times[l][0].count() << ", " << times[l][1].count() << ", " << sizes[l][0] << ", " << sizes[l][1] << std::endl;
+
+	std::cout << "Basic size: " << basic.size() << ", set size: " << set.size() << std::endl;
+}
+
+template<uint32_t MAX_LAYERS>
+void timeStringKeys()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	// URLs that share a long prefix, such that the keys
+	// are compared whenever their prefixes are equal.
+	auto url = [&]() { return "https://www.example.com/item/" + std::to_string(dist(eng)); };
+
+	StringCOLA cola;
+	std::chrono::nanoseconds times[MAX_LAYERS][2];
+
+	size_t cntr = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+	{
+		const size_t s = (static_cast<size_t>(1) << l) - 1;
+		std::vector<std::string> keys;
+		while (cola.size() + keys.size() < s)
+			keys.push_back(url());
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (const std::string& key : keys)
+			cola.add(key);
+		auto end = std::chrono::high_resolution_clock::now();
+		times[l][0] = end - start;
+
+		keys.clear();
+		for (uint32_t i = 0; i < 1000; i++)
+			keys.push_back(url());
+
+		start = std::chrono::high_resolution_clock::now();
+		for (const std::string& key : keys)
+		{
+			if (cola.contains(key))
+				cntr++;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		times[l][1] = end - start;
+	}
+
+	std::cout << "log2(N + 1), insert time, search time (1000 keys)" << std::endl;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+		std::cout << l << ", " << times[l][0].count() << ", " << times[l][1].count() << std::endl;
+
+	std::cout << "Arena bytes: " << cola.arenaSize() << std::endl;
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
+template<uint32_t MAX_LAYERS>
+void timeSetOperations()
+{
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	std::cout << "log2(N + 1), add time, merge time, contains time, intersect time, difference time" << std::endl;
+
+	size_t cntr = 0;
+	for (uint32_t l = 1; l < MAX_LAYERS; l++)
+	{
+		// Two shards of N elements each, which overlap in part
+		const size_t s = (static_cast<size_t>(1) << l) - 1;
+		BasicCOLA a, b;
+		for (size_t i = 0; i < s; i++)
+		{
+			a.add(dist(eng) >> 1);
+			b.add(dist(eng) >> 1);
+		}
+
+		// Combine the shards by adding each element of b
+		BasicCOLA added = a.clone();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t value : b)
+			added.add(value);
+		auto end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds addTime = end - start;
+
+		// Combine the shards by merging the layers of b
+		BasicCOLA merged = a.clone();
+		start = std::chrono::high_resolution_clock::now();
+		merged.merge(b);
+		end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds mergeTime = end - start;
+
+		// Intersect by searching each element of b
+		start = std::chrono::high_resolution_clock::now();
+		for (int64_t value : b)
+		{
+			if (a.contains(value))
+				cntr++;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds containsTime = end - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (auto cursor = a.intersect(b); cursor.valid(); cursor.next())
+			cntr++;
+		end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds intersectTime = end - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (auto cursor = a.difference(b); cursor.valid(); cursor.next())
+			cntr++;
+		end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds differenceTime = end - start;
+
+		std::cout << l << ", " << addTime.count() << ", " << mergeTime.count() << ", " << containsTime.count() << ", " << intersectTime.count() << ", " << differenceTime.count() << std::endl;
+	}
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
 template<typename T, uint32_t MAX_LAYERS>
-void timeSearchContained()
+void timeCompressedMemory()
 {
-	T cola;
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	// Keys drawn from a range of 4 * 2^MAX_LAYERS, such as dense ids
+	const uint32_t range = static_cast<uint32_t>(4) << MAX_LAYERS;
 
+	CompressedCOLA<T> cola(1024);
 	std::chrono::nanoseconds times[MAX_LAYERS];
+	size_t bytes[MAX_LAYERS];
 
 	size_t cntr = 0;
 	for (uint32_t l = 1; l < MAX_LAYERS; l++)
 	{
-		uint32_t s = (1 << l) - 1;
+		const size_t s = (static_cast<size_t>(1) << l) - 1;
 		while (cola.size() < s)
-			cola.add(cola.size());
+			cola.add(static_cast<T>(dist(eng) % range));
+		bytes[l] = cola.memoryUsage();
 
 		auto start = std::chrono::high_resolution_clock::now();
-		for (uint32_t i = 0; i < 100000; i++) {
-			if (cola.contains(static_cast<uint64_t>(i) * cola.size() / 100000))
+		for (uint32_t i = 0; i < 10000; i++) {
+			if (cola.contains(static_cast<T>(dist(eng) % range)))
 				cntr++;
 		}
 		auto end = std::chrono::high_resolution_clock::now();
 		times[l] = end - start;
 	}
 
-	std::cout << "log2(N + 1), avg. search time" << std::endl;
+	std::cout << "log2(N + 1), bytes, raw bytes, search time" << std::endl;
 	for (uint32_t l = 1; l < MAX_LAYERS; l++)
-		std::cout << times[l].count() << std::endl;
+		std::cout << l << ", " << bytes[l] << ", " << ((static_cast<size_t>(1) << l) - 1) * sizeof(T) << ", " << times[l].count() << std::endl;
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
+template<uint32_t MAX_LAYERS>
+void timeGrowthFactors()
+{
+	std::cout << "g, levels, insert time, search time" << std::endl;
+
+	size_t cntr = 0;
+	for (uint32_t g = 2; g <= 64; g <<= 1)
+	{
+		std::default_random_engine eng(812938729);
+		std::uniform_int_distribution<uint32_t> dist;
+
+		GrowthCOLA cola(g);
+
+		const size_t s = (static_cast<size_t>(1) << MAX_LAYERS) - 1;
+		auto start = std::chrono::high_resolution_clock::now();
+		while (cola.size() < s)
+			cola.add(static_cast<int32_t>(dist(eng)));
+		auto end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds insertTime = end - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < 10000; i++) {
+			if (cola.contains(static_cast<int32_t>(dist(eng))))
+				cntr++;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		const std::chrono::nanoseconds searchTime = end - start;
+
+		std::cout << g << ", " << +cola.levelCount() << ", " << insertTime.count() << ", " << searchTime.count() << std::endl;
+	}
+
+	// Print cntr at the end to ensure that the compiler
+	// does not unwantingly optimise code away.
+	std::cout << cntr << std::endl;
+}
+
+template<typename T, uint32_t MAX_LAYERS>
+void timeConcurrentSearch()
+{
+	// Latency of searches in a small cola that fits in the caches, while
+	// another thread inserts into a large cola. Large merges evict the small
+	// cola from the shared caches unless they use streaming stores.
+	std::default_random_engine eng(812938729);
+	std::uniform_int_distribution<uint32_t> dist;
+
+	T hot;
+	while (hot.size() < (static_cast<uint32_t>(1) << 16) - 1)
+		hot.add(static_cast<int32_t>(dist(eng)));
+
+	std::atomic<bool> inserting(false);
+	std::atomic<bool> done(false);
+	std::chrono::nanoseconds idleTotal(0), idleMax(0), busyTotal(0), busyMax(0);
+	size_t idleCount = 0, busyCount = 0, cntr = 0;
+
+	std::thread searcher([&]()
+	{
+		std::default_random_engine searchEng(1234567);
+		while (!done)
+		{
+			const bool busy = inserting;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < 1000; i++) {
+				if (hot.contains(static_cast<int32_t>(dist(searchEng))))
+					cntr++;
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			const std::chrono::nanoseconds time = end - start;
+
+			std::chrono::nanoseconds& total = busy ? busyTotal : idleTotal;
+			std::chrono::nanoseconds& max = busy ? busyMax : idleMax;
+			total += time;
+			max = std::max(max, time);
+			(busy ? busyCount : idleCount)++;
+		}
+	});
+
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	T cola;
+	inserting = true;
+	while (cola.size() < (static_cast<uint32_t>(1) << MAX_LAYERS) - 1)
+		cola.add(static_cast<int32_t>(dist(eng)));
+	inserting = false;
+
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	done = true;
+	searcher.join();
+
+	std::cout << "1000 searches, avg. time, max. time" << std::endl;
+	if (idleCount > 0)
+		std::cout << "idle, " << idleTotal.count() / idleCount << ", " << idleMax.count() << std::endl;
+	if (busyCount > 0)
+		std::cout << "inserting, " << busyTotal.count() / busyCount << ", " << busyMax.count() << std::endl;
 
 	std::cout << "Size: " << cola.size() << std::endl;
 
@@ -499,6 +1643,30 @@ int main()
 	//testLookaheadCola();
 	//testAVXBasicCola();
 	//testAVXDeamortizedCola();
+	//testCheckpoint<BasicCOLA>("/dev/shm/cola");
+	//testCheckpoint<DeamortizedCOLA>("/dev/shm/cola");
+	//testDurableCola("/dev/shm/cola");
+	//testExternalCola("/dev/shm/cola");
+	//testCompressedCola<int64_t>(16);
+	//testCompressedCola<int64_t>(128);
+	//testCompressedCola<int32_t>(16);
+	//testCompressedCola<int32_t>(128);
+	//testClone<BasicCOLA>();
+	//testClone<DeamortizedCOLA>();
+	//testClone<LookaheadCOLA>();
+	//testClone<AVXBasicCOLA>();
+	//testClone<AVXDeamortizedCOLA>();
+	//testRankSelect<BasicCOLA, int64_t>();
+	//testRankSelect<DeamortizedCOLA, int64_t>();
+	//testRankSelect<AVXBasicCOLA, int32_t>();
+	//testFreezeThaw();
+	//testSetOperations();
+	//testDedupCola();
+	//testAppendSorted<BasicCOLA>();
+	//testAppendSorted<AVXBasicCOLA>();
+	//testFloatCola();
+	//testStringCola();
+	//testCompositeCola();
 
 	system("PAUSE");
 	timeInsertRandom<AVXDeamortizedCOLA, 30>();
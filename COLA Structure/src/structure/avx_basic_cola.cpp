@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <algorithm>
+#include <limits>
 #include <immintrin.h>
 
 #ifndef BASIC_PARALLEL_MERGE
@@ -12,37 +13,213 @@
 #define BASIC_MERGE_UNSAFE_CAST 1
 #endif // !BASIC_MERGE_UNSAFE_CAST
 
+#ifndef BASIC_INSERT_BUFFER
+// Collect inserted elements unsorted in place of the smallest layers, such
+// that most inserts do not merge. When full, the buffer is sorted with a
+// sorting network and pushed as one layer of BASIC_INSERT_BUFFER_SIZE.
+#define BASIC_INSERT_BUFFER 1
+#endif // !BASIC_INSERT_BUFFER
+
+#ifndef BASIC_STREAM_THRESHOLD
+// Merged layers of at least this many elements are written with non-temporal
+// stores that bypass the caches, such that writing a layer much larger than
+// the last level cache does not evict the small layers. Zero disables it.
+#define BASIC_STREAM_THRESHOLD (static_cast<uint32_t>(1) << 22)
+#endif // !BASIC_STREAM_THRESHOLD
+
+#ifndef BASIC_PREFETCH_DISTANCE
+// Number of elements ahead to prefetch the inputs of streamed merges.
+#define BASIC_PREFETCH_DISTANCE 128
+#endif // !BASIC_PREFETCH_DISTANCE
+
 #ifndef BASIC_PARALLEL_SEARCH
 // Note: Parallel search is slower than the sequential search in
 // almost all cases because of excessive and frequent cache misses.
 #define BASIC_PARALLEL_SEARCH 1
 #endif // !BASIC_PARALLEL_SEARCH
 
-AVXBasicCOLA::AVXBasicCOLA(uint32_t initialCapacity) :
-	m_DataUnaligned(nullptr),
+#ifndef BASIC_VERTICAL_SEARCH
+// Search batches of eight values in the same layer at once, instead of one
+// value in eight layers at once. The upper levels of the LEADBIT search are
+// shared by the values, so they stay in cache.
+#define BASIC_VERTICAL_SEARCH 1
+#endif // !BASIC_VERTICAL_SEARCH
+
+static int32_t* alignData(int32_t* unalignedPtr)
+{
+#if BASIC_PARALLEL_MERGE && BASIC_MERGE_UNSAFE_CAST
+	// Data must be aligned to 32 bytes (256 bits) when using parallel search. This
+	// will then align elements used for bitonic merges at 32 bytes (256 bits).
+	// Ensure that we have an alignment with lower bits as zero.
+	return (int32_t*)(((uintptr_t)unalignedPtr + 31) & ~(uintptr_t)0x1F);
+#else
+	return unalignedPtr;
+#endif
+}
+
+#if BASIC_PARALLEL_SEARCH
+#ifndef BASIC_GATHER_LAYER_LIMIT
+// Largest layer that is searched with gathers. The gathers take signed 32-bit
+// offsets, which are relative to the largest layer of each block of layers,
+// and therefore reach all layers of a block of at most 2^31 elements.
+#define BASIC_GATHER_LAYER_LIMIT (static_cast<AVXIndex>(1) << 31)
+#endif // !BASIC_GATHER_LAYER_LIMIT
+
+static inline __m256i gatherLayers(const int32_t* layer, __m256i _base, __m256i _r)
+{
+	// Load layer[r - base] for each lane, where base is the index of layer
+	return _mm256_i32gather_epi32(layer, _mm256_sub_epi32(_r, _base), sizeof(int32_t));
+}
+
+static int32_t horizontalMax(__m256i _x)
+{
+	// Reduce the two halves and then pairs within the remaining half
+	__m128i _h = _mm_max_epi32(_mm256_castsi256_si128(_x), _mm256_extracti128_si256(_x, 1));
+	_h = _mm_max_epi32(_h, _mm_shuffle_epi32(_h, _MM_SHUFFLE(1, 0, 3, 2)));
+	_h = _mm_max_epi32(_h, _mm_shuffle_epi32(_h, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(_h);
+}
+
+static int32_t horizontalMin(__m256i _x)
+{
+	__m128i _h = _mm_min_epi32(_mm256_castsi256_si128(_x), _mm256_extracti128_si256(_x, 1));
+	_h = _mm_min_epi32(_h, _mm_shuffle_epi32(_h, _MM_SHUFFLE(1, 0, 3, 2)));
+	_h = _mm_min_epi32(_h, _mm_shuffle_epi32(_h, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(_h);
+}
+#endif
+
+#if BASIC_INSERT_BUFFER
+template<bool GREATER>
+static uint32_t bufferCompareMask(const int32_t* data, uint32_t bufferSize, int32_t value)
+{
+	// Compare the 16 elements at the start of the data with value at once
+	// (equal or greater), masking out index 0 and the unused buffer part.
+	const __m256i _z = _mm256_set1_epi32(value);
+	const __m256i _lo = _mm256_loadu_si256((const __m256i*)&data[0]);
+	const __m256i _hi = _mm256_loadu_si256((const __m256i*)&data[8]);
+	const __m256i _mlo = GREATER ? _mm256_cmpgt_epi32(_lo, _z) : _mm256_cmpeq_epi32(_lo, _z);
+	const __m256i _mhi = GREATER ? _mm256_cmpgt_epi32(_hi, _z) : _mm256_cmpeq_epi32(_hi, _z);
+	const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mlo))) |
+		(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mhi))) << 8);
+	return mask & (((static_cast<uint32_t>(1) << bufferSize) - 1) << 1);
+}
+#endif
+
+static const std::shared_ptr<int32_t>& emptyBlock()
+{
+	// Block of minimum capacity left behind by moves. It is always
+	// shared, so it is copied before anything is written to it.
+	static const std::shared_ptr<int32_t> block = allocateShared<int32_t>(16 + 8);
+	return block;
+}
+
+AVXBasicCOLA::AVXBasicCOLA(AVXIndex initialCapacity) :
+	m_DataUnaligned(),
 	m_Data(nullptr),
 	m_Capacity(0),
-	m_Size(0)
+	m_Size(0),
+	m_BufferSize(0),
+	m_BufferSorted(true),
+	m_Fences(),
+	m_ModelLayers(0),
+	m_Tree(),
+	m_Frozen(false)
 {
 	// Capacity must be a power of two (and greater than zero)
-	m_Capacity = std::max(static_cast<uint32_t>(16), nextPO2MinusOne(initialCapacity - 1) + 1);
+	m_Capacity = std::max(static_cast<AVXIndex>(16), nextPO2MinusOne(initialCapacity - 1) + 1);
 	allocateData(m_DataUnaligned, m_Data, m_Capacity);
 }
 
 AVXBasicCOLA::AVXBasicCOLA(const AVXBasicCOLA& other) :
-	m_DataUnaligned(nullptr),
+	m_DataUnaligned(),
 	m_Data(nullptr),
 	m_Capacity(other.m_Capacity),
-	m_Size(other.m_Size)
+	m_Size(other.m_Size),
+	m_BufferSize(other.m_BufferSize),
+	m_BufferSorted(other.m_BufferSorted),
+	m_Fences(other.m_Fences),
+	m_ModelLayers(other.m_ModelLayers),
+	m_Tree(other.m_Tree),
+	m_Frozen(other.m_Frozen)
 {
 	allocateData(m_DataUnaligned, m_Data, m_Capacity);
 	// Copy instead of pointing to the same memory.
 	memcpy(m_Data, other.m_Data, other.m_Capacity * sizeof(int32_t));
+	std::copy(other.m_Models, other.m_Models + sizeof(AVXIndex) * 8, m_Models);
+}
+
+AVXBasicCOLA::AVXBasicCOLA(AVXBasicCOLA&& other) noexcept :
+	m_DataUnaligned(std::move(other.m_DataUnaligned)),
+	m_Data(other.m_Data),
+	m_Capacity(other.m_Capacity),
+	m_Size(other.m_Size),
+	m_BufferSize(other.m_BufferSize),
+	m_BufferSorted(other.m_BufferSorted),
+	m_Fences(other.m_Fences),
+	m_ModelLayers(other.m_ModelLayers),
+	m_Tree(std::move(other.m_Tree)),
+	m_Frozen(other.m_Frozen)
+{
+	std::move(other.m_Models, other.m_Models + sizeof(AVXIndex) * 8, m_Models);
+
+	// Leave the other cola empty, but still usable.
+	other.releaseData();
+	other.m_Size = 0;
+	other.m_BufferSize = 0;
+	other.m_BufferSorted = true;
+	other.m_Tree = StaticSearchTree();
+	other.m_Frozen = false;
+}
+
+AVXBasicCOLA::~AVXBasicCOLA() { }
+
+AVXBasicCOLA& AVXBasicCOLA::operator=(AVXBasicCOLA&& other) noexcept
+{
+	if (this != &other)
+	{
+		m_DataUnaligned = std::move(other.m_DataUnaligned);
+		m_Data = other.m_Data;
+		m_Capacity = other.m_Capacity;
+		m_Size = other.m_Size;
+		m_BufferSize = other.m_BufferSize;
+		m_BufferSorted = other.m_BufferSorted;
+		m_Fences = other.m_Fences;
+		std::move(other.m_Models, other.m_Models + sizeof(AVXIndex) * 8, m_Models);
+		m_ModelLayers = other.m_ModelLayers;
+		m_Tree = std::move(other.m_Tree);
+		m_Frozen = other.m_Frozen;
+
+		other.releaseData();
+		other.m_Size = 0;
+		other.m_BufferSize = 0;
+		other.m_BufferSorted = true;
+		other.m_Tree = StaticSearchTree();
+		other.m_Frozen = false;
+	}
+
+	return *this;
 }
 
-AVXBasicCOLA::~AVXBasicCOLA()
+AVXBasicCOLA AVXBasicCOLA::clone() const
 {
-	delete[] m_DataUnaligned;
+	AVXBasicCOLA cola(16);
+
+	// Share the data block instead of copying it.
+	cola.m_DataUnaligned = m_DataUnaligned;
+	cola.m_Data = m_Data;
+	cola.m_Capacity = m_Capacity;
+	cola.m_Size = m_Size;
+	cola.m_BufferSize = m_BufferSize;
+	cola.m_BufferSorted = m_BufferSorted;
+	cola.m_Fences = m_Fences;
+	std::copy(m_Models, m_Models + sizeof(AVXIndex) * 8, cola.m_Models);
+	cola.m_ModelLayers = m_ModelLayers;
+	// The frozen form is never modified, so it can always be shared.
+	cola.m_Tree = m_Tree;
+	cola.m_Frozen = m_Frozen;
+
+	return cola;
 }
 
 #if BASIC_PARALLEL_MERGE
@@ -83,6 +260,26 @@ static inline void store8x32i(int32_t* dst, __m256i src)
 #endif
 }
 
+static inline void storeMerged8x32i(int32_t* dst, __m256i src, bool stream)
+{
+#if BASIC_MERGE_UNSAFE_CAST
+	// Streaming stores require the data to be aligned
+	if (stream)
+	{
+		_mm256_stream_si256((__m256i*)dst, src);
+		return;
+	}
+#endif
+	store8x32i(dst, src);
+}
+
+static inline void prefetchMerged(const int32_t* src)
+{
+	// Inputs of streamed merges are not read again before the merged layer
+	// is, so they are fetched without polluting the caches.
+	_mm_prefetch((const char*)&src[BASIC_PREFETCH_DISTANCE], _MM_HINT_NTA);
+}
+
 static inline void minmax(__m256i& _a, __m256i& _b, __m256i& _mn, __m256i& _mx)
 {
 	_mn = _mm256_min_epi32(_a, _b);
@@ -135,36 +332,133 @@ static inline void bitonicMerge8x8(__m256i& _a, __m256i& _b)
 	_a = _mm256_blend_epi32(_mna, _mxa, 0b10101010);
 	_b = _mm256_blend_epi32(_mnb, _mxb, 0b10101010);
 }
+
+/* Compare-exchange patterns of the sorting network for eight elements */
+static const __m256i _flip1_idx = _mm256_set_epi32(6, 7, 4, 5, 2, 3, 0, 1);
+static const __m256i _flip3_idx = _mm256_set_epi32(4, 5, 6, 7, 0, 1, 2, 3);
+static const __m256i _flip7_idx = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+static const __m256i _half2_idx = _mm256_set_epi32(5, 4, 7, 6, 1, 0, 3, 2);
+
+template<int MASK>
+static inline void compareExchange(__m256i& _a, const __m256i& _idx)
+{
+	// Compare each element with the element at idx, keeping the minimum
+	// at the lower index (the lanes in MASK get the maximum).
+	const __m256i _b = _mm256_permutevar8x32_epi32(_a, _idx);
+	_a = _mm256_blend_epi32(_mm256_min_epi32(_a, _b), _mm256_max_epi32(_a, _b), MASK);
+}
+
+static inline void bitonicSort8(__m256i& _a)
+{
+	// Bitonic sorting network where the first step of each merge compares
+	// mirrored elements, such that all comparisons are ascending.
+	compareExchange<0b10101010>(_a, _flip1_idx);
+
+	compareExchange<0b11001100>(_a, _flip3_idx);
+	compareExchange<0b10101010>(_a, _flip1_idx);
+
+	compareExchange<0b11110000>(_a, _flip7_idx);
+	compareExchange<0b11001100>(_a, _half2_idx);
+	compareExchange<0b10101010>(_a, _flip1_idx);
+}
 #endif
 
 void AVXBasicCOLA::add(int32_t value)
 {
-	const uint32_t nSize = m_Size + 1;
+	insert<false>(value);
+}
+
+void AVXBasicCOLA::appendSorted(int32_t value)
+{
+	insert<true>(value);
+}
+
+template<bool SORTED>
+void AVXBasicCOLA::insert(int32_t value)
+{
+	if (m_Frozen)
+		thaw();
+
+#if BASIC_INSERT_BUFFER
+	// Number of elements pushed to the layers, which is either none or the
+	// full buffer and the value.
+	const AVXIndex count = (m_BufferSize + 1 == BASIC_INSERT_BUFFER_SIZE) ? BASIC_INSERT_BUFFER_SIZE : 0;
+#else
+	const AVXIndex count = 1;
+#endif
+
+	const AVXIndex nSize = m_Size + count;
 	if (nSize >= m_Capacity)
 	{
 		// Allocate a new layer
 		reallocData(m_Capacity << 1);
 	}
+	else if (isShared(m_DataUnaligned))
+	{
+		// The merge would overwrite layers of a clone, copy the data first.
+		// Layers are stored contiguously, so the entire block is copied.
+		reallocData(m_Capacity);
+	}
 
-	// Find first position of empty array (merge-layer)
-	const uint32_t m = leastZeroBits(nSize) + 1;
-	const uint32_t mEnd = m << 1;
+#if BASIC_INSERT_BUFFER
+	if (count == 0)
+	{
+		// Buffer elements are stored from index one
+		m_Data[++m_BufferSize] = value;
+		m_BufferSorted &= SORTED;
+		return;
+	}
+#endif
 
-	m_Data[mEnd - 1] = value;
+	// Find first position of empty array (merge-layer)
+	const AVXIndex m = leastZeroBits(nSize) + 1;
+	const AVXIndex mEnd = m << 1;
 
 	// Iteratively merge arrays
-	uint32_t i = 1;
+	AVXIndex i = 1;
+
+#if BASIC_INSERT_BUFFER
+	// The value and the buffer (index 0 is not used by any layer) are
+	// sorted and stored as the first elements of the merged layer.
+	if (SORTED && m_BufferSorted)
+	{
+		// The buffer only holds sorted appends and is followed by the value
+		std::copy(&m_Data[1], &m_Data[BASIC_INSERT_BUFFER_SIZE], &m_Data[mEnd - BASIC_INSERT_BUFFER_SIZE]);
+		m_Data[mEnd - 1] = value;
+	}
+	else
+	{
+		m_Data[0] = value;
+#if BASIC_PARALLEL_MERGE
+		__m256i _lo = load8x32i(&m_Data[0]);
+		__m256i _hi = load8x32i(&m_Data[BASIC_BITONIC_SORT_COUNT]);
+		bitonicSort8(_lo);
+		bitonicSort8(_hi);
+		bitonicMerge8x8(_lo, _hi);
+		store8x32i(&m_Data[mEnd - BASIC_INSERT_BUFFER_SIZE], _lo);
+		store8x32i(&m_Data[mEnd - BASIC_BITONIC_SORT_COUNT], _hi);
+#else
+		std::sort(&m_Data[0], &m_Data[BASIC_INSERT_BUFFER_SIZE]);
+		std::copy(&m_Data[0], &m_Data[BASIC_INSERT_BUFFER_SIZE], &m_Data[mEnd - BASIC_INSERT_BUFFER_SIZE]);
+#endif
+	}
+	m_BufferSize = 0;
+	m_BufferSorted = true;
+	i = BASIC_INSERT_BUFFER_SIZE;
+#else
+	m_Data[mEnd - 1] = value;
+#endif
 
 #if BASIC_PARALLEL_MERGE
 	// Merge the first eight elements (three layers) sequentially
 	while (i < BASIC_BITONIC_SORT_COUNT && i != m)
 	{
 		// Index after last element in current layer
-		const uint32_t iEnd = i << 1;
+		const AVXIndex iEnd = i << 1;
 
 		// Index of first element in merging layer and new index
-		uint32_t j = mEnd - i;
-		uint32_t k = mEnd - iEnd;
+		AVXIndex j = mEnd - i;
+		AVXIndex k = mEnd - iEnd;
 
 		// Simple merge sort (ascending order)
 		while (i != iEnd && j != mEnd)
@@ -181,12 +475,12 @@ void AVXBasicCOLA::add(int32_t value)
 	}
 
 	// Sort remaining elements using AVX
-	if (i != m)
+	if (i == BASIC_BITONIC_SORT_COUNT && i != m)
 	{
 		// At this point we know that we can sort the next eight
 		// elements. This can be done with a single bitonic sort.
-		uint32_t j = mEnd - BASIC_BITONIC_SORT_COUNT;
-		uint32_t k = mEnd - 2 * BASIC_BITONIC_SORT_COUNT;
+		AVXIndex j = mEnd - BASIC_BITONIC_SORT_COUNT;
+		AVXIndex k = mEnd - 2 * BASIC_BITONIC_SORT_COUNT;
 
 		__m256i _a, _b;
 
@@ -206,83 +500,110 @@ void AVXBasicCOLA::add(int32_t value)
 		// Store higher half of sorted vectors
 		store8x32i(&m_Data[k], _b);
 		//k += BASIC_BITONIC_SORT_COUNT;
+	}
 
-		// Sort remaining elements (layers have size 16 * 2^(l - 4))
-		while (i != m)
-		{
-			// Index after last element in current layer
-			const uint32_t iEnd = i << 1;
-
-			// Index of first element in merging layer and new index
-			j = mEnd - i;
-			k = mEnd - iEnd;
+	// Sort remaining elements (layers have size 16 * 2^(l - 4))
+	while (i != m)
+	{
+		// Index after last element in current layer
+		const AVXIndex iEnd = i << 1;
 
-			_a = load8x32i(&m_Data[i]);
-			_b = load8x32i(&m_Data[j]);
+		// Index of first element in merging layer and new index
+		AVXIndex j = mEnd - i;
+		AVXIndex k = mEnd - iEnd;
 
-			i += BASIC_BITONIC_SORT_COUNT;
-			j += BASIC_BITONIC_SORT_COUNT;
+		// Copy the layers if they cover disjoint ranges
+		if (mergeDisjoint(m_Data, i, j, k, i))
+		{
+			i = iEnd;
+			continue;
+		}
 
-			do
-			{
-				bitonicMerge8x8(_a, _b);
+		// Merged layer is the size of the output
+		const bool stream = (BASIC_STREAM_THRESHOLD != 0 && iEnd >= BASIC_STREAM_THRESHOLD);
 
-				// Store lower elements (smallest elements both layers)
-				store8x32i(&m_Data[k], _a);
-				k += BASIC_BITONIC_SORT_COUNT;
+		__m256i _a = load8x32i(&m_Data[i]);
+		__m256i _b = load8x32i(&m_Data[j]);
 
-				if (m_Data[i] < m_Data[j])
-				{
-					_a = load8x32i(&m_Data[i]);
-					i += BASIC_BITONIC_SORT_COUNT;
-				}
-				else
-				{
-					_a = load8x32i(&m_Data[j]);
-					j += BASIC_BITONIC_SORT_COUNT;
-				}
-			} while (i != iEnd && j != mEnd);
+		i += BASIC_BITONIC_SORT_COUNT;
+		j += BASIC_BITONIC_SORT_COUNT;
 
-			// At least one pair is remaining to be merged
+		do
+		{
 			bitonicMerge8x8(_a, _b);
-			store8x32i(&m_Data[k], _a);
+
+			// Store lower elements (smallest elements both layers)
+			storeMerged8x32i(&m_Data[k], _a, stream);
 			k += BASIC_BITONIC_SORT_COUNT;
 
-			// Sort remaining elements from current layer
-			while (i != iEnd)
+			if (stream)
+			{
+				prefetchMerged(&m_Data[i]);
+				prefetchMerged(&m_Data[j]);
+			}
+
+			if (m_Data[i] < m_Data[j])
 			{
 				_a = load8x32i(&m_Data[i]);
 				i += BASIC_BITONIC_SORT_COUNT;
-				bitonicMerge8x8(_a, _b);
-				store8x32i(&m_Data[k], _a);
-				k += BASIC_BITONIC_SORT_COUNT;
 			}
-
-			// Sort remaining elements from merging layer
-			while (j != mEnd)
+			else
 			{
 				_a = load8x32i(&m_Data[j]);
 				j += BASIC_BITONIC_SORT_COUNT;
-				bitonicMerge8x8(_a, _b);
-				store8x32i(&m_Data[k], _a);
-				k += BASIC_BITONIC_SORT_COUNT;
 			}
+		} while (i != iEnd && j != mEnd);
+
+		// At least one pair is remaining to be merged
+		bitonicMerge8x8(_a, _b);
+		storeMerged8x32i(&m_Data[k], _a, stream);
+		k += BASIC_BITONIC_SORT_COUNT;
 
-			// Store the remaining pair of higher elements.
-			store8x32i(&m_Data[k], _b);
-			//k += BASIC_BITONIC_SORT_COUNT;
+		// Sort remaining elements from current layer
+		while (i != iEnd)
+		{
+			_a = load8x32i(&m_Data[i]);
+			i += BASIC_BITONIC_SORT_COUNT;
+			bitonicMerge8x8(_a, _b);
+			storeMerged8x32i(&m_Data[k], _a, stream);
+			k += BASIC_BITONIC_SORT_COUNT;
+		}
+
+		// Sort remaining elements from merging layer
+		while (j != mEnd)
+		{
+			_a = load8x32i(&m_Data[j]);
+			j += BASIC_BITONIC_SORT_COUNT;
+			bitonicMerge8x8(_a, _b);
+			storeMerged8x32i(&m_Data[k], _a, stream);
+			k += BASIC_BITONIC_SORT_COUNT;
 		}
+
+		// Store the remaining pair of higher elements.
+		storeMerged8x32i(&m_Data[k], _b, stream);
+		//k += BASIC_BITONIC_SORT_COUNT;
+
+		// Order the streaming stores before the next merge reads the layer
+		if (stream)
+			_mm_sfence();
 	}
 #else
 	// Sequential fallback implementation
 	while (i != m)
 	{
 		// Index after last element in current layer
-		const uint32_t iEnd = i << 1;
+		const AVXIndex iEnd = i << 1;
 
 		// Index of first element in merging layer and new index
-		uint32_t j = mEnd - i;
-		uint32_t k = mEnd - iEnd;
+		AVXIndex j = mEnd - i;
+		AVXIndex k = mEnd - iEnd;
+
+		// Copy the layers if they cover disjoint ranges
+		if (mergeDisjoint(m_Data, i, j, k, i))
+		{
+			i = iEnd;
+			continue;
+		}
 
 		// Simple merge sort (ascending order)
 		while (i != iEnd && j != mEnd)
@@ -299,6 +620,9 @@ void AVXBasicCOLA::add(int32_t value)
 	}
 #endif
 
+	// Layer m has been replaced by the merge
+	m_Fences.set(popcount(m - 1), m_Data[m], m_Data[mEnd - 1]);
+	fitModel(m);
 	m_Size = nSize;
 }
 
@@ -326,26 +650,59 @@ bool AVXBasicCOLA::contains(int32_t value) const
 	// Since the size of the remaining layers are always a power of two,
 	// we have that P = N and we do not need to include padding elements.
 
+	if (m_Frozen)
+		return m_Tree.contains(value);
+
+#if BASIC_INSERT_BUFFER
+	// Scan the unsorted insert buffer
+	if (m_BufferSize != 0 && bufferCompareMask<false>(m_Data, m_BufferSize, value) != 0)
+		return true;
+#endif
+
+	// Layers with a model are searched with it, and left out below
+	for (AVXIndex modelled = m_Size & m_ModelLayers; modelled != 0; modelled &= modelled - 1)
+	{
+		const AVXIndex q = modelled & (~modelled + 1);
+		const uint8_t l = popcount(q - 1);
+		if (!m_Fences.excludes(l, value) && m_Data[m_Models[l].search(value, m_Data, q, q << 1)] == value)
+			return true;
+	}
+
+	const AVXIndex searched = m_Size & ~m_ModelLayers;
+
 	// Compute P = N ? 2^floor(log2(N - 1)) : 0 of the last layer.
-	uint32_t p = (nextPO2MinusOne(m_Size) >> 1) + 1;
+	AVXIndex p = (nextPO2MinusOne(searched) >> 1) + 1;
 
 #if BASIC_PARALLEL_SEARCH
+#if AVX_64BIT_INDEX
+	// Search the layers that are too large for the gathers sequentially
+	for (; p > BASIC_GATHER_LAYER_LIMIT; p >>= 1)
+	{
+		if ((searched & p) && !m_Fences.excludes(popcount(p - 1), value) && m_Data[leadbitSearch(value, m_Data, p, p)] == value)
+			return true;
+	}
+#endif
+
 	// Nearby layers will be searched in parallel, such that when searching
 	// layer l, we also search l + 1, ..., l + 7 in parallel. This results
 	// in at most seven redundant iterations for layer l.
-	__m256i _i, _k, _p, _r, _z, _x, _mask1, _mask2, _zero, _size;
+	__m256i _i, _k, _p, _r, _z, _x, _mask1, _mask2, _zero, _size, _base, _min, _max;
 
-	// Prepare constants used for checks
+	// Prepare constants used for checks. Only the layers of at most 2^31
+	// elements are left, so only the lower 32 bits of the size are needed.
 	_zero = _mm256_set1_epi32(0u);
-	_size = _mm256_set1_epi32(m_Size);
+	_size = _mm256_set1_epi32(static_cast<int32_t>(searched));
 	// Prepare a vector with search value
 	_z = _mm256_set1_epi32(value);
 	// Prepare end of the first layers to be searched
 	_p = _mm256_set_epi32(p, p >> 1, p >> 2, p >> 3,
 		p >> 4, p >> 5, p >> 6, p >> 7);
 
+	// Index of the largest layer in the current block, p = 2^l
+	ptrdiff_t l = popcount(p - 1);
+
 	// Comments for 4 element vectors (we now have 8).
-	for (; p != 0; p >>= 8)
+	for (; p != 0; p >>= 8, l -= 8)
 	{
 		// Compute non-zero values for layers that are non-empty in the current block
 		// mask1 = p & size
@@ -361,12 +718,24 @@ bool AVXBasicCOLA::contains(int32_t value) const
 		//       = |00...00|00...00|00...00|11...11| // Shortened for better comments
 		_mask1 = _mm256_cmpeq_epi32(_mask1, _zero);
 
+		// Also treat the layers whose fences exclude the value as empty. The
+		// fences of the layers l - 7, ..., l are consecutive, like the lanes.
+		// mask1 = mask1 OR (min > z) OR (z > max)
+		_min = _mm256_loadu_si256((const __m256i*)m_Fences.min(l - 7));
+		_max = _mm256_loadu_si256((const __m256i*)m_Fences.max(l - 7));
+		_mask1 = _mm256_or_si256(_mask1, _mm256_or_si256(_mm256_cmpgt_epi32(_min, _z), _mm256_cmpgt_epi32(_z, _max)));
+
 		// Check if we should search layers (i.e. if not all layers are empty).
 		// i.e. if either of the masks are non-one, search the layers.
 		//     |00...00|00...00|00...00|11...11| != |11...11| =>
 		//     |   0   |   0   |   0   |   1   | != 0b1111
 		if (_mm256_movemask_ps(_mm256_castsi256_ps(_mask1)) != 0b11111111)
 		{
+			// Elements are loaded relative to the first layer, p, such
+			// that the offsets of all layers in the block fit in 32 bits.
+			const int32_t* layer = &m_Data[p];
+			_base = _mm256_set1_epi32(static_cast<int32_t>(p));
+
 			// Prepare index of first element in each of the four layers.
 			// i = p
 			_i = _p;
@@ -400,7 +769,7 @@ bool AVXBasicCOLA::contains(int32_t value) const
 			// Load the elements in each of the layers from their respective index.
 			// x = m_Data[r]
 			//   = |m_Data[0...11000...0]|m_Data[0...01100...0]|m_Data[0...00110...0]|m_Data[0...00011...0]|
-			_x = _mm256_i32gather_epi32(m_Data, _r, sizeof(int32_t));
+			_x = gatherLayers(layer, _base, _r);
 
 			// Compute comparison mask for x > z for each of the four layers.
 			// mask2 = if (x > z)
@@ -449,7 +818,7 @@ bool AVXBasicCOLA::contains(int32_t value) const
 
 			// Load the resulting elements in each of the layers.
 			// x = m_Data[i]
-			_x = _mm256_i32gather_epi32(m_Data, _i, sizeof(int32_t));
+			_x = gatherLayers(layer, _base, _i);
 
 			// Searching has finished. Check if found elements are equal.
 			// if (z == x)
@@ -475,14 +844,14 @@ bool AVXBasicCOLA::contains(int32_t value) const
 	// Sequential fallback implementation
 	for (; p != 0; p >>= 1)
 	{
-		uint32_t i = p;
-		uint32_t k = i >> 1;
+		AVXIndex i = p;
+		AVXIndex k = i >> 1;
 
-		if (m_Size & i)
+		if ((searched & i) && !m_Fences.excludes(popcount(p - 1), value))
 		{
 			do
 			{
-				uint32_t r = i | k;
+				AVXIndex r = i | k;
 				if (value >= m_Data[r])
 					i = r;
 				k >>= 1;
@@ -497,33 +866,612 @@ bool AVXBasicCOLA::contains(int32_t value) const
 	return false;
 }
 
-void AVXBasicCOLA::allocateData(int32_t*& unalignedPtr, int32_t*& alignedPtr, uint32_t capacity) const
+void AVXBasicCOLA::containsBatch(const int32_t* values, size_t count, bool* results) const
+{
+	if (m_Frozen)
+	{
+		for (size_t j = 0; j < count; j++)
+			results[j] = m_Tree.contains(values[j]);
+		return;
+	}
+
+#if BASIC_VERTICAL_SEARCH
+	// Layers of more than 2^31 elements can not be reached by the signed
+	// 32-bit offsets of the gathers, and are searched per value.
+	const AVXIndex gatherLimit = static_cast<AVXIndex>(1) << 31;
+	const __m256i _ones = _mm256_set1_epi32(-1);
+
+	for (size_t b = 0; b < count; b += 8)
+	{
+		// Fill the lanes past the last value with the first value of the batch
+		const size_t n = std::min(count - b, static_cast<size_t>(8));
+		int32_t batch[8];
+		for (size_t j = 0; j < 8; j++)
+			batch[j] = values[b + ((j < n) ? j : 0)];
+
+		const __m256i _z = _mm256_loadu_si256((const __m256i*)batch);
+		__m256i _found = _mm256_setzero_si256();
+
+#if BASIC_INSERT_BUFFER
+		// Compare the values with each element of the unsorted insert buffer
+		for (uint32_t j = 1; j <= m_BufferSize; j++)
+			_found = _mm256_or_si256(_found, _mm256_cmpeq_epi32(_z, _mm256_set1_epi32(m_Data[j])));
+#endif
+
+		// Search the layers from the largest, which holds most elements,
+		// until all values are found.
+		for (AVXIndex layers = m_Size; layers != 0 && _mm256_movemask_ps(_mm256_castsi256_ps(_found)) != 0xFF;)
+		{
+			const AVXIndex p = (nextPO2MinusOne(layers) >> 1) + 1;
+			const uint8_t l = popcount(p - 1);
+			layers &= ~p;
+
+			// Lanes that are not found yet, and whose values are within the fences
+			__m256i _skip = _mm256_or_si256(_found, _mm256_cmpgt_epi32(_mm256_set1_epi32(*m_Fences.min(l)), _z));
+			_skip = _mm256_or_si256(_skip, _mm256_cmpgt_epi32(_z, _mm256_set1_epi32(*m_Fences.max(l))));
+			const int skipMask = _mm256_movemask_ps(_mm256_castsi256_ps(_skip));
+			if (skipMask == 0xFF)
+				continue;
+
+			// Layer p is at indices [p, 2p)
+			const int32_t* layer = &m_Data[p];
+			if (p > gatherLimit)
+			{
+				for (size_t j = 0; j < n; j++)
+				{
+					if (((skipMask >> j) & 0x1) == 0 && m_Data[leadbitSearch(batch[j], m_Data, p, p)] == batch[j])
+						_found = _mm256_or_si256(_found, _mm256_cmpeq_epi32(_z, _mm256_set1_epi32(batch[j])));
+				}
+				continue;
+			}
+
+			// LEADBIT search of all lanes in lockstep, where i is the offset
+			// in the layer and x the element at it. Skipped lanes do not load.
+			const __m256i _active = _mm256_xor_si256(_skip, _ones);
+			__m256i _i = _mm256_setzero_si256();
+			__m256i _x = _mm256_set1_epi32(layer[0]);
+			for (AVXIndex k = p >> 1; k != 0; k >>= 1)
+			{
+				const __m256i _r = _mm256_or_si256(_i, _mm256_set1_epi32(static_cast<int32_t>(k)));
+				const __m256i _xr = _mm256_mask_i32gather_epi32(_x, layer, _r, _active, sizeof(int32_t));
+
+				// i = r and x = x_r where z >= x_r
+				const __m256i _greater = _mm256_cmpgt_epi32(_xr, _z);
+				_i = _mm256_blendv_epi8(_r, _i, _greater);
+				_x = _mm256_blendv_epi8(_xr, _x, _greater);
+			}
+
+			_found = _mm256_or_si256(_found, _mm256_and_si256(_active, _mm256_cmpeq_epi32(_x, _z)));
+		}
+
+		const int foundMask = _mm256_movemask_ps(_mm256_castsi256_ps(_found));
+		for (size_t j = 0; j < n; j++)
+			results[b + j] = ((foundMask >> j) & 0x1) != 0;
+	}
+#else
+	// Sequential fallback implementation
+	for (size_t j = 0; j < count; j++)
+		results[j] = contains(values[j]);
+#endif
+}
+
+_Neighbors<int32_t> AVXBasicCOLA::neighbors(int32_t value) const
+{
+	// Same LEADBIT search as in contains, except that the search does not
+	// stop at the first layer. For each layer, the found element and the
+	// element after it are candidates, and the best candidates across all
+	// layers are kept in vectors and reduced with min/max.
+	_Neighbors<int32_t> neighbors;
+
+	if (m_Frozen)
+	{
+		// The first element not less than value is the successor, and
+		// the element before it is the predecessor unless they are equal.
+		const size_t i = m_Tree.lowerBound(value);
+		const int32_t* data = m_Tree.data();
+
+		if (i < m_Size)
+			neighbors.addSuccessor(data[i]);
+		if (i < m_Size && data[i] == value)
+			neighbors.addPredecessor(value);
+		else if (i > 0)
+			neighbors.addPredecessor(data[i - 1]);
+		return neighbors;
+	}
+
+#if BASIC_INSERT_BUFFER
+	for (uint32_t i = 1; i <= m_BufferSize; i++)
+	{
+		if (m_Data[i] <= value)
+			neighbors.addPredecessor(m_Data[i]);
+		if (m_Data[i] >= value)
+			neighbors.addSuccessor(m_Data[i]);
+	}
+
+	if (neighbors.isExact(value))
+		return neighbors;
+#endif
+
+	for (AVXIndex modelled = m_Size & m_ModelLayers; modelled != 0; modelled &= modelled - 1)
+	{
+		const AVXIndex q = modelled & (~modelled + 1);
+		neighbors.addSearchResult(value, m_Data, m_Models[popcount(q - 1)].search(value, m_Data, q, q << 1), q << 1);
+
+		if (neighbors.isExact(value))
+			return neighbors;
+	}
+
+	const AVXIndex searched = m_Size & ~m_ModelLayers;
+	AVXIndex p = (nextPO2MinusOne(searched) >> 1) + 1;
+
+#if BASIC_PARALLEL_SEARCH
+#if AVX_64BIT_INDEX
+	for (; p > BASIC_GATHER_LAYER_LIMIT; p >>= 1)
+	{
+		if (searched & p)
+		{
+			neighbors.addSearchResult(value, m_Data, leadbitSearch(value, m_Data, p, p), p << 1);
+
+			if (neighbors.isExact(value))
+				return neighbors;
+		}
+	}
+#endif
+
+	__m256i _i, _k, _p, _r, _z, _x, _y, _mask1, _mask2, _last, _zero, _one, _ones, _size, _base;
+	__m256i _predecessor, _successor, _predecessorMissing, _successorMissing;
+
+	_zero = _mm256_set1_epi32(0u);
+	_one = _mm256_set1_epi32(1u);
+	_ones = _mm256_cmpeq_epi32(_zero, _zero);
+	_size = _mm256_set1_epi32(static_cast<int32_t>(searched));
+	_z = _mm256_set1_epi32(value);
+	_p = _mm256_set_epi32(p, p >> 1, p >> 2, p >> 3,
+		p >> 4, p >> 5, p >> 6, p >> 7);
+
+	// Best candidates so far, and masks of the lanes without any candidate
+	_predecessor = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+	_successor = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+	_predecessorMissing = _ones;
+	_successorMissing = _ones;
+
+	for (; p != 0; p >>= 8)
+	{
+		// Mask of the layers that are empty in the current block
+		_mask1 = _mm256_cmpeq_epi32(_mm256_and_si256(_p, _size), _zero);
+
+		if (_mm256_movemask_ps(_mm256_castsi256_ps(_mask1)) != 0b11111111)
+		{
+			const int32_t* layer = &m_Data[p];
+			_base = _mm256_set1_epi32(static_cast<int32_t>(p));
+			_i = _mm256_andnot_si256(_mask1, _p);
+			_k = _mm256_andnot_si256(_mask1, _mm256_srli_epi32(_p, 1));
+
+		repeat:
+			// i = (i | k) if (z >= m_Data[i | k]) else i
+			_r = _mm256_or_si256(_i, _k);
+			_x = gatherLayers(layer, _base, _r);
+			_mask2 = _mm256_cmpgt_epi32(_x, _z);
+			_r = _mm256_andnot_si256(_mask2, _r);
+			_i = _mm256_or_si256(_i, _r);
+
+			_k = _mm256_srli_epi32(_k, 1);
+			_mask2 = _mm256_cmpeq_epi32(_k, _zero);
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(_mask2)) != 0b11111111)
+				goto repeat;
+
+			_x = gatherLayers(layer, _base, _i);
+
+			// Stop if the value is found in a non-empty layer
+			_mask2 = _mm256_andnot_si256(_mask1, _mm256_cmpeq_epi32(_z, _x));
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(_mask2)) != 0b00000000)
+			{
+				neighbors.addPredecessor(value);
+				neighbors.addSuccessor(value);
+				return neighbors;
+			}
+
+			// Load the element after i, unless i is the last element of its
+			// layer, 2p - 1, in which case i itself is loaded again.
+			_last = _mm256_cmpeq_epi32(_i, _mm256_sub_epi32(_mm256_slli_epi32(_p, 1), _one));
+			_y = gatherLayers(layer, _base, _mm256_add_epi32(_i, _mm256_andnot_si256(_last, _one)));
+
+			// Predecessor candidate is x unless x > z (i.e. the whole layer is greater)
+			_mask2 = _mm256_or_si256(_mask1, _mm256_cmpgt_epi32(_x, _z));
+			_predecessor = _mm256_max_epi32(_predecessor, _mm256_blendv_epi8(_x, _predecessor, _mask2));
+			_predecessorMissing = _mm256_and_si256(_predecessorMissing, _mask2);
+
+			// Successor candidate is y if x < z, which only exists if x is not last
+			_mask2 = _mm256_cmpgt_epi32(_z, _x);
+			_y = _mm256_blendv_epi8(_x, _y, _mask2);
+			_mask2 = _mm256_or_si256(_mask1, _mm256_and_si256(_mask2, _last));
+			_successor = _mm256_min_epi32(_successor, _mm256_blendv_epi8(_y, _successor, _mask2));
+			_successorMissing = _mm256_and_si256(_successorMissing, _mask2);
+		}
+
+		_p = _mm256_srli_epi32(_p, 8);
+	}
+
+	if (_mm256_movemask_ps(_mm256_castsi256_ps(_predecessorMissing)) != 0b11111111)
+		neighbors.addPredecessor(horizontalMax(_predecessor));
+	if (_mm256_movemask_ps(_mm256_castsi256_ps(_successorMissing)) != 0b11111111)
+		neighbors.addSuccessor(horizontalMin(_successor));
+#else
+	// Sequential fallback implementation
+	for (; p != 0; p >>= 1)
+	{
+		if (searched & p)
+		{
+			neighbors.addSearchResult(value, m_Data, leadbitSearch(value, m_Data, p, p), p << 1);
+
+			if (neighbors.isExact(value))
+				break;
+		}
+	}
+#endif
+
+	return neighbors;
+}
+
+AVXIndex AVXBasicCOLA::countLessEqual(int32_t value) const
+{
+	// Same LEADBIT search as in contains. The number of elements less than or
+	// equal to value in a layer is i - p + 1, or zero if m_Data[i] > value.
+	if (m_Frozen)
+		return (value != std::numeric_limits<int32_t>::max()) ? m_Tree.lowerBound(value + 1) : m_Size;
+
+	AVXIndex count = 0;
+#if BASIC_INSERT_BUFFER
+	// Elements in the buffer that are not greater than value
+	count = m_BufferSize - popcount(bufferCompareMask<true>(m_Data, m_BufferSize, value));
+#endif
+
+	for (AVXIndex modelled = m_Size & m_ModelLayers; modelled != 0; modelled &= modelled - 1)
+	{
+		const AVXIndex q = modelled & (~modelled + 1);
+		const uint8_t l = popcount(q - 1);
+		if (m_Fences.isAbove(l, value))
+			continue;
+
+		if (m_Fences.isAtMost(l, value))
+		{
+			count += q;
+			continue;
+		}
+
+		const AVXIndex i = static_cast<AVXIndex>(m_Models[l].search(value, m_Data, q, q << 1));
+		count += i - q + (m_Data[i] <= value);
+	}
+
+	const AVXIndex searched = m_Size & ~m_ModelLayers;
+	AVXIndex p = (nextPO2MinusOne(searched) >> 1) + 1;
+
+#if BASIC_PARALLEL_SEARCH
+#if AVX_64BIT_INDEX
+	for (; p > BASIC_GATHER_LAYER_LIMIT; p >>= 1)
+	{
+		if ((searched & p) && !m_Fences.isAbove(popcount(p - 1), value))
+		{
+			if (m_Fences.isAtMost(popcount(p - 1), value))
+			{
+				count += p;
+				continue;
+			}
+
+			const AVXIndex i = static_cast<AVXIndex>(leadbitSearch(value, m_Data, p, p));
+			count += i - p + (m_Data[i] <= value);
+		}
+	}
+#endif
+
+	__m256i _i, _k, _p, _r, _z, _x, _mask1, _mask2, _zero, _one, _size, _count, _base, _min, _max;
+
+	_zero = _mm256_set1_epi32(0u);
+	_one = _mm256_set1_epi32(1u);
+	_size = _mm256_set1_epi32(static_cast<int32_t>(searched));
+	_z = _mm256_set1_epi32(value);
+	_p = _mm256_set_epi32(p, p >> 1, p >> 2, p >> 3,
+		p >> 4, p >> 5, p >> 6, p >> 7);
+
+	// Per lane counts. A lane counts layers of at most 2^31 elements that
+	// are eight layers apart, so it stays below 2^32.
+	_count = _zero;
+
+	ptrdiff_t l = popcount(p - 1);
+
+	for (; p != 0; p >>= 8, l -= 8)
+	{
+		// Mask of the layers that are empty in the current block
+		_mask1 = _mm256_cmpeq_epi32(_mm256_and_si256(_p, _size), _zero);
+
+		// Layers with no element greater than value are counted whole, and
+		// like the layers with only greater elements, are not searched.
+		// count += p if (m_Size & p && max <= z) else 0
+		_min = _mm256_loadu_si256((const __m256i*)m_Fences.min(l - 7));
+		_max = _mm256_loadu_si256((const __m256i*)m_Fences.max(l - 7));
+		_mask2 = _mm256_cmpgt_epi32(_max, _z);
+		_count = _mm256_add_epi32(_count, _mm256_andnot_si256(_mm256_or_si256(_mask1, _mask2), _p));
+		_mask1 = _mm256_or_si256(_mask1, _mm256_or_si256(_mm256_cmpgt_epi32(_min, _z), _mm256_cmpeq_epi32(_mask2, _zero)));
+
+		if (_mm256_movemask_ps(_mm256_castsi256_ps(_mask1)) != 0b11111111)
+		{
+			const int32_t* layer = &m_Data[p];
+			_base = _mm256_set1_epi32(static_cast<int32_t>(p));
+			_i = _mm256_andnot_si256(_mask1, _p);
+			_k = _mm256_andnot_si256(_mask1, _mm256_srli_epi32(_p, 1));
+
+		repeat:
+			// i = (i | k) if (z >= m_Data[i | k]) else i
+			_r = _mm256_or_si256(_i, _k);
+			_x = gatherLayers(layer, _base, _r);
+			_mask2 = _mm256_cmpgt_epi32(_x, _z);
+			_r = _mm256_andnot_si256(_mask2, _r);
+			_i = _mm256_or_si256(_i, _r);
+
+			_k = _mm256_srli_epi32(_k, 1);
+			_mask2 = _mm256_cmpeq_epi32(_k, _zero);
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(_mask2)) != 0b11111111)
+				goto repeat;
+
+			_x = gatherLayers(layer, _base, _i);
+
+			// count += (i - p + 1) if (m_Size & p && x <= z) else 0
+			_mask2 = _mm256_or_si256(_mask1, _mm256_cmpgt_epi32(_x, _z));
+			_r = _mm256_add_epi32(_mm256_sub_epi32(_i, _p), _one);
+			_count = _mm256_add_epi32(_count, _mm256_andnot_si256(_mask2, _r));
+		}
+
+		_p = _mm256_srli_epi32(_p, 8);
+	}
+
+	// Horizontal sum of the lane counts, widened to 64 bits since the
+	// sum may not fit in 32 bits.
+	_count = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(_count)),
+		_mm256_cvtepu32_epi64(_mm256_extracti128_si256(_count, 1)));
+	__m128i _h = _mm_add_epi64(_mm256_castsi256_si128(_count), _mm256_extracti128_si256(_count, 1));
+	_h = _mm_add_epi64(_h, _mm_unpackhi_epi64(_h, _h));
+	return count + static_cast<AVXIndex>(_mm_cvtsi128_si64(_h));
+#else
+	// Sequential fallback implementation
+	for (; p != 0; p >>= 1)
+	{
+		if ((searched & p) && !m_Fences.isAbove(popcount(p - 1), value))
+		{
+			if (m_Fences.isAtMost(popcount(p - 1), value))
+			{
+				count += p;
+				continue;
+			}
+
+			const AVXIndex i = static_cast<AVXIndex>(leadbitSearch(value, m_Data, p, p));
+			count += i - p + (m_Data[i] <= value);
+		}
+	}
+
+	return count;
+#endif
+}
+
+bool AVXBasicCOLA::select(AVXIndex k, int32_t& result) const
+{
+	int32_t lo, hi;
+	if (k >= size() || !successor(std::numeric_limits<int32_t>::min(), lo) || !predecessor(std::numeric_limits<int32_t>::max(), hi))
+		return false;
+
+	result = selectByValue(k, lo, hi, [this](int32_t value) { return countLessEqual(value); });
+	return true;
+}
+
+_LayerModel_Stats AVXBasicCOLA::modelStats() const
+{
+	_LayerModel_Stats stats;
+	if (m_Frozen)
+		return stats;
+
+	for (AVXIndex p = 1; p != 0 && p <= m_Size; p <<= 1)
+	{
+		if ((m_Size & p) == 0 || LAYER_MODEL_MIN_SIZE == 0 || p < LAYER_MODEL_MIN_SIZE)
+			continue;
+
+		if ((m_ModelLayers & p) == 0)
+		{
+			stats.m_FallbackLayers++;
+			continue;
+		}
+
+		const _LayerModel<int32_t>& model = m_Models[popcount(p - 1)];
+		stats.m_ModelLayers++;
+		stats.m_Segments += model.segmentCount();
+		stats.m_Bytes += model.bytes();
+		stats.m_MaxError = std::max(stats.m_MaxError, model.maxError(m_Data, p, p << 1));
+	}
+
+	return stats;
+}
+
+void AVXBasicCOLA::fitModel(AVXIndex p)
+{
+	// Layer p occupies [p, 2p)
+	if (m_Models[popcount(p - 1)].fit(m_Data, p, p << 1))
+		m_ModelLayers |= p;
+	else
+		m_ModelLayers &= ~p;
+}
+
+void AVXBasicCOLA::allocateData(std::shared_ptr<int32_t>& unalignedBlock, int32_t*& alignedPtr, AVXIndex capacity) const
 {
 #if BASIC_PARALLEL_MERGE && BASIC_MERGE_UNSAFE_CAST
-	// Data must be aligned to 32 bytes (256 bits) when using parallel search. This
-	// will then align elements used for bitonic merges at 32 bytes (256 bits).
-	unalignedPtr = new int32_t[static_cast<size_t>(capacity) + 8];
-	// Ensure that we have an alignment with lower bits as zero.
-	alignedPtr = (int32_t*)(((uintptr_t)unalignedPtr + 31) & ~(uintptr_t)0x1F);
+	// Allocate extra elements to be able to align the data.
+	unalignedBlock = allocateShared<int32_t>(static_cast<size_t>(capacity) + 8);
 #else
-	unalignedPtr = alignedPtr = new int32_t[capacity];
+	unalignedBlock = allocateShared<int32_t>(capacity);
 #endif
+	alignedPtr = alignData(unalignedBlock.get());
 }
 
-void AVXBasicCOLA::reallocData(uint32_t capacity)
+void AVXBasicCOLA::reallocData(AVXIndex capacity)
 {
 	// Allocate and copy memory to new block
-	int32_t* newBlockUnaligned;
+	std::shared_ptr<int32_t> newBlockUnaligned;
 	int32_t* newBlock;
 	allocateData(newBlockUnaligned, newBlock, capacity);
 
 	// Copy memory from old aligned ptr to new aligned ptr.
-	const uint32_t c = (capacity > m_Capacity) ? m_Capacity : capacity;
+	const AVXIndex c = (capacity > m_Capacity) ? m_Capacity : capacity;
 	memcpy(newBlock, m_Data, c * sizeof(int32_t));
 
-	// Delete old unaligned data and set new block
-	delete[] m_DataUnaligned;
-	m_DataUnaligned = newBlockUnaligned;
+	// Release old block (it is deleted unless shared with a clone)
+	m_DataUnaligned = std::move(newBlockUnaligned);
 	m_Data = newBlock;
 	m_Capacity = capacity;
 }
+
+void AVXBasicCOLA::releaseData()
+{
+	m_DataUnaligned = emptyBlock();
+	m_Data = alignData(m_DataUnaligned.get());
+	m_Capacity = 16;
+
+	// The models are only valid for the released layers
+	for (uint8_t l = 0; l < sizeof(AVXIndex) * 8; l++)
+		m_Models[l].clear();
+	m_ModelLayers = 0;
+}
+
+void AVXBasicCOLA::freeze()
+{
+	if (m_Frozen)
+		return;
+
+	struct Run
+	{
+		const int32_t* m_Begin;
+		const int32_t* m_End;
+	};
+
+	// Merge all layers at once into the leaves of the tree using a
+	// min-heap of runs, such that each element is only moved once.
+	Run heap[sizeof(AVXIndex) * 8 + 1];
+	uint32_t heapSize = 0;
+	for (AVXIndex p = 1; p != 0 && p <= m_Size; p <<= 1)
+	{
+		if (m_Size & p)
+			heap[heapSize++] = { &m_Data[p], &m_Data[p << 1] };
+	}
+
+	// The insert buffer is sorted as a copy, since the data may be shared
+	int32_t buffer[BASIC_INSERT_BUFFER_SIZE];
+	if (m_BufferSize != 0)
+	{
+		std::copy(&m_Data[1], &m_Data[1 + m_BufferSize], buffer);
+		std::sort(buffer, buffer + m_BufferSize);
+		heap[heapSize++] = { buffer, buffer + m_BufferSize };
+	}
+
+	m_Size += m_BufferSize;
+	m_BufferSize = 0;
+	m_BufferSorted = true;
+
+	int32_t* dst = m_Tree.reset(m_Size);
+
+	if (heapSize != 0)
+	{
+		const auto greater = [](const Run& a, const Run& b) {
+			return *a.m_Begin > *b.m_Begin;
+		};
+		std::make_heap(heap, heap + heapSize, greater);
+
+		while (heapSize > 1)
+		{
+			*dst++ = *heap[0].m_Begin++;
+
+			// Remove the run if it is exhausted
+			if (heap[0].m_Begin == heap[0].m_End)
+				heap[0] = heap[--heapSize];
+
+			// Sift the top run down to restore the heap
+			uint32_t i = 0;
+			const Run run = heap[0];
+			while (true)
+			{
+				uint32_t c = (i << 1) + 1;
+				if (c >= heapSize)
+					break;
+				if (c + 1 < heapSize && *heap[c + 1].m_Begin < *heap[c].m_Begin)
+					c++;
+				if (*run.m_Begin <= *heap[c].m_Begin)
+					break;
+				heap[i] = heap[c];
+				i = c;
+			}
+			heap[i] = run;
+		}
+
+		// Copy remaining elements of the last run
+		std::copy(heap[0].m_Begin, heap[0].m_End, dst);
+	}
+
+	m_Tree.build();
+	m_Frozen = true;
+
+	releaseData();
+}
+
+void AVXBasicCOLA::thaw()
+{
+	if (!m_Frozen)
+		return;
+
+	m_Capacity = std::max(static_cast<AVXIndex>(16), nextPO2MinusOne(m_Size) + 1);
+	allocateData(m_DataUnaligned, m_Data, m_Capacity);
+
+	// Any split of the sorted run keeps the layers sorted, so consecutive
+	// parts of the run are copied into the layers. The smallest elements
+	// go to the largest layer, as if they were appended in sorted order,
+	// such that appendSorted can continue from a thawed cola.
+	const int32_t* src = m_Tree.data();
+
+#if BASIC_INSERT_BUFFER
+	// Elements that do not fill a layer of the buffer size are buffered
+	m_BufferSize = m_Size & (BASIC_INSERT_BUFFER_SIZE - 1);
+	m_Size -= m_BufferSize;
+	m_BufferSorted = true;
+	std::copy(src + m_Size, src + m_Size + m_BufferSize, &m_Data[1]);
+#endif
+
+	for (AVXIndex p = nextPO2MinusOne(m_Size) - (nextPO2MinusOne(m_Size) >> 1); p != 0; p >>= 1)
+	{
+		if (m_Size & p)
+		{
+			memcpy(&m_Data[p], src, p * sizeof(int32_t));
+			m_Fences.set(popcount(p - 1), src[0], src[p - 1]);
+			fitModel(p);
+			src += p;
+		}
+	}
+
+	m_Tree = StaticSearchTree();
+	m_Frozen = false;
+}
+
+bool AVXBasicCOLA::saveFrozen(const std::string& path) const
+{
+	return m_Frozen && m_Tree.save(path);
+}
+
+bool AVXBasicCOLA::loadFrozen(const std::string& path)
+{
+	// The tree may hold more elements than the cola can index
+	StaticSearchTree tree;
+	if (!tree.load(path) || tree.size() > std::numeric_limits<AVXIndex>::max())
+		return false;
+
+	m_Tree = std::move(tree);
+	m_Frozen = true;
+	m_Size = static_cast<AVXIndex>(m_Tree.size());
+	m_BufferSize = 0;
+	m_BufferSorted = true;
+
+	releaseData();
+	return true;
+}
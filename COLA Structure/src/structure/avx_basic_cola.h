@@ -2,7 +2,18 @@
 
 #include <cstdint>
 
+#include "./avx_index.h"
+#include "./fence_util.h"
+#include "./layer_model.h"
 #include "./math_util.h"
+#include "./memory_util.h"
+#include "./neighbor_util.h"
+#include "./order_util.h"
+#include "./static_search_tree.h"
+
+// Number of elements pushed from the insert buffer at once, which is
+// also the size (and index) of the first layer after the buffer.
+#define BASIC_INSERT_BUFFER_SIZE static_cast<uint32_t>(16)
 
 class _AVXBasicCOLA_ConstIterator
 {
@@ -11,15 +22,23 @@ public:
 	using ReferenceType = const int32_t&;
 
 public:
-	_AVXBasicCOLA_ConstIterator(const PointerType data, uint32_t size, uint32_t index) :
+	_AVXBasicCOLA_ConstIterator(const PointerType data, AVXIndex size, AVXIndex bufferEnd, AVXIndex index) :
 		m_Data(data),
 		m_Size(size),
+		m_BufferEnd(bufferEnd),
 		m_Index(index) { }
 
 	_AVXBasicCOLA_ConstIterator& operator++()
 	{
 		m_Index++;
 
+		// Elements of the insert buffer are stored consecutively from index
+		// one, in place of the smallest layers. Continue with the layers.
+		if (m_Index < m_BufferEnd)
+			return *this;
+		if (m_Index == m_BufferEnd)
+			m_Index = BASIC_INSERT_BUFFER_SIZE;
+
 		// Check if we are at the end of a layer
 		if (isPO2(m_Index))
 		{
@@ -41,10 +60,14 @@ public:
 	_AVXBasicCOLA_ConstIterator& operator--()
 	{
 		// Check if we are at the beginning of a layer
-		if (isPO2(m_Index))
+		const bool inBuffer = (m_Index != 0 && m_Index < m_BufferEnd);
+		if (!inBuffer && isPO2(m_Index))
 		{
-			// Get index after the last element in the previous layer
+			// Get index after the last element in the previous layer,
+			// or in the insert buffer if there are no layers left.
 			m_Index = nextPO2MinusOne(m_Size & (m_Index - 1)) + 1;
+			if (m_Index < m_BufferEnd)
+				m_Index = m_BufferEnd;
 		}
 
 		m_Index--;
@@ -81,8 +104,9 @@ public:
 
 protected:
 	const PointerType m_Data;
-	const uint32_t m_Size;
-	uint32_t m_Index;
+	const AVXIndex m_Size;
+	const AVXIndex m_BufferEnd;
+	AVXIndex m_Index;
 };
 
 class AVXBasicCOLA
@@ -94,38 +118,145 @@ public:
 	AVXBasicCOLA() :
 		AVXBasicCOLA::AVXBasicCOLA(16) { }
 
-	AVXBasicCOLA(uint32_t initialCapacity);
+	AVXBasicCOLA(AVXIndex initialCapacity);
 
 	AVXBasicCOLA(const AVXBasicCOLA& other);
 
+	AVXBasicCOLA(AVXBasicCOLA&& other) noexcept;
+
 	~AVXBasicCOLA();
 
+	AVXBasicCOLA& operator=(AVXBasicCOLA&& other) noexcept;
+
 public:
+	// Create a copy in constant time. The data is shared until either
+	// of the colas inserts an element, which copies it for that cola.
+	AVXBasicCOLA clone() const;
+
+	// Inserting into a frozen cola thaws it first.
 	void add(int32_t value);
 
+	// Insert a value that is not less than any element of the cola, such
+	// that merges are copies. The order of the values is not checked, but
+	// layers that overlap because of earlier adds are still merged.
+	void appendSorted(int32_t value);
+
 	bool contains(int32_t value) const;
 
-	inline uint32_t size() const { return m_Size; }
+	// Set results[j] to contains(values[j]) for each of the count values.
+	// Eight values are searched in the same layer at once, which suits
+	// sorted values, whose searches share most of the probed cache lines.
+	void containsBatch(const int32_t* values, size_t count, bool* results) const;
+
+	// Largest element less than or equal to value.
+	inline bool predecessor(int32_t value, int32_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int32_t value, int32_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int32_t value, int32_t& result) const { return ::strictPredecessor(*this, value, result); }
+
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int32_t value, int32_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int32_t value, int32_t& result) const { return neighbors(value).nearest(value, result); }
+
+	// Number of elements less than value.
+	inline AVXIndex rank(int32_t value) const { return (value != std::numeric_limits<int32_t>::min()) ? countLessEqual(value - 1) : 0; }
+
+	// Element of rank k, i.e. the k-th smallest element starting from zero.
+	bool select(AVXIndex k, int32_t& result) const;
+
+	// Number of elements in the range [lo, hi].
+	inline AVXIndex countRange(int32_t lo, int32_t hi) const { return (lo <= hi) ? countLessEqual(hi) - rank(lo) : 0; }
+
+	// Element at quantile q in [0, 1], which is the element of rank floor(q * (size - 1)).
+	inline bool quantile(double q, int32_t& result) const { return select(quantileRank(q, size()), result); }
 
-	inline uint32_t capacity() const { return m_Capacity; }
+	inline AVXIndex size() const { return m_Size + m_BufferSize; }
+
+	inline AVXIndex capacity() const { return m_Capacity; }
+
+	// Merge all layers into a single sorted run indexed by a static search
+	// tree, and release the layers. Queries on a frozen cola search the tree.
+	void freeze();
+
+	// Split the sorted run back into layers to allow inserts.
+	void thaw();
+
+	inline bool isFrozen() const { return m_Frozen; }
+
+	// Write the frozen form of the cola to the file. Fails if not frozen.
+	bool saveFrozen(const std::string& path) const;
+
+	// Replace the contents with a frozen form written by saveFrozen.
+	bool loadFrozen(const std::string& path);
+
+	// Size and error of the models of the large layers. Computing the
+	// error searches all keys of the modelled layers.
+	_LayerModel_Stats modelStats() const;
 
 	ConstIterator begin() const
 	{
-		return ConstIterator(m_Data, m_Size, leastZeroBits(m_Size) + 1);
+		// The sorted run of a frozen cola is iterated as if all layers were
+		// full, with the element before the run as the unused index 0.
+		if (m_Frozen)
+			return ConstIterator(m_Tree.data() - 1, ~static_cast<AVXIndex>(0), 1, 1);
+		if (m_BufferSize != 0)
+			return ConstIterator(m_Data, m_Size, m_BufferSize + 1, 1);
+		return ConstIterator(m_Data, m_Size, 1, leastZeroBits(m_Size) + 1);
 	}
 
 	ConstIterator end() const
 	{
-		return ConstIterator(m_Data, m_Size, 0);
+		if (m_Frozen)
+			return ConstIterator(m_Tree.data() - 1, ~static_cast<AVXIndex>(0), 1, m_Size + 1);
+		return ConstIterator(m_Data, m_Size, m_BufferSize + 1, 0);
 	}
 
 private:
-	void allocateData(int32_t*& unalignedPtr, int32_t*& alignedPtr, uint32_t capacity) const;
-	void reallocData(uint32_t capacity);
+	// Insert a value, which is not less than any element if SORTED.
+	template<bool SORTED>
+	void insert(int32_t value);
+
+	_Neighbors<int32_t> neighbors(int32_t value) const;
+
+	// Number of elements less than or equal to value.
+	AVXIndex countLessEqual(int32_t value) const;
+
+	// Fit the model of layer p after it has been written.
+	void fitModel(AVXIndex p);
+
+	void allocateData(std::shared_ptr<int32_t>& unalignedBlock, int32_t*& alignedPtr, AVXIndex capacity) const;
+	void reallocData(AVXIndex capacity);
+	void releaseData();
 
 private:
-	int32_t* m_DataUnaligned;
+	std::shared_ptr<int32_t> m_DataUnaligned;
 	int32_t* m_Data;
-	uint32_t m_Capacity;
-	uint32_t m_Size;
+	AVXIndex m_Capacity;
+	AVXIndex m_Size;
+
+	// Number of unsorted elements in the insert buffer, which is stored at
+	// indices 1 to 15 (the smallest layers) of the data block.
+	uint32_t m_BufferSize;
+
+	// Whether the buffer only holds sorted appends, such that it is
+	// copied into the layers without sorting.
+	bool m_BufferSorted;
+
+	// Fences of the layers. Seven padding entries precede layer 0, such
+	// that the fences of a block of eight layers are loaded at once.
+	_Fences<int32_t, sizeof(AVXIndex) * 8, 7> m_Fences;
+
+	// Models of the layers of at least LAYER_MODEL_MIN_SIZE elements, and
+	// the layers that have one, which are left out of the parallel search.
+	_LayerModel<int32_t> m_Models[sizeof(AVXIndex) * 8];
+	AVXIndex m_ModelLayers;
+
+	// Sorted run of all elements while the cola is frozen.
+	StaticSearchTree m_Tree;
+	bool m_Frozen;
 };
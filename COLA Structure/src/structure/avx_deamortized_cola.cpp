@@ -12,7 +12,25 @@
 #define AVX_MERGE_UNSAFE_CAST 1
 #endif // !AVX_MERGE_UNSAFE_CAST
 
-AVXDeamortizedCOLA::AVXDeamortizedCOLA(uint32_t initialCapacity) :
+#ifndef AVX_STREAM_THRESHOLD
+// Merges into layers of at least this many elements write them with
+// non-temporal stores, such that they do not evict the small layers
+// from the caches. Zero disables it.
+#define AVX_STREAM_THRESHOLD (static_cast<uint32_t>(1) << 22)
+#endif // !AVX_STREAM_THRESHOLD
+
+#ifndef AVX_PARALLEL_FENCES
+// Compare the value with the fences of eight arrays (four layers) at once,
+// and only search the arrays whose fences do not exclude it.
+#define AVX_PARALLEL_FENCES 1
+#endif // !AVX_PARALLEL_FENCES
+
+#ifndef AVX_PREFETCH_DISTANCE
+// Number of elements ahead to prefetch the inputs of streamed merges.
+#define AVX_PREFETCH_DISTANCE 128
+#endif // !AVX_PREFETCH_DISTANCE
+
+AVXDeamortizedCOLA::AVXDeamortizedCOLA(AVXIndex initialCapacity) :
 	m_LeftFullFlags(0),
 	m_RightFullFlags(0),
 	m_MergeFlags(0),
@@ -29,7 +47,7 @@ AVXDeamortizedCOLA::AVXDeamortizedCOLA(uint32_t initialCapacity) :
 	{
 		// Size of each array on layer l is 2^l. Hence, with two
 		// arrays on each layer the size of layer l is 2^(l + 1).
-		allocateData(m_Layers[l].m_DataUnaligned, m_Layers[l].m_Data, static_cast<uint32_t>(2) << l);
+		allocateData(m_Layers[l].m_DataUnaligned, m_Layers[l].m_Data, static_cast<AVXIndex>(2) << l);
 	}
 }
 
@@ -39,7 +57,8 @@ AVXDeamortizedCOLA::AVXDeamortizedCOLA(const AVXDeamortizedCOLA& other) :
 	m_MergeFlags(other.m_MergeFlags),
 
 	m_LayerCount(other.m_LayerCount),
-	m_Layers(new Layer[other.m_LayerCount])
+	m_Layers(new Layer[other.m_LayerCount]),
+	m_Fences(other.m_Fences)
 {
 	// Allocate and copy layers
 	for (uint8_t l = 0; l < m_LayerCount; l++)
@@ -48,7 +67,7 @@ AVXDeamortizedCOLA::AVXDeamortizedCOLA(const AVXDeamortizedCOLA& other) :
 		Layer& srcLayer = other.m_Layers[l];
 
 		// Allocate layer data
-		const uint32_t layerSize = static_cast<uint32_t>(2) << l;
+		const AVXIndex layerSize = static_cast<AVXIndex>(2) << l;
 		allocateData(m_Layers[l].m_DataUnaligned, m_Layers[l].m_Data, layerSize);
 
 		// Copy layer data
@@ -59,13 +78,71 @@ AVXDeamortizedCOLA::AVXDeamortizedCOLA(const AVXDeamortizedCOLA& other) :
 	}
 }
 
+AVXDeamortizedCOLA::AVXDeamortizedCOLA(AVXDeamortizedCOLA&& other) noexcept :
+	m_LeftFullFlags(other.m_LeftFullFlags),
+	m_RightFullFlags(other.m_RightFullFlags),
+	m_MergeFlags(other.m_MergeFlags),
+
+	m_LayerCount(other.m_LayerCount),
+	m_Layers(other.m_Layers),
+	m_Fences(other.m_Fences)
+{
+	// Leave the other cola empty, but still usable. It has no layers
+	// until the next insert allocates the minimum amount of layers.
+	other.m_LeftFullFlags = 0;
+	other.m_RightFullFlags = 0;
+	other.m_MergeFlags = 0;
+	other.m_LayerCount = 0;
+	other.m_Layers = nullptr;
+}
+
 AVXDeamortizedCOLA::~AVXDeamortizedCOLA()
 {
-	for (uint8_t l = 0; l < m_LayerCount; l++)
-		delete[] m_Layers[l].m_DataUnaligned;
 	delete[] m_Layers;
 }
 
+AVXDeamortizedCOLA& AVXDeamortizedCOLA::operator=(AVXDeamortizedCOLA&& other) noexcept
+{
+	if (this != &other)
+	{
+		delete[] m_Layers;
+
+		m_LeftFullFlags = other.m_LeftFullFlags;
+		m_RightFullFlags = other.m_RightFullFlags;
+		m_MergeFlags = other.m_MergeFlags;
+		m_LayerCount = other.m_LayerCount;
+		m_Layers = other.m_Layers;
+		m_Fences = other.m_Fences;
+
+		other.m_LeftFullFlags = 0;
+		other.m_RightFullFlags = 0;
+		other.m_MergeFlags = 0;
+		other.m_LayerCount = 0;
+		other.m_Layers = nullptr;
+	}
+
+	return *this;
+}
+
+AVXDeamortizedCOLA AVXDeamortizedCOLA::clone() const
+{
+	AVXDeamortizedCOLA cola(0);
+	delete[] cola.m_Layers;
+	cola.m_Layers = new Layer[m_LayerCount];
+	cola.m_LayerCount = m_LayerCount;
+
+	// Share the layer data instead of copying it.
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+		cola.m_Layers[l] = m_Layers[l];
+
+	cola.m_LeftFullFlags = m_LeftFullFlags;
+	cola.m_RightFullFlags = m_RightFullFlags;
+	cola.m_MergeFlags = m_MergeFlags;
+	cola.m_Fences = m_Fences;
+
+	return cola;
+}
+
 #if AVX_PARALLEL_MERGE
 /* Helpers for insert operation during merges */
 static const __m256i _reverse_idx = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
@@ -104,6 +181,19 @@ static inline void store8x32i(int32_t* dst, __m256i src)
 #endif
 }
 
+static inline void storeMerged8x32i(int32_t* dst, __m256i src, bool stream)
+{
+#if AVX_MERGE_UNSAFE_CAST
+	// Streaming stores require the data to be aligned
+	if (stream)
+	{
+		_mm256_stream_si256((__m256i*)dst, src);
+		return;
+	}
+#endif
+	store8x32i(dst, src);
+}
+
 static inline void minmax(__m256i& _a, __m256i& _b, __m256i& _mn, __m256i& _mx)
 {
 	_mn = _mm256_min_epi32(_a, _b);
@@ -160,19 +250,22 @@ static inline void bitonicMerge8x8(__m256i& _a, __m256i& _b)
 
 void AVXDeamortizedCOLA::add(int32_t value)
 {
-	const uint32_t nSize = size() + 1;
+	const AVXIndex nSize = size() + 1;
 	if (nSize > capacity())
 	{
-		// Double the usable capacity
-		reallocLayers(m_LayerCount + 1);
+		// Double the usable capacity, or allocate the minimum
+		// amount of layers if the cola has been moved from.
+		reallocLayers(std::max(4ui8, static_cast<uint8_t>(m_LayerCount + 1)));
 	}
 
 	// Insert value into empty array in first layer
+	unshareLayer(0);
 	if (m_LeftFullFlags & 0x1)
 	{
 		// Insert value in right array
 		m_Layers[0].m_Data[1] = value;
 		m_RightFullFlags |= 0x1;
+		m_Fences.set(1, value, value);
 
 		// Prepare merging into layer 1
 		prepareMerge(0);
@@ -182,6 +275,7 @@ void AVXDeamortizedCOLA::add(int32_t value)
 		// Insert value in left array
 		m_Layers[0].m_Data[0] = value;
 		m_LeftFullFlags |= 0x1;
+		m_Fences.set(0, value, value);
 	}
 
 	// Merge layers with m = 2 * k + 2 moves
@@ -190,7 +284,7 @@ void AVXDeamortizedCOLA::add(int32_t value)
 
 void AVXDeamortizedCOLA::prepareMerge(const uint8_t l)
 {
-	const uint32_t flag = static_cast<uint32_t>(1) << l;
+	const AVXIndex flag = static_cast<AVXIndex>(1) << l;
 	m_MergeFlags |= flag;
 
 	Layer& layer = m_Layers[l];
@@ -209,17 +303,18 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 		if ((m_MergeFlags >> l) & 0x1)
 		{
 			// Current and next layer
+			unshareLayer(l + 1);
 			Layer& srcLayer = m_Layers[l];
 			Layer& dstLayer = m_Layers[l + 1];
 
 			// Retrieve indices for merging
-			uint32_t& i = srcLayer.m_MergeLeftIndex;
-			uint32_t& j = srcLayer.m_MergeRightIndex;
-			uint32_t& k = srcLayer.m_MergeDstIndex;
+			AVXIndex& i = srcLayer.m_MergeLeftIndex;
+			AVXIndex& j = srcLayer.m_MergeRightIndex;
+			AVXIndex& k = srcLayer.m_MergeDstIndex;
 
 			// Find last indices for merging
-			const uint32_t iEnd = static_cast<uint32_t>(1) << l;
-			const uint32_t jEnd = static_cast<uint32_t>(2) << l;
+			const AVXIndex iEnd = static_cast<AVXIndex>(1) << l;
+			const AVXIndex jEnd = static_cast<AVXIndex>(2) << l;
 
 #if AVX_PARALLEL_MERGE
 			if (iEnd < AVX_BITONIC_SORT_COUNT)
@@ -254,7 +349,10 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 				// of AVX_BITONIC_SORT_COUNT. Sort using bitonic merge.
 				__m256i _a, _b;
 
-				if (i != 0 && j != (1 << l))
+				// Merged layer is the size of both arrays of the source layer
+				const bool stream = (AVX_STREAM_THRESHOLD != 0 && jEnd >= AVX_STREAM_THRESHOLD);
+
+				if (i != 0 && j != iEnd)
 				{
 					// We have merged the source layers partially. Load the
 					// temporarily stored vector from destination array.
@@ -272,13 +370,21 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 					bitonicMerge8x8(_a, _b);
 
 					// Store lower elements (smallest elements both layers)
-					store8x32i(&dstLayer.m_Data[k], _a);
+					storeMerged8x32i(&dstLayer.m_Data[k], _a, stream);
 					k += AVX_BITONIC_SORT_COUNT;
 					m -= AVX_BITONIC_SORT_COUNT;
 				}
 
 				while (m > 0 && i != iEnd && j != jEnd)
 				{
+					if (stream)
+					{
+						// Inputs are not read again, fetch them without
+						// polluting the caches
+						_mm_prefetch((const char*)&srcLayer.m_Data[i + AVX_PREFETCH_DISTANCE], _MM_HINT_NTA);
+						_mm_prefetch((const char*)&srcLayer.m_Data[j + AVX_PREFETCH_DISTANCE], _MM_HINT_NTA);
+					}
+
 					if (srcLayer.m_Data[i] < srcLayer.m_Data[j])
 					{
 						_a = load8x32i(&srcLayer.m_Data[i]);
@@ -291,7 +397,7 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 					}
 
 					bitonicMerge8x8(_a, _b);
-					store8x32i(&dstLayer.m_Data[k], _a);
+					storeMerged8x32i(&dstLayer.m_Data[k], _a, stream);
 					k += AVX_BITONIC_SORT_COUNT;
 					m -= AVX_BITONIC_SORT_COUNT;
 				}
@@ -302,7 +408,7 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 					_a = load8x32i(&srcLayer.m_Data[i]);
 					i += AVX_BITONIC_SORT_COUNT;
 					bitonicMerge8x8(_a, _b);
-					store8x32i(&dstLayer.m_Data[k], _a);
+					storeMerged8x32i(&dstLayer.m_Data[k], _a, stream);
 					k += AVX_BITONIC_SORT_COUNT;
 					m -= AVX_BITONIC_SORT_COUNT;
 				}
@@ -313,7 +419,7 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 					_a = load8x32i(&srcLayer.m_Data[j]);
 					j += AVX_BITONIC_SORT_COUNT;
 					bitonicMerge8x8(_a, _b);
-					store8x32i(&dstLayer.m_Data[k], _a);
+					storeMerged8x32i(&dstLayer.m_Data[k], _a, stream);
 					k += AVX_BITONIC_SORT_COUNT;
 					m -= AVX_BITONIC_SORT_COUNT;
 				}
@@ -321,15 +427,20 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 				if (i == iEnd && j == jEnd)
 				{
 					// Store the last vector of elements.
-					store8x32i(&dstLayer.m_Data[k], _b);
+					storeMerged8x32i(&dstLayer.m_Data[k], _b, stream);
 					k += AVX_BITONIC_SORT_COUNT;
 					m -= AVX_BITONIC_SORT_COUNT;
 				}
 				else
 				{
-					// Store the vector temporarily in the destination layer.
+					// Store the vector temporarily in the destination layer. It is
+					// loaded again by the next merge step, so it is not streamed.
 					store8x32i(&dstLayer.m_Data[k], _b);
 				}
+
+				// Order the streaming stores before the layer is searched
+				if (stream)
+					_mm_sfence();
 			}
 #else
 			// Sequential fallback implementation
@@ -359,22 +470,24 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 			if (i == iEnd && j == jEnd)
 			{
 				// Remove full and merge flags
-				m_LeftFullFlags &= ~(1 << l);
-				m_RightFullFlags &= ~(1 << l);
-				m_MergeFlags &= ~(1 << l);
+				m_LeftFullFlags &= ~(static_cast<AVXIndex>(1) << l);
+				m_RightFullFlags &= ~(static_cast<AVXIndex>(1) << l);
+				m_MergeFlags &= ~(static_cast<AVXIndex>(1) << l);
 
 				// Set full flags of next layer.
 				if ((k >> l) == 0x2)
 				{
 					// We were merging into the left array
-					m_LeftFullFlags |= static_cast<uint32_t>(2) << l;
+					m_LeftFullFlags |= static_cast<AVXIndex>(2) << l;
+					setFences(l + 1, false);
 					// Test if the other array is also full
 					if ((m_RightFullFlags >> l) & 0x2)
 						prepareMerge(l + 1);
 				}
 				else
 				{
-					m_RightFullFlags |= static_cast<uint32_t>(2) << l;
+					m_RightFullFlags |= static_cast<AVXIndex>(2) << l;
+					setFences(l + 1, true);
 					if ((m_RightFullFlags >> l) & 0x2)
 						prepareMerge(l + 1);
 				}
@@ -387,13 +500,40 @@ void AVXDeamortizedCOLA::mergeLayers(int_fast16_t m)
 
 bool AVXDeamortizedCOLA::contains(int32_t value) const
 {
+#if AVX_PARALLEL_FENCES
+	const __m256i _z = _mm256_set1_epi32(value);
+	// Arrays of the current four layers whose fences do not exclude the
+	// value, where bit 2h is the left and bit 2h + 1 the right array.
+	uint32_t candidates = 0;
+#endif
+
 	for (uint8_t l = 0; l < m_LayerCount; l++)
 	{
 		// Size of an array in the layer is half the layer size
-		const uint32_t arraySize = static_cast<uint32_t>(1) << l;
+		const AVXIndex arraySize = static_cast<AVXIndex>(1) << l;
+
+#if AVX_PARALLEL_FENCES
+		if ((l & 0x3) == 0)
+		{
+			// candidates = NOT ((min > z) OR (z > max))
+			const __m256i _min = _mm256_loadu_si256((const __m256i*)m_Fences.min(l << 1));
+			const __m256i _max = _mm256_loadu_si256((const __m256i*)m_Fences.max(l << 1));
+			const __m256i _mask = _mm256_or_si256(_mm256_cmpgt_epi32(_min, _z), _mm256_cmpgt_epi32(_z, _max));
+			candidates = ~static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mask)));
+		}
+		else
+			candidates >>= 2;
+
+		const bool searchLeft = (candidates & 0x1) != 0;
+		const bool searchRight = (candidates & 0x2) != 0;
+#else
+		// Sequential fallback implementation
+		const bool searchLeft = !m_Fences.excludes(l << 1, value);
+		const bool searchRight = !m_Fences.excludes((l << 1) | 0x1, value);
+#endif
 
 		// Check if the left array has elements
-		if (((m_LeftFullFlags >> l) & 0x1))
+		if (((m_LeftFullFlags >> l) & 0x1) && searchLeft)
 		{
 			// Perform simple binary search
 			if (binarySearch(value, m_Layers[l].m_Data, 0, arraySize))
@@ -401,7 +541,7 @@ bool AVXDeamortizedCOLA::contains(int32_t value) const
 		}
 
 		// Check if the left array has elements
-		if ((m_RightFullFlags >> l) & 0x1)
+		if (((m_RightFullFlags >> l) & 0x1) && searchRight)
 		{
 			// Perform simple binary search
 			if (binarySearch(value, m_Layers[l].m_Data, arraySize, static_cast<size_t>(arraySize) << 1))
@@ -412,30 +552,54 @@ bool AVXDeamortizedCOLA::contains(int32_t value) const
 	return false;
 }
 
-uint32_t AVXDeamortizedCOLA::size() const
+_Neighbors<int32_t> AVXDeamortizedCOLA::neighbors(int32_t value) const
+{
+	_Neighbors<int32_t> neighbors;
+
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+	{
+		const AVXIndex arraySize = static_cast<AVXIndex>(1) << l;
+		const int32_t* data = m_Layers[l].m_Data;
+
+		// Both arrays of a layer are of power of two size
+		if (((m_LeftFullFlags >> l) & 0x1))
+			neighbors.addSearchResult(value, data, leadbitSearch(value, data, 0, arraySize), arraySize);
+
+		if ((m_RightFullFlags >> l) & 0x1)
+			neighbors.addSearchResult(value, data, leadbitSearch(value, data, arraySize, arraySize), static_cast<size_t>(arraySize) << 1);
+
+		if (neighbors.isExact(value))
+			break;
+	}
+
+	return neighbors;
+}
+
+AVXIndex AVXDeamortizedCOLA::size() const
 {
 	return m_LeftFullFlags + m_RightFullFlags;
 }
 
-uint32_t AVXDeamortizedCOLA::capacity() const
+AVXIndex AVXDeamortizedCOLA::capacity() const
 {
 	// The actual capacity of the layers can be calculated as:
 	//   Layers    0   1   2   ...   l
 	//   Capacity  2 + 4 + 8 + ... + 2^(l + 1) = 2^(l + 2) - 2
 	// To allow for merging, the usable capacity should be halved.
-	return (static_cast<uint32_t>(1) << m_LayerCount) - 1;
+	return (static_cast<AVXIndex>(1) << m_LayerCount) - 1;
 }
 
-void AVXDeamortizedCOLA::allocateData(int32_t*& unalignedPtr, int32_t*& alignedPtr, uint32_t capacity) const
+void AVXDeamortizedCOLA::allocateData(std::shared_ptr<int32_t>& unalignedBlock, int32_t*& alignedPtr, AVXIndex capacity) const
 {
 #if AVX_PARALLEL_MERGE && AVX_MERGE_UNSAFE_CAST
 	// Data must be aligned to 32 bytes (256 bits) when using parallel search. This
 	// will then align elements used for bitonic merges at 32 bytes (256 bits).
-	unalignedPtr = new int32_t[static_cast<size_t>(capacity) + 8];
+	unalignedBlock = allocateShared<int32_t>(static_cast<size_t>(capacity) + 8);
 	// Ensure that we have an alignment with lower bits as zero.
-	alignedPtr = (int32_t*)(((uintptr_t)unalignedPtr + 31) & ~(uintptr_t)0x1F);
+	alignedPtr = (int32_t*)(((uintptr_t)unalignedBlock.get() + 31) & ~(uintptr_t)0x1F);
 #else
-	unalignedPtr = alignedPtr = new int32_t[capacity];
+	unalignedBlock = allocateShared<int32_t>(capacity);
+	alignedPtr = unalignedBlock.get();
 #endif
 }
 
@@ -448,9 +612,9 @@ void AVXDeamortizedCOLA::reallocLayers(uint8_t layerCount)
 	for (uint8_t l = 0; l < layerCount; l++)
 	{
 		if (l < m_LayerCount)
-			newLayers[l] = m_Layers[l];
+			newLayers[l] = std::move(m_Layers[l]);
 		else
-			allocateData(newLayers[l].m_DataUnaligned, newLayers[l].m_Data, static_cast<uint32_t>(2) << l);
+			allocateData(newLayers[l].m_DataUnaligned, newLayers[l].m_Data, static_cast<AVXIndex>(2) << l);
 	}
 
 	// Delete and set old block
@@ -458,3 +622,29 @@ void AVXDeamortizedCOLA::reallocLayers(uint8_t layerCount)
 	m_Layers = newLayers;
 	m_LayerCount = layerCount;
 }
+
+void AVXDeamortizedCOLA::unshareLayer(uint8_t l)
+{
+	Layer& layer = m_Layers[l];
+	if (isShared(layer.m_DataUnaligned))
+	{
+		// Copy the layer before writing to it, since a clone still reads it.
+		// Note: this makes the first write to each shared layer O(2^l).
+		const AVXIndex layerSize = static_cast<AVXIndex>(2) << l;
+		std::shared_ptr<int32_t> newBlockUnaligned;
+		int32_t* newBlock;
+		allocateData(newBlockUnaligned, newBlock, layerSize);
+		memcpy(newBlock, layer.m_Data, layerSize * sizeof(int32_t));
+
+		layer.m_DataUnaligned = std::move(newBlockUnaligned);
+		layer.m_Data = newBlock;
+	}
+}
+
+void AVXDeamortizedCOLA::setFences(uint8_t l, bool right)
+{
+	// Fences of a full array are its first and last element
+	const AVXIndex arraySize = static_cast<AVXIndex>(1) << l;
+	const int32_t* array = &m_Layers[l].m_Data[right ? arraySize : 0];
+	m_Fences.set((l << 1) | (right ? 0x1 : 0x0), array[0], array[arraySize - 1]);
+}
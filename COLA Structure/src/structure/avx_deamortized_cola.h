@@ -1,6 +1,10 @@
 #pragma once
 
+#include "./avx_index.h"
+#include "./fence_util.h"
 #include "./math_util.h"
+#include "./memory_util.h"
+#include "./neighbor_util.h"
 
 #include <cstdint>
 #include <iostream>
@@ -8,11 +12,12 @@
 struct _AVXDeamortizedCOLA_Layer
 {
 	int32_t* m_Data;
-	int32_t* m_DataUnaligned;
+	// Unaligned data of the layer, which may be shared with clones.
+	std::shared_ptr<int32_t> m_DataUnaligned;
 
-	uint32_t m_MergeLeftIndex;
-	uint32_t m_MergeRightIndex;
-	uint32_t m_MergeDstIndex;
+	AVXIndex m_MergeLeftIndex;
+	AVXIndex m_MergeRightIndex;
+	AVXIndex m_MergeDstIndex;
 };
 
 class _AVXDeamortizedCOLA_ConstIterator
@@ -24,8 +29,8 @@ public:
 	using ReferenceType = const int32_t&;
 
 public:
-	_AVXDeamortizedCOLA_ConstIterator(uint32_t leftFullFlags, uint32_t rightFullFlags, uint8_t layerCount,
-		const Layer* layers, uint8_t layer, uint32_t index) :
+	_AVXDeamortizedCOLA_ConstIterator(AVXIndex leftFullFlags, AVXIndex rightFullFlags, uint8_t layerCount,
+		const Layer* layers, uint8_t layer, AVXIndex index) :
 
 		m_LeftFullFlags(leftFullFlags),
 		m_RightFullFlags(rightFullFlags),
@@ -38,8 +43,8 @@ public:
 
 	_AVXDeamortizedCOLA_ConstIterator& operator++()
 	{
-		const uint32_t prevIndex = m_Index++;
-		const uint32_t mask = static_cast<uint32_t>(1) << m_Layer;
+		const AVXIndex prevIndex = m_Index++;
+		const AVXIndex mask = static_cast<AVXIndex>(1) << m_Layer;
 
 		// Check if we should go to next layer (end of left array and right empty, or end of right array)
 		if (((prevIndex ^ m_Index) & mask) != 0 && (m_Index & m_RightFullFlags & mask) == 0)
@@ -47,7 +52,7 @@ public:
 			m_Index = 0;
 
 			// Go to next layer that contains elements
-			const uint32_t nonEmptyFlags = m_LeftFullFlags | m_RightFullFlags;
+			const AVXIndex nonEmptyFlags = m_LeftFullFlags | m_RightFullFlags;
 			for (m_Layer++; m_Layer < m_LayerCount; m_Layer++)
 			{
 				// Check if current layer is non-empty
@@ -55,7 +60,7 @@ public:
 				{
 					// Check if left array is empty and set index accordingly
 					if (((m_LeftFullFlags >> m_Layer) & 0x1) == 0)
-						m_Index = static_cast<uint32_t>(1) << m_Layer;
+						m_Index = static_cast<AVXIndex>(1) << m_Layer;
 					break;
 				}
 			}
@@ -73,13 +78,13 @@ public:
 
 	_AVXDeamortizedCOLA_ConstIterator& operator--()
 	{
-		const uint32_t maskMinusOne = (static_cast<uint32_t>(1) << m_Layer) - 1;
+		const AVXIndex maskMinusOne = (static_cast<AVXIndex>(1) << m_Layer) - 1;
 
 		// Check if we should go to next layer (beginning of right array and left empty, or beginning of left array)
 		if ((m_Index & maskMinusOne) == 0 && (m_Index & m_LeftFullFlags) == 0)
 		{
 			// Go to previous layer that contains elements
-			const uint32_t nonEmptyFlags = m_LeftFullFlags | m_RightFullFlags;
+			const AVXIndex nonEmptyFlags = m_LeftFullFlags | m_RightFullFlags;
 			while (m_Layer--)
 			{
 				// Check if current layer is non-empty
@@ -87,9 +92,9 @@ public:
 				{
 					// Check if right array is empty and set index accordingly
 					if (((m_RightFullFlags >> m_Layer) & 0x1) == 0)
-						m_Index = static_cast<uint32_t>(1) << m_Layer;
+						m_Index = static_cast<AVXIndex>(1) << m_Layer;
 					else
-						m_Index = static_cast<uint32_t>(2) << m_Layer;
+						m_Index = static_cast<AVXIndex>(2) << m_Layer;
 					break;
 				}
 			}
@@ -128,14 +133,14 @@ public:
 	}
 
 protected:
-	const uint32_t m_LeftFullFlags;
-	const uint32_t m_RightFullFlags;
+	const AVXIndex m_LeftFullFlags;
+	const AVXIndex m_RightFullFlags;
 
 	const uint8_t m_LayerCount;
 	const Layer* m_Layers;
 
 	uint8_t m_Layer;
-	uint32_t m_Index;
+	AVXIndex m_Index;
 };
 
 class AVXDeamortizedCOLA
@@ -149,25 +154,48 @@ public:
 	AVXDeamortizedCOLA() :
 		AVXDeamortizedCOLA::AVXDeamortizedCOLA(15) { }
 
-	AVXDeamortizedCOLA(uint32_t initialCapacity);
+	AVXDeamortizedCOLA(AVXIndex initialCapacity);
 
 	AVXDeamortizedCOLA(const AVXDeamortizedCOLA& other);
 
+	AVXDeamortizedCOLA(AVXDeamortizedCOLA&& other) noexcept;
+
 	~AVXDeamortizedCOLA();
 
+	AVXDeamortizedCOLA& operator=(AVXDeamortizedCOLA&& other) noexcept;
+
 public:
+	// Create a copy in constant time (per layer). Layers are shared until
+	// either of the colas writes to them, which copies only that layer.
+	AVXDeamortizedCOLA clone() const;
+
 	void add(int32_t value);
 
 	bool contains(int32_t value) const;
 
-	uint32_t size() const;
+	// Largest element less than or equal to value.
+	inline bool predecessor(int32_t value, int32_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int32_t value, int32_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int32_t value, int32_t& result) const { return ::strictPredecessor(*this, value, result); }
 
-	uint32_t capacity() const;
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int32_t value, int32_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int32_t value, int32_t& result) const { return neighbors(value).nearest(value, result); }
+
+	AVXIndex size() const;
+
+	AVXIndex capacity() const;
 
 	ConstIterator begin() const
 	{
 		const uint8_t layer = popcount(leastZeroBits(m_LeftFullFlags | m_RightFullFlags));
-		const uint32_t index = ((m_LeftFullFlags >> layer) & 0x1) ? 0 : (static_cast<uint32_t>(1) << layer);
+		const AVXIndex index = ((m_LeftFullFlags >> layer) & 0x1) ? 0 : (static_cast<AVXIndex>(1) << layer);
 		return ConstIterator(m_LeftFullFlags, m_RightFullFlags, m_LayerCount, m_Layers, layer, index);
 	}
 
@@ -177,16 +205,24 @@ public:
 	}
 
 private:
+	_Neighbors<int32_t> neighbors(int32_t value) const;
+
 	void prepareMerge(const uint8_t l);
 	void mergeLayers(int_fast16_t m);
-	void allocateData(int32_t*& unalignedPtr, int32_t*& alignedPtr, uint32_t capacity) const;
+	void allocateData(std::shared_ptr<int32_t>& unalignedBlock, int32_t*& alignedPtr, AVXIndex capacity) const;
 	void reallocLayers(uint8_t layerCount);
+	void unshareLayer(uint8_t l);
+	void setFences(uint8_t l, bool right);
 
 private:
-	uint32_t m_LeftFullFlags;
-	uint32_t m_RightFullFlags;
-	uint32_t m_MergeFlags;
+	AVXIndex m_LeftFullFlags;
+	AVXIndex m_RightFullFlags;
+	AVXIndex m_MergeFlags;
 
 	uint8_t m_LayerCount;
 	Layer* m_Layers;
+
+	// Fences of the full arrays, where the right array of layer l is 2l + 1.
+	// The fences of four layers are compared with the value at once.
+	_Fences<int32_t, sizeof(AVXIndex) * 16> m_Fences;
 };
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+#ifndef AVX_64BIT_INDEX
+// Index the AVX colas with 64-bit sizes, such that they can hold more than
+// 2^32 - 1 elements. The keys remain 32-bit to keep eight keys per vector.
+#define AVX_64BIT_INDEX 0
+#endif // !AVX_64BIT_INDEX
+
+// Type of sizes, capacities and indices of the AVX colas.
+#if AVX_64BIT_INDEX
+using AVXIndex = uint64_t;
+#else
+using AVXIndex = uint32_t;
+#endif
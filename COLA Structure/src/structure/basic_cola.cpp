@@ -3,28 +3,119 @@
 #include <memory>
 #include <algorithm>
 
+static const std::shared_ptr<int64_t>& emptyBlock()
+{
+	// Block of minimum capacity left behind by moves. It is always
+	// shared, so it is copied before anything is written to it.
+	static const std::shared_ptr<int64_t> block = allocateShared<int64_t>(15);
+	return block;
+}
+
 BasicCOLA::BasicCOLA(size_t initialCapacity) :
+	m_Block(),
 	m_Data(nullptr),
 	m_Capacity(0),
-	m_Size(0)
+	m_Size(0),
+	m_Generation(0),
+	m_SearchPolicy(SearchPolicy::Default),
+	m_SmallLayerHash((static_cast<size_t>(1) << SMALL_LAYER_HASH_BITS) - 1)
 {
 	// Capacity must be a power of two minus 1 (and greater than zero)
 	m_Capacity = std::max(static_cast<size_t>(15), nextPO2MinusOne(initialCapacity));
-	m_Data = new int64_t[m_Capacity];
+	m_Block = allocateShared<int64_t>(m_Capacity);
+	m_Data = m_Block.get();
 }
 
 BasicCOLA::BasicCOLA(const BasicCOLA& other) :
-	m_Data(new int64_t[other.m_Capacity]),
+	m_Block(allocateShared<int64_t>(other.m_Capacity)),
+	m_Data(m_Block.get()),
 	m_Capacity(other.m_Capacity),
-	m_Size(other.m_Size)
+	m_Size(other.m_Size),
+	m_Generation(other.m_Generation),
+	m_Fences(other.m_Fences),
+	m_SearchPolicy(other.m_SearchPolicy),
+	m_SmallLayerHash(other.m_SmallLayerHash)
 {
 	// Copy instead of pointing to the same memory.
 	memcpy(m_Data, other.m_Data, other.m_Capacity * sizeof(int64_t));
+	memcpy(m_LayerGenerations, other.m_LayerGenerations, sizeof(m_LayerGenerations));
+	std::copy(other.m_Models, other.m_Models + sizeof(size_t) * 8, m_Models);
 }
 
-BasicCOLA::~BasicCOLA()
+BasicCOLA::BasicCOLA(BasicCOLA&& other) noexcept :
+	m_Block(std::move(other.m_Block)),
+	m_Data(other.m_Data),
+	m_Capacity(other.m_Capacity),
+	m_Size(other.m_Size),
+	m_Generation(other.m_Generation),
+	m_Fences(other.m_Fences),
+	m_SearchPolicy(other.m_SearchPolicy),
+	m_SmallLayerHash(std::move(other.m_SmallLayerHash)),
+	m_Checkpoint(std::move(other.m_Checkpoint))
 {
-	delete[] m_Data;
+	memcpy(m_LayerGenerations, other.m_LayerGenerations, sizeof(m_LayerGenerations));
+	std::move(other.m_Models, other.m_Models + sizeof(size_t) * 8, m_Models);
+
+	// Leave the other cola empty, but still usable.
+	other.m_Block = emptyBlock();
+	other.m_Data = other.m_Block.get();
+	other.m_Capacity = 15;
+	other.m_Size = 0;
+}
+
+BasicCOLA::~BasicCOLA() { }
+
+BasicCOLA& BasicCOLA::operator=(BasicCOLA&& other) noexcept
+{
+	if (this != &other)
+	{
+		m_Block = std::move(other.m_Block);
+		m_Data = other.m_Data;
+		m_Capacity = other.m_Capacity;
+		m_Size = other.m_Size;
+		m_Generation = other.m_Generation;
+		m_Fences = other.m_Fences;
+		m_SearchPolicy = other.m_SearchPolicy;
+		m_SmallLayerHash = std::move(other.m_SmallLayerHash);
+		m_Checkpoint = std::move(other.m_Checkpoint);
+		memcpy(m_LayerGenerations, other.m_LayerGenerations, sizeof(m_LayerGenerations));
+		std::move(other.m_Models, other.m_Models + sizeof(size_t) * 8, m_Models);
+
+		other.m_Block = emptyBlock();
+		other.m_Data = other.m_Block.get();
+		other.m_Capacity = 15;
+		other.m_Size = 0;
+	}
+
+	return *this;
+}
+
+BasicCOLA BasicCOLA::clone() const
+{
+	BasicCOLA cola(0);
+
+	// Share the data block instead of copying it. The clone does
+	// not share the checkpoint state, so its first checkpoint is full.
+	cola.m_Block = m_Block;
+	cola.m_Data = m_Data;
+	cola.m_Capacity = m_Capacity;
+	cola.m_Size = m_Size;
+	cola.m_Generation = m_Generation;
+	cola.m_Fences = m_Fences;
+	cola.m_SearchPolicy = m_SearchPolicy;
+	cola.m_SmallLayerHash = m_SmallLayerHash;
+	memcpy(cola.m_LayerGenerations, m_LayerGenerations, sizeof(m_LayerGenerations));
+	std::copy(m_Models, m_Models + sizeof(size_t) * 8, cola.m_Models);
+
+	return cola;
+}
+
+void BasicCOLA::appendSorted(int64_t value)
+{
+	// The layers precede the value, so the disjoint check of each merge
+	// copies them. Earlier values need not be sorted, as the check falls
+	// back to merging layers that overlap.
+	add(value);
 }
 
 void BasicCOLA::add(int64_t value)
@@ -35,6 +126,12 @@ void BasicCOLA::add(int64_t value)
 		// Allocate a new layer
 		reallocData((m_Capacity << 1) + 1);
 	}
+	else if (isShared(m_Block))
+	{
+		// The merge would overwrite layers of a clone, copy the data first.
+		// Layers are stored contiguously, so the entire block is copied.
+		reallocData(m_Capacity);
+	}
 
 	// Find first position of empty array (merge-layer)
 	const size_t m = leastZeroBits(nSize);
@@ -44,6 +141,7 @@ void BasicCOLA::add(int64_t value)
 
 	// Iteratively merge arrays
 	size_t i = 0;
+	uint8_t l = 0;
 	while (i != m)
 	{
 		// Index after last element in current layer
@@ -53,31 +151,193 @@ void BasicCOLA::add(int64_t value)
 		size_t j = mEnd - i - 1;
 		size_t k = mEnd - iEnd - 1;
 
-		// Simple merge sort (ascending order)
-		while (i != iEnd && j != mEnd)
+		if (mergeDisjoint(m_Data, i, j, k, iEnd - i))
 		{
-			if (m_Data[i] <= m_Data[j])
+			i = iEnd;
+		}
+		else
+		{
+			// Simple merge sort (ascending order)
+			while (i != iEnd && j != mEnd)
+			{
+				if (m_Data[i] <= m_Data[j])
+					m_Data[k++] = m_Data[i++];
+				else
+					m_Data[k++] = m_Data[j++];
+			}
+
+			// Copy remaining elements in current layer
+			while (i != iEnd)
 				m_Data[k++] = m_Data[i++];
-			else
-				m_Data[k++] = m_Data[j++];
 		}
 
-		// Copy remaining elements in current layer
-		while (i != iEnd)
-			m_Data[k++] = m_Data[i++];
+		l++;
 	}
 
+	// Layer l has been replaced by the merge
+	m_LayerGenerations[l] = ++m_Generation;
+	m_Fences.set(l, m_Data[m], m_Data[mEnd - 1]);
+	m_Models[l].fit(m_Data, m, mEnd);
 	m_Size = nSize;
+
+	// Merges among the small layers only add the value to them, while a
+	// merge into a larger layer empties all of them.
+	if (SMALL_LAYER_HASH_BITS != 0)
+	{
+		if (l < SMALL_LAYER_HASH_BITS)
+			m_SmallLayerHash.insert(value);
+		else
+			m_SmallLayerHash.clear();
+	}
+}
+
+// Merge the sorted runs a and b into out. Runs that do not overlap are copied.
+static void mergeRuns(const int64_t* a, size_t aSize, const int64_t* b, size_t bSize, int64_t* out)
+{
+	if (a[aSize - 1] <= b[0])
+	{
+		out = std::copy(a, a + aSize, out);
+		std::copy(b, b + bSize, out);
+	}
+	else if (b[bSize - 1] < a[0])
+	{
+		out = std::copy(b, b + bSize, out);
+		std::copy(a, a + aSize, out);
+	}
+	else
+	{
+		// Select the next element without branching on the comparison,
+		// which is unpredictable for interleaved runs.
+		const int64_t* aEnd = a + aSize;
+		const int64_t* bEnd = b + bSize;
+		while (a != aEnd && b != bEnd)
+		{
+			const bool takeB = *b < *a;
+			*out++ = takeB ? *b : *a;
+			b += takeB;
+			a += !takeB;
+		}
+
+		out = std::copy(a, aEnd, out);
+		std::copy(b, bEnd, out);
+	}
+}
+
+void BasicCOLA::merge(const BasicCOLA& other)
+{
+	if (other.m_Size == 0)
+		return;
+
+	const size_t size = m_Size + other.m_Size;
+	if (size > m_Capacity)
+	{
+		// Allocate the new layers
+		reallocData(nextPO2MinusOne(size));
+	}
+	else if (isShared(m_Block))
+	{
+		// The merge would overwrite layers of a clone, copy the data first
+		reallocData(m_Capacity);
+	}
+
+	// The layers l of both colas and the carry of 2^l elements from the
+	// layers below are added like binary digits. Layer l keeps the only run
+	// or, if there are three, its own layer, and two runs are merged into
+	// the carry. Layer l is only written after it has been read, so the
+	// layers are merged in place, even if other is this cola, and layers
+	// that are kept are not touched.
+	//
+	// The carry out of layer l is written to buffer l % 2, while the carry
+	// into it is read from the other buffer. The largest carry goes into
+	// the top layer and is of its size, so the buffers take one and a half
+	// times the top layer instead of the whole size.
+	const size_t topSize = (nextPO2MinusOne(size) >> 1) + 1;
+	const uint8_t top = popcount(topSize - 1);
+	std::unique_ptr<int64_t[]> carryBlock(new int64_t[topSize + (topSize >> 1)]);
+	int64_t* buffers[2];
+	buffers[(top + 1) & 0x1] = carryBlock.get();
+	buffers[top & 0x1] = carryBlock.get() + topSize;
+	const int64_t* carry = nullptr;
+
+	size_t changed = 0;
+	for (uint8_t l = 0; (size >> l) != 0; l++)
+	{
+		const size_t layerSize = static_cast<size_t>(1) << l;
+		int64_t* layer = &m_Data[layerSize - 1];
+
+		const int64_t* runs[3];
+		uint8_t n = 0;
+		if ((m_Size >> l) & 0x1)
+			runs[n++] = layer;
+		if ((other.m_Size >> l) & 0x1)
+			runs[n++] = &other.m_Data[layerSize - 1];
+		if (carry != nullptr)
+			runs[n++] = carry;
+
+		if (n == 1)
+		{
+			if (runs[0] != layer)
+			{
+				std::copy(runs[0], runs[0] + layerSize, layer);
+				changed |= layerSize;
+			}
+			carry = nullptr;
+		}
+		else if (n != 0)
+		{
+			int64_t* out = buffers[l & 0x1];
+			mergeRuns(runs[n - 2], layerSize, runs[n - 1], layerSize, out);
+			carry = out;
+		}
+	}
+
+	m_Size = size;
+
+	for (uint8_t l = 0; (changed >> l) != 0; l++)
+	{
+		if ((changed >> l) & 0x1)
+		{
+			// Layer l has been replaced by the merge
+			m_LayerGenerations[l] = ++m_Generation;
+			m_Fences.set(l, m_Data[(static_cast<size_t>(1) << l) - 1], m_Data[(static_cast<size_t>(2) << l) - 2]);
+			m_Models[l].fit(m_Data, (static_cast<size_t>(1) << l) - 1, (static_cast<size_t>(2) << l) - 1);
+		}
+	}
+	rebuildSmallLayerHash();
+}
+
+_SetCursor<int64_t> BasicCOLA::cursor() const
+{
+	_SetCursor<int64_t> cursor;
+	for (uint8_t l = 0; (m_Size >> l) != 0; l++)
+	{
+		// Layer l starts at index 2^l - 1 and contains 2^l elements
+		if ((m_Size >> l) & 0x1)
+			cursor.addRun(m_Data, (static_cast<size_t>(1) << l) - 1, (static_cast<size_t>(2) << l) - 1);
+	}
+	return cursor;
 }
 
 bool BasicCOLA::contains(int64_t value) const
 {
+	// Recent elements are found in the hash set of the small layers, which
+	// are not searched below.
+	size_t smallEnd = 0;
+	if (SMALL_LAYER_HASH_BITS != 0)
+	{
+		if (m_SmallLayerHash.contains(value))
+			return true;
+		smallEnd = (static_cast<size_t>(1) << SMALL_LAYER_HASH_BITS) - 1;
+	}
+
 	// Find index after the last element in the last layer.
 	size_t iEnd = nextPO2MinusOne(m_Size);
+	uint8_t l = popcount(iEnd);
 
-	while (iEnd)
+	while (iEnd > smallEnd)
 	{
 		const size_t iStart = iEnd >> 1;
+		l--;
 
 		// Check if the current layer is non-empty (when
 		// the top set bit of iEnd is also set in m_Size).
@@ -85,10 +345,18 @@ bool BasicCOLA::contains(int64_t value) const
 		//   0000 1111 & xxxx 1xxx   >    0000 0111
 		// E.g. of failure (iEnd = 1111):
 		//   0000 1111 & xxxx 0xxx   <=   0000 0111
-		if ((iEnd & m_Size) > iStart)
+		// Layers whose fences exclude the value are skipped.
+		if ((iEnd & m_Size) > iStart && !m_Fences.excludes(l, value))
 		{
+			if (!m_Models[l].isEmpty() || isInterpolated(l))
+			{
+				// Search the window around the predicted position, or
+				// interpolate between the fences
+				if (m_Data[searchLayer(l, value)] == value)
+					return true;
+			}
 			// Perform basic binary search in range (inclusive)
-			if (binarySearch(value, m_Data, iStart, iEnd))
+			else if (binarySearch(value, m_Data, iStart, iEnd))
 				return true;
 		}
 
@@ -99,15 +367,196 @@ bool BasicCOLA::contains(int64_t value) const
 	return false;
 }
 
+_Neighbors<int64_t> BasicCOLA::neighbors(int64_t value) const
+{
+	_Neighbors<int64_t> neighbors;
+
+	for (uint8_t l = 0; (m_Size >> l) != 0; l++)
+	{
+		if ((m_Size >> l) & 0x1)
+		{
+			// Layer l starts at index 2^l - 1 and contains 2^l elements
+			const size_t layerSize = static_cast<size_t>(1) << l;
+			const size_t i = searchLayer(l, value);
+			neighbors.addSearchResult(value, m_Data, i, (layerSize << 1) - 1);
+
+			if (neighbors.isExact(value))
+				break;
+		}
+	}
+
+	return neighbors;
+}
+
+size_t BasicCOLA::countLessEqual(int64_t value) const
+{
+	size_t count = 0;
+
+	for (uint8_t l = 0; (m_Size >> l) != 0; l++)
+	{
+		if (((m_Size >> l) & 0x1) && !m_Fences.isAbove(l, value))
+		{
+			// Elements up to and including i are less than or equal
+			// to value, unless i is the first element and greater.
+			const size_t layerSize = static_cast<size_t>(1) << l;
+			if (m_Fences.isAtMost(l, value))
+			{
+				count += layerSize;
+				continue;
+			}
+
+			const size_t i = searchLayer(l, value);
+			count += i - (layerSize - 1) + (m_Data[i] <= value);
+		}
+	}
+
+	return count;
+}
+
+bool BasicCOLA::select(size_t k, int64_t& result) const
+{
+	int64_t lo, hi;
+	if (k >= size() || !successor(std::numeric_limits<int64_t>::min(), lo) || !predecessor(std::numeric_limits<int64_t>::max(), hi))
+		return false;
+
+	result = selectByValue(k, lo, hi, [this](int64_t value) { return countLessEqual(value); });
+	return true;
+}
+
+bool BasicCOLA::checkpoint(const std::string& directory)
+{
+	m_Checkpoint.begin(directory);
+
+	for (uint8_t l = 0; (m_Size >> l) != 0; l++)
+	{
+		if ((m_Size >> l) & 0x1)
+		{
+			// Layer l starts at index 2^l - 1 and contains 2^l elements
+			const size_t layerSize = static_cast<size_t>(1) << l;
+			if (!m_Checkpoint.addLayer(l, m_LayerGenerations[l], &m_Data[layerSize - 1], layerSize, sizeof(int64_t)))
+				return false;
+		}
+	}
+
+	const uint64_t header[CHECKPOINT_HEADER_COUNT] = { m_Size, 0, 0, 0 };
+	return m_Checkpoint.commit(header, m_Generation);
+}
+
+bool BasicCOLA::restore(const std::string& directory)
+{
+	_Checkpoint_Manifest manifest;
+	if (!_Checkpoint_State::readManifest(directory, manifest))
+		return false;
+
+	const size_t size = static_cast<size_t>(manifest.m_Header[0]);
+	const size_t capacity = std::max(m_Capacity, nextPO2MinusOne(size));
+	
+	// Read into a new block such that a failed restore leaves the cola unchanged
+	std::shared_ptr<int64_t> newBlock = allocateShared<int64_t>(capacity);
+	uint64_t layerGenerations[sizeof(size_t) * 8] = { 0 };
+	size_t restoredSize = 0;
+
+	for (const _Checkpoint_Entry& entry : manifest.m_Entries)
+	{
+		const size_t layerSize = (entry.m_Slot < sizeof(size_t) * 8) ? (static_cast<size_t>(1) << entry.m_Slot) : 0;
+		if (layerSize == 0 || entry.m_Count != layerSize || (size & layerSize) == 0 ||
+			!_Checkpoint_State::readLayer(directory, entry, &newBlock.get()[layerSize - 1], sizeof(int64_t)))
+		{
+			return false;
+		}
+
+		layerGenerations[entry.m_Slot] = entry.m_Generation;
+		restoredSize |= layerSize;
+	}
+
+	if (restoredSize != size)
+		return false;
+
+	m_Block = std::move(newBlock);
+	m_Data = m_Block.get();
+	m_Capacity = capacity;
+	m_Size = size;
+	m_Generation = manifest.m_Generation;
+	memcpy(m_LayerGenerations, layerGenerations, sizeof(m_LayerGenerations));
+
+	// Fences, models and the hash set are not part of the checkpoint, take them from the sorted layers
+	for (uint8_t l = 0; (m_Size >> l) != 0; l++)
+	{
+		if ((m_Size >> l) & 0x1)
+		{
+			m_Fences.set(l, m_Data[(static_cast<size_t>(1) << l) - 1], m_Data[(static_cast<size_t>(2) << l) - 2]);
+			m_Models[l].fit(m_Data, (static_cast<size_t>(1) << l) - 1, (static_cast<size_t>(2) << l) - 1);
+		}
+	}
+	rebuildSmallLayerHash();
+
+	// Layers of the restored checkpoint do not need to be written again
+	m_Checkpoint.adopt(directory, manifest);
+	return true;
+}
+
+_LayerModel_Stats BasicCOLA::modelStats() const
+{
+	_LayerModel_Stats stats;
+
+	for (uint8_t l = 0; (m_Size >> l) != 0; l++)
+	{
+		const size_t layerSize = static_cast<size_t>(1) << l;
+		if (((m_Size >> l) & 0x1) == 0 || LAYER_MODEL_MIN_SIZE == 0 || layerSize < LAYER_MODEL_MIN_SIZE)
+			continue;
+
+		const _LayerModel<int64_t>& model = m_Models[l];
+		if (model.isEmpty())
+		{
+			stats.m_FallbackLayers++;
+			continue;
+		}
+
+		stats.m_ModelLayers++;
+		stats.m_Segments += model.segmentCount();
+		stats.m_Bytes += model.bytes();
+		stats.m_MaxError = std::max(stats.m_MaxError, model.maxError(m_Data, layerSize - 1, (layerSize << 1) - 1));
+	}
+
+	return stats;
+}
+
+size_t BasicCOLA::searchLayer(uint8_t l, int64_t value) const
+{
+	// Layer l starts at index 2^l - 1 and contains 2^l elements
+	const size_t layerSize = static_cast<size_t>(1) << l;
+	if (!m_Models[l].isEmpty())
+		return m_Models[l].search(value, m_Data, layerSize - 1, (layerSize << 1) - 1);
+	if (isInterpolated(l))
+		return interpolationSearch(value, m_Data, layerSize - 1, (layerSize << 1) - 1, *m_Fences.min(l), *m_Fences.max(l));
+	return leadbitSearch(value, m_Data, layerSize - 1, layerSize);
+}
+
+void BasicCOLA::rebuildSmallLayerHash()
+{
+	m_SmallLayerHash.clear();
+
+	for (uint8_t l = 0; l < SMALL_LAYER_HASH_BITS && (m_Size >> l) != 0; l++)
+	{
+		if ((m_Size >> l) & 0x1)
+		{
+			// Layer l starts at index 2^l - 1 and contains 2^l elements
+			const size_t layerSize = static_cast<size_t>(1) << l;
+			for (size_t i = layerSize - 1; i != (layerSize << 1) - 1; i++)
+				m_SmallLayerHash.insert(m_Data[i]);
+		}
+	}
+}
+
 void BasicCOLA::reallocData(size_t capacity)
 {
 	// Allocate and copy memory to new block
-	int64_t* newBlock = new int64_t[capacity];
+	std::shared_ptr<int64_t> newBlock = allocateShared<int64_t>(capacity);
 	const size_t c = (capacity > m_Capacity) ? m_Capacity : capacity;
-	memcpy(newBlock, m_Data, c * sizeof(int64_t));
+	memcpy(newBlock.get(), m_Data, c * sizeof(int64_t));
 
-	// Delete and set old block
-	delete[] m_Data;
-	m_Data = newBlock;
+	// Release old block (it is deleted unless shared with a clone)
+	m_Block = std::move(newBlock);
+	m_Data = m_Block.get();
 	m_Capacity = capacity;
 }
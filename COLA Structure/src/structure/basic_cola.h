@@ -1,8 +1,18 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 
 #include "./math_util.h"
+#include "./memory_util.h"
+#include "./neighbor_util.h"
+#include "./order_util.h"
+#include "./checkpoint.h"
+#include "./fence_util.h"
+#include "./layer_model.h"
+#include "./interpolation_util.h"
+#include "./small_layer_hash.h"
+#include "./set_cursor.h"
 
 class _BasicCOLA_ConstIterator
 {
@@ -98,16 +108,88 @@ public:
 
 	BasicCOLA(const BasicCOLA& other);
 
+	BasicCOLA(BasicCOLA&& other) noexcept;
+
 	~BasicCOLA();
 
+	BasicCOLA& operator=(BasicCOLA&& other) noexcept;
+
 public:
+	// Create a copy in constant time. The data is shared until either
+	// of the colas inserts an element, which copies it for that cola.
+	BasicCOLA clone() const;
+
 	void add(int64_t value);
 
+	// Insert a value that is not less than any element of the cola, such
+	// that merges are copies. The order of the values is not checked, but
+	// layers that overlap because of earlier adds are still merged.
+	void appendSorted(int64_t value);
+
+	// Add all elements of other by merging its layers into the layers of
+	// this cola, like adding binary numbers, instead of inserting them one
+	// by one. Layers that no merge reaches are kept as they are. The merge
+	// runs in place, with carry buffers of 1.5 times the top layer.
+	void merge(const BasicCOLA& other);
+
 	bool contains(int64_t value) const;
 
+	// Cursor over the elements in ascending order, which is invalidated by inserts.
+	_SetCursor<int64_t> cursor() const;
+
+	// Cursor over the elements that are also in other, in ascending order.
+	inline IntersectCursor<int64_t> intersect(const BasicCOLA& other) const { return IntersectCursor<int64_t>(cursor(), other.cursor()); }
+
+	// Cursor over the elements that are not in other, in ascending order.
+	inline DifferenceCursor<int64_t> difference(const BasicCOLA& other) const { return DifferenceCursor<int64_t>(cursor(), other.cursor()); }
+
+	// Largest element less than or equal to value.
+	inline bool predecessor(int64_t value, int64_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int64_t value, int64_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int64_t value, int64_t& result) const { return ::strictPredecessor(*this, value, result); }
+
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int64_t value, int64_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int64_t value, int64_t& result) const { return neighbors(value).nearest(value, result); }
+
+	// Number of elements less than value.
+	inline size_t rank(int64_t value) const { return (value != std::numeric_limits<int64_t>::min()) ? countLessEqual(value - 1) : 0; }
+
+	// Element of rank k, i.e. the k-th smallest element starting from zero.
+	bool select(size_t k, int64_t& result) const;
+
+	// Number of elements in the range [lo, hi].
+	inline size_t countRange(int64_t lo, int64_t hi) const { return (lo <= hi) ? countLessEqual(hi) - rank(lo) : 0; }
+
+	// Element at quantile q in [0, 1], which is the element of rank floor(q * (size - 1)).
+	inline bool quantile(double q, int64_t& result) const { return select(quantileRank(q, size()), result); }
+
 	inline size_t size() const { return m_Size; }
 
 	inline size_t capacity() const { return m_Capacity; }
+
+	// Persist the layers created since the last checkpoint into the
+	// directory, followed by a manifest describing the full structure.
+	bool checkpoint(const std::string& directory);
+
+	// Replace the contents with the latest checkpoint in the directory.
+	bool restore(const std::string& directory);
+
+	// Size and error of the models of the large layers. Computing the
+	// error searches all keys of the modelled layers.
+	_LayerModel_Stats modelStats() const;
+
+	// Search large layers without models with interpolation search if the
+	// keys are close to uniformly distributed. Defaults to binary search.
+	inline void setSearchPolicy(SearchPolicy policy) { m_SearchPolicy = policy; }
+
+	inline SearchPolicy searchPolicy() const { return m_SearchPolicy; }
 	
 	ConstIterator begin() const
 	{
@@ -120,10 +202,47 @@ public:
 	}
 
 private:
+	_Neighbors<int64_t> neighbors(int64_t value) const;
+
+	// Number of elements less than or equal to value.
+	size_t countLessEqual(int64_t value) const;
+
+	// Last element of layer l that is less than or equal to value, or the
+	// first element if there is none. Uses the model of the layer if any,
+	// or interpolation search if the search policy selects it.
+	size_t searchLayer(uint8_t l, int64_t value) const;
+
+	// True if layer l is searched with interpolation search.
+	inline bool isInterpolated(uint8_t l) const
+	{
+		return m_SearchPolicy == SearchPolicy::Interpolation && (static_cast<size_t>(1) << l) >= INTERPOLATION_MIN_SIZE;
+	}
+
 	void reallocData(size_t capacity);
 
+	// Refill the hash set from the small layers.
+	void rebuildSmallLayerHash();
+
 private:
+	std::shared_ptr<int64_t> m_Block;
 	int64_t* m_Data;
 	size_t m_Capacity;
 	size_t m_Size;
+
+	// Generation of the merge that created each layer.
+	uint64_t m_LayerGenerations[sizeof(size_t) * 8];
+	uint64_t m_Generation;
+
+	_Fences<int64_t, sizeof(size_t) * 8> m_Fences;
+
+	// Models of the layers of at least LAYER_MODEL_MIN_SIZE elements.
+	_LayerModel<int64_t> m_Models[sizeof(size_t) * 8];
+
+	SearchPolicy m_SearchPolicy;
+
+	// Elements of the layers below SMALL_LAYER_HASH_BITS, which are all
+	// merged away at once when a merge reaches a larger layer.
+	_SmallLayerHash<int64_t> m_SmallLayerHash;
+
+	_Checkpoint_State m_Checkpoint;
 };
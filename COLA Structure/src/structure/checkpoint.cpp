@@ -0,0 +1,138 @@
+#include "./checkpoint.h"
+
+#include "./file_util.h"
+
+#define CHECKPOINT_MANIFEST_NAME "manifest"
+#define CHECKPOINT_MANIFEST_TMP_NAME "manifest.tmp"
+
+void _Checkpoint_State::begin(const std::string& directory)
+{
+	if (directory != m_Directory)
+	{
+		// Layer files in another directory can not be shared.
+		m_Directory = directory;
+		m_RefCounts.clear();
+		m_Published.clear();
+	}
+
+	m_Pending.clear();
+}
+
+bool _Checkpoint_State::addLayer(uint64_t slot, uint64_t generation, const void* data, uint64_t count, size_t elementSize)
+{
+	// Layers are immutable until they are merged away, so a layer with
+	// a referenced generation is already stored in the directory.
+	if (m_RefCounts.find(generation) == m_RefCounts.end())
+	{
+		const std::string path = joinPath(m_Directory, layerFileName(generation));
+		if (!writeFile(path, data, static_cast<size_t>(count) * elementSize))
+			return false;
+	}
+
+	m_Pending.push_back({ slot, generation, count });
+	return true;
+}
+
+bool _Checkpoint_State::commit(const uint64_t header[CHECKPOINT_HEADER_COUNT], uint64_t generation)
+{
+	// Layout: magic, version, header, generation, entry count, entries.
+	std::vector<uint64_t> buffer;
+	buffer.reserve(4 + CHECKPOINT_HEADER_COUNT + 3 * m_Pending.size());
+	buffer.push_back((static_cast<uint64_t>(CHECKPOINT_VERSION) << 32) | CHECKPOINT_MAGIC);
+	for (size_t h = 0; h < CHECKPOINT_HEADER_COUNT; h++)
+		buffer.push_back(header[h]);
+	buffer.push_back(generation);
+	buffer.push_back(m_Pending.size());
+	for (const Entry& entry : m_Pending)
+	{
+		buffer.push_back(entry.m_Slot);
+		buffer.push_back(entry.m_Generation);
+		buffer.push_back(entry.m_Count);
+	}
+
+	// Write the manifest to a temporary file first, such that a crash
+	// never leaves a partially written manifest behind.
+	const std::string tmpPath = joinPath(m_Directory, CHECKPOINT_MANIFEST_TMP_NAME);
+	const std::string path = joinPath(m_Directory, CHECKPOINT_MANIFEST_NAME);
+	if (!writeFile(tmpPath, buffer.data(), buffer.size() * sizeof(uint64_t)))
+		return false;
+	if (!replaceFile(tmpPath, path))
+		return false;
+
+	// Reference the layers of the new manifest before releasing the
+	// previous one, so unchanged layer files are kept.
+	for (const Entry& entry : m_Pending)
+		m_RefCounts[entry.m_Generation]++;
+
+	for (const Entry& entry : m_Published)
+	{
+		auto itr = m_RefCounts.find(entry.m_Generation);
+		if (itr != m_RefCounts.end() && --itr->second == 0)
+		{
+			std::remove(joinPath(m_Directory, layerFileName(entry.m_Generation)).c_str());
+			m_RefCounts.erase(itr);
+		}
+	}
+
+	m_Published.swap(m_Pending);
+	m_Pending.clear();
+	return true;
+}
+
+void _Checkpoint_State::adopt(const std::string& directory, const Manifest& manifest)
+{
+	m_Directory = directory;
+	m_RefCounts.clear();
+	m_Pending.clear();
+
+	m_Published = manifest.m_Entries;
+	for (const Entry& entry : m_Published)
+		m_RefCounts[entry.m_Generation]++;
+}
+
+bool _Checkpoint_State::readManifest(const std::string& directory, Manifest& manifest)
+{
+	// Fall back to the temporary manifest in case we crashed
+	// after removing the old manifest but before renaming.
+	FILE* file = openFile(joinPath(directory, CHECKPOINT_MANIFEST_NAME), "rb");
+	if (file == nullptr)
+		file = openFile(joinPath(directory, CHECKPOINT_MANIFEST_TMP_NAME), "rb");
+	if (file == nullptr)
+		return false;
+
+	uint64_t magic = 0, count = 0;
+	bool success = fread(&magic, sizeof(uint64_t), 1, file) == 1 &&
+		magic == ((static_cast<uint64_t>(CHECKPOINT_VERSION) << 32) | CHECKPOINT_MAGIC) &&
+		fread(manifest.m_Header, sizeof(uint64_t), CHECKPOINT_HEADER_COUNT, file) == CHECKPOINT_HEADER_COUNT &&
+		fread(&manifest.m_Generation, sizeof(uint64_t), 1, file) == 1 &&
+		fread(&count, sizeof(uint64_t), 1, file) == 1;
+
+	if (success)
+	{
+		manifest.m_Entries.resize(static_cast<size_t>(count));
+		for (Entry& entry : manifest.m_Entries)
+		{
+			if (fread(&entry.m_Slot, sizeof(uint64_t), 1, file) != 1 ||
+				fread(&entry.m_Generation, sizeof(uint64_t), 1, file) != 1 ||
+				fread(&entry.m_Count, sizeof(uint64_t), 1, file) != 1)
+			{
+				success = false;
+				break;
+			}
+		}
+	}
+
+	fclose(file);
+	return success;
+}
+
+bool _Checkpoint_State::readLayer(const std::string& directory, const Entry& entry, void* data, size_t elementSize)
+{
+	const std::string path = joinPath(directory, layerFileName(entry.m_Generation));
+	return readFile(path, data, static_cast<size_t>(entry.m_Count) * elementSize);
+}
+
+std::string _Checkpoint_State::layerFileName(uint64_t generation)
+{
+	return "layer_" + std::to_string(generation) + ".bin";
+}
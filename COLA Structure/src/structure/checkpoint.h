@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#define CHECKPOINT_MAGIC 0x414C4F43u
+#define CHECKPOINT_VERSION 1u
+#define CHECKPOINT_HEADER_COUNT 4
+
+struct _Checkpoint_Entry
+{
+	// Layer (or array) slot that the elements belong to.
+	uint64_t m_Slot;
+	// Generation of the layer, i.e. the merge that created it.
+	uint64_t m_Generation;
+	// Number of elements stored in the layer file.
+	uint64_t m_Count;
+};
+
+struct _Checkpoint_Manifest
+{
+	// Structure specific state, e.g. size and full flags.
+	uint64_t m_Header[CHECKPOINT_HEADER_COUNT];
+	// Next generation to be assigned by the structure.
+	uint64_t m_Generation;
+
+	std::vector<_Checkpoint_Entry> m_Entries;
+};
+
+class _Checkpoint_State
+{
+public:
+	using Entry = _Checkpoint_Entry;
+	using Manifest = _Checkpoint_Manifest;
+
+public:
+	// Prepare a new checkpoint in the given directory. Layer files from
+	// previous checkpoints are only reused if the directory is unchanged.
+	void begin(const std::string& directory);
+
+	// Write the layer unless a previous checkpoint already stored it.
+	bool addLayer(uint64_t slot, uint64_t generation, const void* data, uint64_t count, size_t elementSize);
+
+	// Publish the manifest of the current checkpoint and remove layer
+	// files that are no longer referenced by any manifest.
+	bool commit(const uint64_t header[CHECKPOINT_HEADER_COUNT], uint64_t generation);
+
+	// Mark the layers of a restored manifest as already written.
+	void adopt(const std::string& directory, const Manifest& manifest);
+
+public:
+	static bool readManifest(const std::string& directory, Manifest& manifest);
+
+	static bool readLayer(const std::string& directory, const Entry& entry, void* data, size_t elementSize);
+
+private:
+	static std::string layerFileName(uint64_t generation);
+
+private:
+	std::string m_Directory;
+	// Number of published manifests referencing each layer file.
+	std::unordered_map<uint64_t, uint32_t> m_RefCounts;
+
+	std::vector<Entry> m_Published;
+	std::vector<Entry> m_Pending;
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "./math_util.h"
+
+template<size_t N>
+class _CompositeCOLA_ConstIterator
+{
+public:
+	using Key = std::array<int64_t, N>;
+	using PointerType = const Key*;
+	using ReferenceType = Key;
+
+public:
+	_CompositeCOLA_ConstIterator(const std::array<const int64_t*, N>& columns, size_t size, size_t index) :
+		m_Columns(columns),
+		m_Size(size),
+		m_Index(index) { }
+
+	_CompositeCOLA_ConstIterator& operator++()
+	{
+		m_Index++;
+
+		// Check if we are at the end of a layer
+		if (isPO2MinusOne(m_Index))
+		{
+			// Get index of the first element in the next layer
+			// or all ones if there are no layers left.
+			m_Index = leastZeroBits(m_Size & (~m_Index));
+		}
+
+		return *this;
+	}
+
+	_CompositeCOLA_ConstIterator operator++(int)
+	{
+		_CompositeCOLA_ConstIterator itr = *this;
+		++(*this);
+		return itr;
+	}
+
+	_CompositeCOLA_ConstIterator& operator--()
+	{
+		// Check if we are at the beginning of a layer
+		if (isPO2MinusOne(m_Index))
+		{
+			// Get index after the last element in the previous layer
+			m_Index = nextPO2MinusOne(m_Size & m_Index);
+		}
+
+		m_Index--;
+
+		return *this;
+	}
+
+	_CompositeCOLA_ConstIterator operator--(int)
+	{
+		_CompositeCOLA_ConstIterator itr = *this;
+		--(*this);
+		return itr;
+	}
+
+	// Keys are gathered from the columns on access, so they are returned by value.
+	ReferenceType operator*() const
+	{
+		Key key;
+		for (size_t c = 0; c < N; c++)
+			key[c] = m_Columns[c][m_Index];
+		return key;
+	}
+
+	bool operator==(const _CompositeCOLA_ConstIterator& other) const
+	{
+		return (m_Columns[0] == other.m_Columns[0] && m_Index == other.m_Index);
+	}
+
+	bool operator!=(const _CompositeCOLA_ConstIterator& other) const
+	{
+		return !(*this == other);
+	}
+
+protected:
+	const std::array<const int64_t*, N> m_Columns;
+	const size_t m_Size;
+	size_t m_Index;
+};
+
+// Cola of composite keys of N integer columns, e.g. (tenant, timestamp)
+// pairs, ordered lexicographically like std::array. The layers are laid out
+// like in BasicCOLA, but column-wise, such that searches run on the first
+// column and only touch the next columns within the run of equal first
+// columns.
+//
+// Range queries take inclusive bounds on full keys, so a range on a prefix
+// of the columns fills the remaining columns of the bounds with the lowest
+// and highest values, e.g. all entries of tenant x from t0 to t1 are the
+// range from (x, t0, INT64_MIN) to (x, t1, INT64_MAX). Each layer takes one
+// lower bound search per range.
+template<size_t N>
+class CompositeCOLA
+{
+	static_assert(N >= 1, "Keys must have at least one column");
+
+public:
+	using Key = std::array<int64_t, N>;
+	using ConstIterator = _CompositeCOLA_ConstIterator<N>;
+
+public:
+	CompositeCOLA() :
+		CompositeCOLA::CompositeCOLA(15) { }
+
+	CompositeCOLA(size_t initialCapacity) :
+		m_Size(0),
+		m_Capacity(std::max(static_cast<size_t>(15), nextPO2MinusOne(initialCapacity)))
+	{
+		// Capacity must be a power of two minus 1 (and greater than zero)
+		for (size_t c = 0; c < N; c++)
+			m_Columns[c].resize(m_Capacity);
+	}
+
+	CompositeCOLA(const CompositeCOLA& other) = default;
+
+public:
+	void add(const Key& key)
+	{
+		const size_t nSize = m_Size + 1;
+		if (nSize > m_Capacity)
+		{
+			// Allocate a new layer
+			m_Capacity = (m_Capacity << 1) + 1;
+			for (size_t c = 0; c < N; c++)
+				m_Columns[c].resize(m_Capacity);
+		}
+
+		// Find first position of empty array (merge-layer)
+		const size_t m = leastZeroBits(nSize);
+		const size_t mEnd = (m << 1) + 1;
+
+		set(mEnd - 1, key);
+
+		// Iteratively merge arrays, moving all columns of a key at once
+		size_t i = 0;
+		while (i != m)
+		{
+			// Index after last element in current layer
+			const size_t iEnd = (i << 1) + 1;
+
+			// Index of first element in merging layer and new index
+			size_t j = mEnd - i - 1;
+			size_t k = mEnd - iEnd - 1;
+
+			// Simple merge sort (ascending order)
+			while (i != iEnd && j != mEnd)
+			{
+				if (compare(i, j) <= 0)
+					move(i++, k++);
+				else
+					move(j++, k++);
+			}
+
+			// Copy remaining elements in current layer
+			while (i != iEnd)
+				move(i++, k++);
+		}
+
+		m_Size = nSize;
+	}
+
+	bool contains(const Key& key) const
+	{
+		const int64_t* first = m_Columns[0].data();
+
+		for (size_t full = m_Size; full != 0; full &= full - 1)
+		{
+			const size_t start = full & (~full + 1);
+			const size_t i = start - 1, iEnd = (start << 1) - 1;
+
+			// Skip layers that can not contain the key
+			if (key[0] < first[i] || key[0] > first[iEnd - 1])
+				continue;
+
+			const size_t k = bound<false>(key, i, iEnd);
+			if (k != iEnd && compare(k, key) == 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	// Largest key less than or equal to key.
+	inline bool predecessor(const Key& key, Key& result) const { return neighbor<true, false>(key, result); }
+
+	// Smallest key greater than or equal to key.
+	inline bool successor(const Key& key, Key& result) const { return neighbor<false, false>(key, result); }
+
+	// Largest key strictly less than key.
+	inline bool strictPredecessor(const Key& key, Key& result) const { return neighbor<true, true>(key, result); }
+
+	// Smallest key strictly greater than key.
+	inline bool strictSuccessor(const Key& key, Key& result) const { return neighbor<false, true>(key, result); }
+
+	// Number of keys in the range [lo, hi].
+	size_t countRange(const Key& lo, const Key& hi) const
+	{
+		size_t count = 0;
+		for (size_t full = m_Size; full != 0; full &= full - 1)
+		{
+			const size_t start = full & (~full + 1);
+			const size_t i = start - 1, iEnd = (start << 1) - 1;
+
+			const size_t k = bound<false>(lo, i, iEnd);
+			const size_t kEnd = bound<true>(hi, k, iEnd);
+			count += kEnd - k;
+		}
+
+		return count;
+	}
+
+	// Call visit(key) for each key in the range [lo, hi], layer by layer.
+	// The keys are sorted within each layer, but not across layers.
+	template<typename F>
+	void forEachInRange(const Key& lo, const Key& hi, F visit) const
+	{
+		for (size_t full = m_Size; full != 0; full &= full - 1)
+		{
+			const size_t start = full & (~full + 1);
+			const size_t i = start - 1, iEnd = (start << 1) - 1;
+
+			for (size_t k = bound<false>(lo, i, iEnd); k != iEnd && compare(k, hi) <= 0; k++)
+				visit(get(k));
+		}
+	}
+
+	inline size_t size() const { return m_Size; }
+
+	inline size_t capacity() const { return m_Capacity; }
+
+	ConstIterator begin() const
+	{
+		return ConstIterator(columns(), m_Size, leastZeroBits(m_Size));
+	}
+
+	ConstIterator end() const
+	{
+		return ConstIterator(columns(), m_Size, ~static_cast<size_t>(0));
+	}
+
+private:
+	inline std::array<const int64_t*, N> columns() const
+	{
+		std::array<const int64_t*, N> columns;
+		for (size_t c = 0; c < N; c++)
+			columns[c] = m_Columns[c].data();
+		return columns;
+	}
+
+	inline Key get(size_t i) const
+	{
+		Key key;
+		for (size_t c = 0; c < N; c++)
+			key[c] = m_Columns[c][i];
+		return key;
+	}
+
+	inline void set(size_t i, const Key& key)
+	{
+		for (size_t c = 0; c < N; c++)
+			m_Columns[c][i] = key[c];
+	}
+
+	inline void move(size_t from, size_t to)
+	{
+		for (size_t c = 0; c < N; c++)
+			m_Columns[c][to] = m_Columns[c][from];
+	}
+
+	// Compare the keys at i and j lexicographically, column by column.
+	inline int compare(size_t i, size_t j) const
+	{
+		for (size_t c = 0; c < N; c++)
+		{
+			if (m_Columns[c][i] != m_Columns[c][j])
+				return (m_Columns[c][i] < m_Columns[c][j]) ? -1 : 1;
+		}
+		return 0;
+	}
+
+	inline int compare(size_t i, const Key& key) const
+	{
+		for (size_t c = 0; c < N; c++)
+		{
+			if (m_Columns[c][i] != key[c])
+				return (m_Columns[c][i] < key[c]) ? -1 : 1;
+		}
+		return 0;
+	}
+
+	// Index of the first key in [start, end) that is not less than key, or
+	// greater than key if UPPER.
+	template<bool UPPER>
+	size_t bound(const Key& key, size_t start, size_t end) const
+	{
+		// Keys with a smaller first column are less than key, and keys with
+		// a greater first column are greater, so it is searched first.
+		const int64_t* first = m_Columns[0].data();
+		size_t lo = (key[0] != std::numeric_limits<int64_t>::min()) ? upperBound(key[0] - 1, first, start, end) : start;
+		size_t hi = upperBound(key[0], first, lo, end);
+
+		// Compare the next columns only for equal first columns
+		while (lo < hi)
+		{
+			const size_t m = lo + ((hi - lo) >> 1);
+			const int c = compare(m, key);
+
+			if (UPPER ? (c <= 0) : (c < 0))
+				lo = m + 1;
+			else
+				hi = m;
+		}
+
+		return lo;
+	}
+
+	// Neighbor of key, the predecessor if PREDECESSOR or the successor
+	// otherwise, which must not be equal to key if STRICT.
+	template<bool PREDECESSOR, bool STRICT>
+	bool neighbor(const Key& key, Key& result) const
+	{
+		bool found = false;
+		size_t best = 0;
+
+		for (size_t full = m_Size; full != 0; full &= full - 1)
+		{
+			const size_t start = full & (~full + 1);
+			const size_t i = start - 1, iEnd = (start << 1) - 1;
+
+			// The predecessor is before the first key greater than key (or
+			// not less if strict), and the successor is the first key not
+			// less than key (or greater if strict).
+			const size_t k = bound<PREDECESSOR != STRICT>(key, i, iEnd);
+			if (PREDECESSOR ? (k == i) : (k == iEnd))
+				continue;
+
+			const size_t j = PREDECESSOR ? k - 1 : k;
+			if (!found || (PREDECESSOR ? (compare(j, best) > 0) : (compare(j, best) < 0)))
+			{
+				found = true;
+				best = j;
+			}
+		}
+
+		if (found)
+			result = get(best);
+		return found;
+	}
+
+private:
+	size_t m_Size;
+	size_t m_Capacity;
+
+	// Column c of all keys, where layer l occupies [2^l - 1, 2^(l+1) - 1).
+	std::vector<int64_t> m_Columns[N];
+};
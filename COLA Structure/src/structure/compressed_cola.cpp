@@ -0,0 +1,424 @@
+#include "./compressed_cola.h"
+
+#include <memory>
+#include <algorithm>
+#include <immintrin.h>
+
+#ifndef COMPRESSED_SIMD_DECODE
+#define COMPRESSED_SIMD_DECODE 1
+#endif // !COMPRESSED_SIMD_DECODE
+
+// Number of offsets stored in each of the lanes of a block
+#define COMPRESSED_LANE_SIZE (COMPRESSED_BLOCK_SIZE / COMPRESSED_LANE_COUNT)
+
+template<typename T>
+static inline uint64_t offsetOf(T value, T min)
+{
+	// Keys are sorted, so value - min is non-negative and
+	// fits in 64 bits, even for int64_t keys.
+	return static_cast<uint64_t>(value) - static_cast<uint64_t>(min);
+}
+
+template<typename T>
+static void encodeBlock(_CompressedCOLA_Layer<T>& layer, const T* keys)
+{
+	const T min = keys[0];
+	const uint64_t range = offsetOf(keys[COMPRESSED_BLOCK_SIZE - 1], min);
+
+	uint8_t bits = 0;
+	while (bits < 64 && (range >> bits) != 0)
+		bits++;
+
+	const size_t start = layer.m_Words.size();
+	layer.m_Mins.push_back(min);
+
+	if (bits > 32)
+	{
+		// Offsets do not fit in the 32-bit lanes, store the keys raw
+		const size_t wordCount = COMPRESSED_BLOCK_SIZE * sizeof(T) / sizeof(uint32_t);
+		layer.m_Words.resize(start + wordCount);
+		memcpy(layer.m_Words.data() + start, keys, COMPRESSED_BLOCK_SIZE * sizeof(T));
+		layer.m_Bits.push_back(COMPRESSED_RAW_BITS);
+	}
+	else if (bits == 0)
+	{
+		// All keys are equal to the minimum, so no words are stored
+		layer.m_Bits.push_back(bits);
+	}
+	else
+	{
+		// Key i is the (i / 8)th offset in lane i % 8. Each lane is a
+		// stream of bits, interleaved with the others word by word.
+		const size_t laneWordCount = (COMPRESSED_LANE_SIZE * bits + 31) / 32;
+		layer.m_Words.resize(start + laneWordCount * COMPRESSED_LANE_COUNT, 0);
+		uint32_t* words = layer.m_Words.data() + start;
+
+		for (size_t i = 0; i < COMPRESSED_BLOCK_SIZE; i++)
+		{
+			const uint32_t offset = static_cast<uint32_t>(offsetOf(keys[i], min));
+			const size_t lane = i % COMPRESSED_LANE_COUNT;
+			const size_t pos = (i / COMPRESSED_LANE_COUNT) * bits;
+			const size_t w = pos >> 5;
+			const size_t s = pos & 31;
+
+			words[w * COMPRESSED_LANE_COUNT + lane] |= offset << s;
+			if (s + bits > 32)
+				words[(w + 1) * COMPRESSED_LANE_COUNT + lane] |= offset >> (32 - s);
+		}
+
+		layer.m_Bits.push_back(bits);
+	}
+
+	layer.m_Offsets.push_back(layer.m_Words.size());
+}
+
+static inline uint32_t bitMask(uint8_t bits)
+{
+	return (bits >= 32) ? ~static_cast<uint32_t>(0) : ((static_cast<uint32_t>(1) << bits) - 1);
+}
+
+#if COMPRESSED_SIMD_DECODE
+static inline __m256i decode8x32u(const uint32_t* words, uint8_t bits, size_t j, __m256i _mask)
+{
+	// Decode offset j of all eight lanes at once. All lanes share the
+	// same bit position, so the shifts are the same for every lane.
+	const size_t pos = j * bits;
+	const size_t w = pos >> 5;
+	const size_t s = pos & 31;
+
+	__m256i _v = _mm256_loadu_si256((const __m256i*)&words[w * COMPRESSED_LANE_COUNT]);
+	_v = _mm256_srl_epi32(_v, _mm_cvtsi32_si128(static_cast<int>(s)));
+
+	if (s + bits > 32)
+	{
+		// The offsets span two words in each lane
+		__m256i _hi = _mm256_loadu_si256((const __m256i*)&words[(w + 1) * COMPRESSED_LANE_COUNT]);
+		_hi = _mm256_sll_epi32(_hi, _mm_cvtsi32_si128(static_cast<int>(32 - s)));
+		_v = _mm256_or_si256(_v, _hi);
+	}
+
+	return _mm256_and_si256(_v, _mask);
+}
+#else
+static inline uint32_t decode32u(const uint32_t* words, uint8_t bits, size_t i)
+{
+	const size_t lane = i % COMPRESSED_LANE_COUNT;
+	const size_t pos = (i / COMPRESSED_LANE_COUNT) * bits;
+	const size_t w = pos >> 5;
+	const size_t s = pos & 31;
+
+	uint32_t offset = words[w * COMPRESSED_LANE_COUNT + lane] >> s;
+	if (s + bits > 32)
+		offset |= words[(w + 1) * COMPRESSED_LANE_COUNT + lane] << (32 - s);
+	return offset & bitMask(bits);
+}
+#endif
+
+template<typename T>
+static void decodeBlock(const _CompressedCOLA_Layer<T>& layer, size_t b, T* keys)
+{
+	const T min = layer.m_Mins[b];
+	const uint8_t bits = layer.m_Bits[b];
+	const uint32_t* words = layer.m_Words.data() + layer.m_Offsets[b];
+
+	if (bits == COMPRESSED_RAW_BITS)
+	{
+		memcpy(keys, words, COMPRESSED_BLOCK_SIZE * sizeof(T));
+		return;
+	}
+
+	if (bits == 0)
+	{
+		std::fill(keys, keys + COMPRESSED_BLOCK_SIZE, min);
+		return;
+	}
+
+#if COMPRESSED_SIMD_DECODE
+	const __m256i _mask = _mm256_set1_epi32(static_cast<int>(bitMask(bits)));
+	alignas(32) uint32_t offsets[COMPRESSED_LANE_COUNT];
+
+	for (size_t j = 0; j < COMPRESSED_LANE_SIZE; j++)
+	{
+		_mm256_store_si256((__m256i*)offsets, decode8x32u(words, bits, j, _mask));
+		for (size_t lane = 0; lane < COMPRESSED_LANE_COUNT; lane++)
+			keys[j * COMPRESSED_LANE_COUNT + lane] = static_cast<T>(static_cast<uint64_t>(min) + offsets[lane]);
+	}
+#else
+	for (size_t i = 0; i < COMPRESSED_BLOCK_SIZE; i++)
+		keys[i] = static_cast<T>(static_cast<uint64_t>(min) + decode32u(words, bits, i));
+#endif
+}
+
+template<typename T>
+static bool searchBlock(const _CompressedCOLA_Layer<T>& layer, size_t b, T value)
+{
+	const uint8_t bits = layer.m_Bits[b];
+	const uint32_t* words = layer.m_Words.data() + layer.m_Offsets[b];
+
+	if (bits == COMPRESSED_RAW_BITS)
+		return binarySearch(value, (const T*)words, 0, COMPRESSED_BLOCK_SIZE);
+
+	// The value must be representable as an offset in the block
+	const uint64_t target = offsetOf(value, layer.m_Mins[b]);
+	if (target > bitMask(bits) || (bits == 0 && target != 0))
+		return false;
+	if (target == 0)
+		return true;
+
+#if COMPRESSED_SIMD_DECODE
+	// Compare the target with all offsets, eight at a time, without
+	// converting the offsets back to keys.
+	const __m256i _mask = _mm256_set1_epi32(static_cast<int>(bitMask(bits)));
+	const __m256i _target = _mm256_set1_epi32(static_cast<int>(target));
+	__m256i _found = _mm256_setzero_si256();
+
+	for (size_t j = 0; j < COMPRESSED_LANE_SIZE; j++)
+		_found = _mm256_or_si256(_found, _mm256_cmpeq_epi32(decode8x32u(words, bits, j, _mask), _target));
+
+	return !_mm256_testz_si256(_found, _found);
+#else
+	for (size_t i = 0; i < COMPRESSED_BLOCK_SIZE; i++)
+	{
+		if (decode32u(words, bits, i) == target)
+			return true;
+	}
+	return false;
+#endif
+}
+
+template<typename T>
+class _CompressedCOLA_Reader
+{
+public:
+	// Read from a sorted array of raw keys.
+	void open(const T* data, size_t count)
+	{
+		m_Layer = nullptr;
+		m_Keys = data;
+		m_Count = count;
+		m_Index = 0;
+	}
+
+	// Read from a compressed layer, one decoded block at a time.
+	void open(const _CompressedCOLA_Layer<T>* layer)
+	{
+		m_Layer = layer;
+		m_Block = 0;
+		m_Keys = m_Buffer;
+		m_Count = COMPRESSED_BLOCK_SIZE;
+		m_Index = 0;
+		decodeBlock(*m_Layer, m_Block, m_Buffer);
+	}
+
+	inline bool empty() const { return m_Index == m_Count; }
+
+	inline T value() const { return m_Keys[m_Index]; }
+
+	inline void next()
+	{
+		if (++m_Index == COMPRESSED_BLOCK_SIZE && m_Layer != nullptr && ++m_Block < m_Layer->m_Mins.size())
+		{
+			decodeBlock(*m_Layer, m_Block, m_Buffer);
+			m_Index = 0;
+		}
+	}
+
+private:
+	const _CompressedCOLA_Layer<T>* m_Layer;
+	size_t m_Block;
+
+	const T* m_Keys;
+	size_t m_Count;
+	size_t m_Index;
+
+	T m_Buffer[COMPRESSED_BLOCK_SIZE];
+};
+
+template<typename T>
+CompressedCOLA<T>::CompressedCOLA(size_t threshold) :
+	m_Data(15),
+	m_Size(0),
+	m_RawLayerCount(0)
+{
+	// Layers of size at most the threshold are stored raw. Compressed
+	// layers then always consist of a whole number of blocks.
+	m_RawLayerCount = popcount(nextPO2MinusOne(std::max(COMPRESSED_BLOCK_SIZE, threshold)));
+}
+
+template<typename T>
+CompressedCOLA<T>::~CompressedCOLA() { }
+
+template<typename T>
+void CompressedCOLA<T>::add(T value)
+{
+	const size_t nSize = m_Size + 1;
+
+	// Find first position of empty array (merge-layer)
+	const size_t m = leastZeroBits(nSize);
+	const size_t rawLayersEnd = (static_cast<size_t>(1) << m_RawLayerCount) - 1;
+
+	if (m < rawLayersEnd)
+	{
+		mergeRaw(m, value);
+	}
+	else
+	{
+		// All raw layers are full. Merge them into the staging layer after
+		// the last raw layer, which is then merged with compressed layers.
+		mergeRaw(rawLayersEnd, value);
+		mergeCompressed(popcount(m));
+	}
+
+	m_Size = nSize;
+}
+
+template<typename T>
+void CompressedCOLA<T>::mergeRaw(size_t m, T value)
+{
+	const size_t mEnd = (m << 1) + 1;
+	if (mEnd > m_Data.size())
+	{
+		// Allocate new layers
+		m_Data.resize(mEnd);
+	}
+
+	m_Data[mEnd - 1] = value;
+
+	// Iteratively merge arrays (see BasicCOLA::add)
+	size_t i = 0;
+	while (i != m)
+	{
+		const size_t iEnd = (i << 1) + 1;
+
+		size_t j = mEnd - i - 1;
+		size_t k = mEnd - iEnd - 1;
+
+		while (i != iEnd && j != mEnd)
+		{
+			if (m_Data[i] <= m_Data[j])
+				m_Data[k++] = m_Data[i++];
+			else
+				m_Data[k++] = m_Data[j++];
+		}
+
+		while (i != iEnd)
+			m_Data[k++] = m_Data[i++];
+	}
+}
+
+template<typename T>
+void CompressedCOLA<T>::mergeCompressed(uint8_t l)
+{
+	const uint8_t rawLayerCount = m_RawLayerCount;
+	const size_t stagingSize = static_cast<size_t>(1) << rawLayerCount;
+
+	// Inputs are the staging layer and all compressed layers below
+	// layer l, which are full since l is the first empty layer.
+	std::vector<_CompressedCOLA_Reader<T>> readers(l - rawLayerCount + 1);
+	readers[0].open(&m_Data[stagingSize - 1], stagingSize);
+
+	size_t wordCount = 0;
+	for (uint8_t i = rawLayerCount; i < l; i++)
+	{
+		readers[i - rawLayerCount + 1].open(&m_Layers[i]);
+		wordCount += m_Layers[i].m_Words.size();
+	}
+
+	std::vector<_CompressedCOLA_Reader<T>*> active;
+	for (auto& reader : readers)
+		active.push_back(&reader);
+
+	Layer dst;
+	const size_t blockCount = (static_cast<size_t>(1) << l) / COMPRESSED_BLOCK_SIZE;
+	dst.m_Mins.reserve(blockCount);
+	dst.m_Bits.reserve(blockCount);
+	dst.m_Offsets.reserve(blockCount + 1);
+	dst.m_Offsets.push_back(0);
+	dst.m_Words.reserve(wordCount + stagingSize * sizeof(T) / sizeof(uint32_t));
+
+	// Multi-way merge of decoded inputs, encoding the output block by block
+	T block[COMPRESSED_BLOCK_SIZE];
+	size_t k = 0;
+
+	while (!active.empty())
+	{
+		size_t best = 0;
+		for (size_t r = 1; r < active.size(); r++)
+		{
+			if (active[r]->value() < active[best]->value())
+				best = r;
+		}
+
+		block[k++] = active[best]->value();
+		if (k == COMPRESSED_BLOCK_SIZE)
+		{
+			encodeBlock(dst, block);
+			k = 0;
+		}
+
+		active[best]->next();
+		if (active[best]->empty())
+		{
+			active[best] = active.back();
+			active.pop_back();
+		}
+	}
+
+	dst.m_Max = block[COMPRESSED_BLOCK_SIZE - 1];
+	m_Layers[l] = std::move(dst);
+
+	// Input layers have been merged away
+	for (uint8_t i = rawLayerCount; i < l; i++)
+		m_Layers[i] = Layer();
+}
+
+template<typename T>
+bool CompressedCOLA<T>::contains(T value) const
+{
+	// Search the raw layers as in BasicCOLA::contains
+	const size_t rawSize = m_Size & ((static_cast<size_t>(1) << m_RawLayerCount) - 1);
+	size_t iEnd = nextPO2MinusOne(rawSize);
+
+	while (iEnd)
+	{
+		const size_t iStart = iEnd >> 1;
+		if ((iEnd & rawSize) > iStart)
+		{
+			if (binarySearch(value, m_Data.data(), iStart, iEnd))
+				return true;
+		}
+		iEnd = iStart;
+	}
+
+	// Binary search the block mins of each compressed layer
+	// and decode the only block that may contain the value.
+	for (uint8_t l = m_RawLayerCount; (m_Size >> l) != 0; l++)
+	{
+		const Layer& layer = m_Layers[l];
+		if (((m_Size >> l) & 0x1) == 0 || value < layer.m_Mins.front() || value > layer.m_Max)
+			continue;
+
+		const size_t b = (std::upper_bound(layer.m_Mins.begin(), layer.m_Mins.end(), value) - layer.m_Mins.begin()) - 1;
+		if (searchBlock(layer, b, value))
+			return true;
+	}
+
+	return false;
+}
+
+template<typename T>
+size_t CompressedCOLA<T>::memoryUsage() const
+{
+	size_t bytes = m_Data.capacity() * sizeof(T);
+	for (const Layer& layer : m_Layers)
+	{
+		bytes += layer.m_Mins.capacity() * sizeof(T);
+		bytes += layer.m_Bits.capacity() * sizeof(uint8_t);
+		bytes += layer.m_Offsets.capacity() * sizeof(size_t);
+		bytes += layer.m_Words.capacity() * sizeof(uint32_t);
+	}
+	return bytes;
+}
+
+template class CompressedCOLA<int32_t>;
+template class CompressedCOLA<int64_t>;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "./math_util.h"
+
+#define COMPRESSED_BLOCK_SIZE static_cast<size_t>(128)
+#define COMPRESSED_LANE_COUNT static_cast<size_t>(8)
+#define COMPRESSED_RAW_BITS 0xFF
+
+template<typename T>
+struct _CompressedCOLA_Layer
+{
+	// Smallest key (frame of reference) of each block.
+	std::vector<T> m_Mins;
+	// Bit width of the packed offsets of each block, or COMPRESSED_RAW_BITS
+	// if the block spans more than 32 bits and is stored uncompressed.
+	std::vector<uint8_t> m_Bits;
+	// Index of the first word of each block (and of the end).
+	std::vector<size_t> m_Offsets;
+	// Offsets from the block min, packed vertically in 8 lanes of 32
+	// bits such that key i of a block is stored in lane i % 8.
+	std::vector<uint32_t> m_Words;
+
+	T m_Max;
+};
+
+template<typename T>
+class CompressedCOLA
+{
+private:
+	using Layer = _CompressedCOLA_Layer<T>;
+
+public:
+	// Layers with more than threshold elements are stored as compressed
+	// blocks. The threshold is at least COMPRESSED_BLOCK_SIZE.
+	CompressedCOLA(size_t threshold);
+
+	CompressedCOLA(const CompressedCOLA& other) = default;
+
+	~CompressedCOLA();
+
+public:
+	void add(T value);
+
+	bool contains(T value) const;
+
+	inline size_t size() const { return m_Size; }
+
+	// Number of bytes used by the raw and the compressed layers.
+	size_t memoryUsage() const;
+
+private:
+	void mergeRaw(size_t m, T value);
+	void mergeCompressed(uint8_t l);
+
+private:
+	std::vector<T> m_Data;
+	size_t m_Size;
+
+	// Number of layers stored uncompressed in m_Data.
+	uint8_t m_RawLayerCount;
+	Layer m_Layers[sizeof(size_t) * 8];
+};
+
+using CompressedBasicCOLA = CompressedCOLA<int64_t>;
+using CompressedAVXBasicCOLA = CompressedCOLA<int32_t>;
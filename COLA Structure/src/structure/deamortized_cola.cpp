@@ -9,7 +9,11 @@ DeamortizedCOLA::DeamortizedCOLA(size_t initialCapacity) :
 	m_MergeFlags(0),
 
 	m_LayerCount(0),
-	m_Layers(nullptr)
+	m_Layers(nullptr),
+	m_SearchPolicy(SearchPolicy::Default),
+	m_SmallLayerHash((static_cast<size_t>(2) << SMALL_LAYER_HASH_BITS) - 2),
+
+	m_Generation(0)
 {
 	// Layers should be able to contain twice the capacity to allow for merging.
 	m_LayerCount = std::max(4ui8, popcount(nextPO2MinusOne(initialCapacity)));
@@ -20,7 +24,8 @@ DeamortizedCOLA::DeamortizedCOLA(size_t initialCapacity) :
 	{
 		// Size of each array on layer l is 2^l. Hence, with two
 		// arrays on each layer the size of layer l is 2^(l + 1).
-		m_Layers[l].m_Data = new int64_t[static_cast<size_t>(2) << l];
+		m_Layers[l].m_Block = allocateShared<int64_t>(static_cast<size_t>(2) << l);
+		m_Layers[l].m_Data = m_Layers[l].m_Block.get();
 	}
 }
 
@@ -30,7 +35,12 @@ DeamortizedCOLA::DeamortizedCOLA(const DeamortizedCOLA& other) :
 	m_MergeFlags(other.m_MergeFlags),
 
 	m_LayerCount(other.m_LayerCount),
-	m_Layers(new Layer[other.m_LayerCount])
+	m_Layers(new Layer[other.m_LayerCount]),
+	m_Fences(other.m_Fences),
+	m_SearchPolicy(other.m_SearchPolicy),
+	m_SmallLayerHash(other.m_SmallLayerHash),
+
+	m_Generation(other.m_Generation)
 {
 	// Allocate and copy layers
 	for (uint8_t l = 0; l < m_LayerCount; l++)
@@ -40,38 +50,116 @@ DeamortizedCOLA::DeamortizedCOLA(const DeamortizedCOLA& other) :
 
 		// Allocate layer data
 		const size_t layerSize = static_cast<size_t>(2) << l;
-		dstLayer.m_Data = new int64_t[layerSize];
-		
+		dstLayer.m_Block = allocateShared<int64_t>(layerSize);
+		dstLayer.m_Data = dstLayer.m_Block.get();
+
 		// Copy layer data
 		memcpy(dstLayer.m_Data, srcLayer.m_Data, layerSize * sizeof(int64_t));
 		dstLayer.m_MergeLeftIndex = srcLayer.m_MergeLeftIndex;
 		dstLayer.m_MergeRightIndex = srcLayer.m_MergeRightIndex;
 		dstLayer.m_MergeDstIndex = srcLayer.m_MergeDstIndex;
+		dstLayer.m_LeftGeneration = srcLayer.m_LeftGeneration;
+		dstLayer.m_RightGeneration = srcLayer.m_RightGeneration;
 	}
 }
 
+DeamortizedCOLA::DeamortizedCOLA(DeamortizedCOLA&& other) noexcept :
+	m_LeftFullFlags(other.m_LeftFullFlags),
+	m_RightFullFlags(other.m_RightFullFlags),
+	m_MergeFlags(other.m_MergeFlags),
+
+	m_LayerCount(other.m_LayerCount),
+	m_Layers(other.m_Layers),
+	m_Fences(other.m_Fences),
+	m_SearchPolicy(other.m_SearchPolicy),
+	m_SmallLayerHash(std::move(other.m_SmallLayerHash)),
+
+	m_Generation(other.m_Generation),
+	m_Checkpoint(std::move(other.m_Checkpoint))
+{
+	// Leave the other cola empty, but still usable. It has no layers
+	// until the next insert allocates the minimum amount of layers.
+	other.m_LeftFullFlags = 0;
+	other.m_RightFullFlags = 0;
+	other.m_MergeFlags = 0;
+	other.m_LayerCount = 0;
+	other.m_Layers = nullptr;
+}
+
 DeamortizedCOLA::~DeamortizedCOLA()
 {
-	for (uint8_t l = 0; l < m_LayerCount; l++)
-		delete[] m_Layers[l].m_Data;
 	delete[] m_Layers;
 }
 
+DeamortizedCOLA& DeamortizedCOLA::operator=(DeamortizedCOLA&& other) noexcept
+{
+	if (this != &other)
+	{
+		delete[] m_Layers;
+
+		m_LeftFullFlags = other.m_LeftFullFlags;
+		m_RightFullFlags = other.m_RightFullFlags;
+		m_MergeFlags = other.m_MergeFlags;
+		m_LayerCount = other.m_LayerCount;
+		m_Layers = other.m_Layers;
+		m_Fences = other.m_Fences;
+		m_SearchPolicy = other.m_SearchPolicy;
+		m_SmallLayerHash = std::move(other.m_SmallLayerHash);
+		m_Generation = other.m_Generation;
+		m_Checkpoint = std::move(other.m_Checkpoint);
+
+		other.m_LeftFullFlags = 0;
+		other.m_RightFullFlags = 0;
+		other.m_MergeFlags = 0;
+		other.m_LayerCount = 0;
+		other.m_Layers = nullptr;
+	}
+
+	return *this;
+}
+
+DeamortizedCOLA DeamortizedCOLA::clone() const
+{
+	DeamortizedCOLA cola(0);
+	delete[] cola.m_Layers;
+	cola.m_Layers = new Layer[m_LayerCount];
+	cola.m_LayerCount = m_LayerCount;
+
+	// Share the layer data instead of copying it. The clone does not
+	// share the checkpoint state, so its first checkpoint is full.
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+		cola.m_Layers[l] = m_Layers[l];
+
+	cola.m_LeftFullFlags = m_LeftFullFlags;
+	cola.m_RightFullFlags = m_RightFullFlags;
+	cola.m_MergeFlags = m_MergeFlags;
+	cola.m_Fences = m_Fences;
+	cola.m_SearchPolicy = m_SearchPolicy;
+	cola.m_SmallLayerHash = m_SmallLayerHash;
+	cola.m_Generation = m_Generation;
+
+	return cola;
+}
+
 void DeamortizedCOLA::add(int64_t value)
 {
 	const size_t nSize = size() + 1;
 	if (nSize > capacity())
 	{
-		// Double the usable capacity
-		reallocLayers(m_LayerCount + 1);
+		// Double the usable capacity, or allocate the minimum
+		// amount of layers if the cola has been moved from.
+		reallocLayers(std::max(4ui8, static_cast<uint8_t>(m_LayerCount + 1)));
 	}
 
 	// Insert value into empty array in first layer
+	unshareLayer(0);
 	if (m_LeftFullFlags & 0x1)
 	{
 		// Insert value in right array
 		m_Layers[0].m_Data[1] = value;
+		m_Layers[0].m_RightGeneration = ++m_Generation;
 		m_RightFullFlags |= 0x1;
+		m_Fences.set(1, value, value);
 
 		// Prepare merging into layer 1
 		prepareMerge(0);
@@ -80,9 +168,14 @@ void DeamortizedCOLA::add(int64_t value)
 	{
 		// Insert value in left array
 		m_Layers[0].m_Data[0] = value;
+		m_Layers[0].m_LeftGeneration = ++m_Generation;
 		m_LeftFullFlags |= 0x1;
+		m_Fences.set(0, value, value);
 	}
 
+	if (SMALL_LAYER_HASH_BITS != 0)
+		m_SmallLayerHash.insert(value);
+
 	// Merge layers with m = 2 * k + 2 moves
 	mergeLayers((m_LayerCount << 1) + 2);
 }
@@ -98,6 +191,17 @@ void DeamortizedCOLA::prepareMerge(const uint8_t l)
 	layer.m_MergeDstIndex = m_LeftFullFlags & (flag << 1);
 }
 
+static uint_fast16_t copyElements(const int64_t* src, size_t& i, size_t end, int64_t* dst, size_t& k, uint_fast16_t m)
+{
+	// Copy up to m elements of src[i, end) to dst[k, ...) at once, and
+	// return the number of moves left.
+	const size_t n = std::min(static_cast<size_t>(m), end - i);
+	std::copy(&src[i], &src[i + n], &dst[k]);
+	i += n;
+	k += n;
+	return m - static_cast<uint_fast16_t>(n);
+}
+
 void DeamortizedCOLA::mergeLayers(uint_fast16_t m)
 {
 	uint8_t l = 0;
@@ -108,6 +212,7 @@ void DeamortizedCOLA::mergeLayers(uint_fast16_t m)
 		if ((m_MergeFlags >> l) & 0x1)
 		{
 			// Current and next layer
+			unshareLayer(l + 1);
 			Layer& srcLayer = m_Layers[l];
 			Layer& dstLayer = m_Layers[l + 1];
 			
@@ -120,6 +225,18 @@ void DeamortizedCOLA::mergeLayers(uint_fast16_t m)
 			const size_t iEnd = static_cast<size_t>(1) << l;
 			const size_t jEnd = static_cast<size_t>(2) << l;
 
+			// Arrays of keys inserted in increasing (or decreasing) order cover
+			// disjoint ranges, in which case the rest of one array precedes the
+			// other and is copied without comparing elements. The first and
+			// last elements of the arrays are their fences.
+			if (i != iEnd && j != jEnd)
+			{
+				if (srcLayer.m_Data[iEnd - 1] <= srcLayer.m_Data[j])
+					m = copyElements(srcLayer.m_Data, i, iEnd, dstLayer.m_Data, k, m);
+				else if (srcLayer.m_Data[jEnd - 1] < srcLayer.m_Data[i])
+					m = copyElements(srcLayer.m_Data, j, jEnd, dstLayer.m_Data, k, m);
+			}
+
 			// Perform simple merge sort with moves (ascending order)
 			while (m && i != iEnd && j != jEnd)
 			{
@@ -131,18 +248,10 @@ void DeamortizedCOLA::mergeLayers(uint_fast16_t m)
 			}
 
 			// Copy remaining elements in left array
-			while (m && i != iEnd)
-			{
-				dstLayer.m_Data[k++] = srcLayer.m_Data[i++];
-				m--;
-			}
+			m = copyElements(srcLayer.m_Data, i, iEnd, dstLayer.m_Data, k, m);
 
 			// Copy remaining elements in right array
-			while (m && j != jEnd)
-			{
-				dstLayer.m_Data[k++] = srcLayer.m_Data[j++];
-				m--;
-			}
+			m = copyElements(srcLayer.m_Data, j, jEnd, dstLayer.m_Data, k, m);
 
 			// Check if we are done merging
 			if (i == iEnd && j == jEnd)
@@ -152,18 +261,28 @@ void DeamortizedCOLA::mergeLayers(uint_fast16_t m)
 				m_RightFullFlags &= ~(1 << l);
 				m_MergeFlags &= ~(1 << l);
 
+				// The elements have left the small layers. The hash set can
+				// not remove them, so it is refilled from the other small
+				// arrays, which hold at most as many elements as were merged.
+				if (l + 1 == SMALL_LAYER_HASH_BITS)
+					rebuildSmallLayerHash();
+
 				// Set full flags of next layer.
 				if ((k >> l) == 0x2)
 				{
 					// We were merging into the left array
+					dstLayer.m_LeftGeneration = ++m_Generation;
 					m_LeftFullFlags |= static_cast<size_t>(2) << l;
+					setFences(l + 1, false);
 					// Test if the other array is also full
 					if ((m_RightFullFlags >> l) & 0x2)
 						prepareMerge(l + 1);
 				}
 				else
 				{
+					dstLayer.m_RightGeneration = ++m_Generation;
 					m_RightFullFlags |= static_cast<size_t>(2) << l;
+					setFences(l + 1, true);
 					if ((m_RightFullFlags >> l) & 0x2)
 						prepareMerge(l + 1);
 				}
@@ -176,24 +295,30 @@ void DeamortizedCOLA::mergeLayers(uint_fast16_t m)
 
 bool DeamortizedCOLA::contains(int64_t value) const
 {
-	for (uint8_t l = 0; l < m_LayerCount; l++)
+	// Recent elements are found in the hash set of the small layers, which
+	// are not searched below.
+	uint8_t l = 0;
+	if (SMALL_LAYER_HASH_BITS != 0)
 	{
-		// Size of an array in the layer is half the layer size
-		const size_t arraySize = static_cast<size_t>(1) << l;
-		
-		// Check if the left array has elements
-		if (((m_LeftFullFlags >> l) & 0x1))
+		if (m_SmallLayerHash.contains(value))
+			return true;
+		l = SMALL_LAYER_HASH_BITS;
+	}
+
+	for (; l < m_LayerCount; l++)
+	{
+		// Check if the left array has elements, and if its
+		// fences do not exclude the value.
+		if (((m_LeftFullFlags >> l) & 0x1) && !m_Fences.excludes(l << 1, value))
 		{
-			// Perform simple binary search
-			if (binarySearch(value, m_Layers[l].m_Data, 0, arraySize))
+			if (arrayContains(l, false, value))
 				return true;
 		}
 
 		// Check if the left array has elements
-		if ((m_RightFullFlags >> l) & 0x1)
+		if (((m_RightFullFlags >> l) & 0x1) && !m_Fences.excludes((l << 1) | 0x1, value))
 		{
-			// Perform simple binary search
-			if (binarySearch(value, m_Layers[l].m_Data, arraySize, arraySize << 1))
+			if (arrayContains(l, true, value))
 				return true;
 		}
 	}
@@ -201,6 +326,75 @@ bool DeamortizedCOLA::contains(int64_t value) const
 	return false;
 }
 
+_Neighbors<int64_t> DeamortizedCOLA::neighbors(int64_t value) const
+{
+	_Neighbors<int64_t> neighbors;
+
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+	{
+		const size_t arraySize = static_cast<size_t>(1) << l;
+		const int64_t* data = m_Layers[l].m_Data;
+
+		// Both arrays of a layer are of power of two size
+		if (((m_LeftFullFlags >> l) & 0x1))
+			neighbors.addSearchResult(value, data, leadbitSearch(value, data, 0, arraySize), arraySize);
+
+		if ((m_RightFullFlags >> l) & 0x1)
+			neighbors.addSearchResult(value, data, leadbitSearch(value, data, arraySize, arraySize), arraySize << 1);
+
+		if (neighbors.isExact(value))
+			break;
+	}
+
+	return neighbors;
+}
+
+size_t DeamortizedCOLA::countLessEqual(int64_t value) const
+{
+	size_t count = 0;
+
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+	{
+		const size_t arraySize = static_cast<size_t>(1) << l;
+		const int64_t* data = m_Layers[l].m_Data;
+
+		// Arrays are counted whole or skipped if their fences allow it
+		if (((m_LeftFullFlags >> l) & 0x1) && !m_Fences.isAbove(l << 1, value))
+		{
+			if (m_Fences.isAtMost(l << 1, value))
+				count += arraySize;
+			else
+			{
+				const size_t i = leadbitSearch(value, data, 0, arraySize);
+				count += i + (data[i] <= value);
+			}
+		}
+
+		if (((m_RightFullFlags >> l) & 0x1) && !m_Fences.isAbove((l << 1) | 0x1, value))
+		{
+			if (m_Fences.isAtMost((l << 1) | 0x1, value))
+				count += arraySize;
+			else
+			{
+				const size_t i = leadbitSearch(value, data, arraySize, arraySize);
+				count += i - arraySize + (data[i] <= value);
+			}
+		}
+	}
+
+	return count;
+}
+
+bool DeamortizedCOLA::select(size_t k, int64_t& result) const
+{
+	int64_t lo, hi;
+	if (k >= size() || !successor(std::numeric_limits<int64_t>::min(), lo) || !predecessor(std::numeric_limits<int64_t>::max(), hi))
+		return false;
+
+	result = selectByValue(k, lo, hi, [this](int64_t value) { return countLessEqual(value); });
+	return true;
+}
+
 size_t DeamortizedCOLA::size() const
 {
 	return m_LeftFullFlags + m_RightFullFlags;
@@ -215,6 +409,130 @@ size_t DeamortizedCOLA::capacity() const
 	return (static_cast<size_t>(1) << m_LayerCount) - 1;
 }
 
+bool DeamortizedCOLA::checkpoint(const std::string& directory)
+{
+	m_Checkpoint.begin(directory);
+
+	// Only full arrays are persisted. Arrays that are currently being merged
+	// into are not full yet, and their sources are still intact.
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+	{
+		const size_t arraySize = static_cast<size_t>(1) << l;
+		const Layer& layer = m_Layers[l];
+
+		if ((m_LeftFullFlags >> l) & 0x1)
+		{
+			if (!m_Checkpoint.addLayer(l << 1, layer.m_LeftGeneration, layer.m_Data, arraySize, sizeof(int64_t)))
+				return false;
+		}
+
+		if ((m_RightFullFlags >> l) & 0x1)
+		{
+			if (!m_Checkpoint.addLayer((l << 1) | 0x1, layer.m_RightGeneration, &layer.m_Data[arraySize], arraySize, sizeof(int64_t)))
+				return false;
+		}
+	}
+
+	const uint64_t header[CHECKPOINT_HEADER_COUNT] = { m_LeftFullFlags, m_RightFullFlags, m_LayerCount, 0 };
+	return m_Checkpoint.commit(header, m_Generation);
+}
+
+bool DeamortizedCOLA::restore(const std::string& directory)
+{
+	_Checkpoint_Manifest manifest;
+	if (!_Checkpoint_State::readManifest(directory, manifest))
+		return false;
+
+	const size_t leftFullFlags = static_cast<size_t>(manifest.m_Header[0]);
+	const size_t rightFullFlags = static_cast<size_t>(manifest.m_Header[1]);
+	const uint8_t layerCount = std::max(m_LayerCount, static_cast<uint8_t>(manifest.m_Header[2]));
+	if (manifest.m_Header[2] > sizeof(size_t) * 8)
+		return false;
+
+	// Read into new layers such that a failed restore leaves the cola unchanged
+	Layer* newLayers = new Layer[layerCount];
+	for (uint8_t l = 0; l < layerCount; l++)
+	{
+		newLayers[l].m_Block = allocateShared<int64_t>(static_cast<size_t>(2) << l);
+		newLayers[l].m_Data = newLayers[l].m_Block.get();
+	}
+
+	size_t restoredLeftFlags = 0;
+	size_t restoredRightFlags = 0;
+	bool success = true;
+
+	for (const _Checkpoint_Entry& entry : manifest.m_Entries)
+	{
+		if ((entry.m_Slot >> 1) >= layerCount)
+		{
+			success = false;
+			break;
+		}
+
+		const uint8_t l = static_cast<uint8_t>(entry.m_Slot >> 1);
+		const size_t arraySize = static_cast<size_t>(1) << l;
+		const bool right = (entry.m_Slot & 0x1) != 0;
+
+		if (entry.m_Count != arraySize ||
+			!_Checkpoint_State::readLayer(directory, entry, &newLayers[l].m_Data[right ? arraySize : 0], sizeof(int64_t)))
+		{
+			success = false;
+			break;
+		}
+
+		if (right)
+		{
+			newLayers[l].m_RightGeneration = entry.m_Generation;
+			restoredRightFlags |= arraySize;
+		}
+		else
+		{
+			newLayers[l].m_LeftGeneration = entry.m_Generation;
+			restoredLeftFlags |= arraySize;
+		}
+	}
+
+	if (!success || restoredLeftFlags != leftFullFlags || restoredRightFlags != rightFullFlags)
+	{
+		delete[] newLayers;
+		return false;
+	}
+
+	delete[] m_Layers;
+
+	m_Layers = newLayers;
+	m_LayerCount = layerCount;
+	m_LeftFullFlags = leftFullFlags;
+	m_RightFullFlags = rightFullFlags;
+	m_MergeFlags = 0;
+	m_Generation = manifest.m_Generation;
+
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+	{
+		if ((m_LeftFullFlags >> l) & 0x1)
+			setFences(l, false);
+		if ((m_RightFullFlags >> l) & 0x1)
+			setFences(l, true);
+	}
+
+	// Layers of the restored checkpoint do not need to be written again
+	m_Checkpoint.adopt(directory, manifest);
+
+	// Merges that were in progress are restarted and completed eagerly, which
+	// leaves the cola in a state where no merges are pending.
+	for (uint8_t l = 0; l < m_LayerCount; l++)
+	{
+		if ((m_LeftFullFlags >> l) & (m_RightFullFlags >> l) & 0x1)
+			prepareMerge(l);
+	}
+
+	while (m_MergeFlags)
+		mergeLayers(UINT_FAST16_MAX);
+
+	rebuildSmallLayerHash();
+	return true;
+}
+
 void DeamortizedCOLA::reallocLayers(uint8_t layerCount)
 {
 	// Allocate and copy layers to new block
@@ -224,9 +542,12 @@ void DeamortizedCOLA::reallocLayers(uint8_t layerCount)
 	for (uint8_t l = 0; l < layerCount; l++)
 	{
 		if (l < m_LayerCount)
-			newLayers[l] = m_Layers[l];
+			newLayers[l] = std::move(m_Layers[l]);
 		else
-			newLayers[l].m_Data = new int64_t[static_cast<size_t>(2) << l];
+		{
+			newLayers[l].m_Block = allocateShared<int64_t>(static_cast<size_t>(2) << l);
+			newLayers[l].m_Data = newLayers[l].m_Block.get();
+		}
 	}
 
 	// Delete and set old block
@@ -234,3 +555,69 @@ void DeamortizedCOLA::reallocLayers(uint8_t layerCount)
 	m_Layers = newLayers;
 	m_LayerCount = layerCount;
 }
+
+void DeamortizedCOLA::unshareLayer(uint8_t l)
+{
+	Layer& layer = m_Layers[l];
+	if (isShared(layer.m_Block))
+	{
+		// Copy the layer before writing to it, since a clone still reads it.
+		// Note: this makes the first write to each shared layer O(2^l).
+		const size_t layerSize = static_cast<size_t>(2) << l;
+		std::shared_ptr<int64_t> newBlock = allocateShared<int64_t>(layerSize);
+		memcpy(newBlock.get(), layer.m_Data, layerSize * sizeof(int64_t));
+
+		layer.m_Block = std::move(newBlock);
+		layer.m_Data = layer.m_Block.get();
+	}
+}
+
+void DeamortizedCOLA::setFences(uint8_t l, bool right)
+{
+	// Fences of a full array are its first and last element
+	const size_t arraySize = static_cast<size_t>(1) << l;
+	const int64_t* array = &m_Layers[l].m_Data[right ? arraySize : 0];
+	m_Fences.set((l << 1) | (right ? 0x1 : 0x0), array[0], array[arraySize - 1]);
+}
+
+bool DeamortizedCOLA::arrayContains(uint8_t l, bool right, int64_t value) const
+{
+	// Size of an array in the layer is half the layer size
+	const size_t arraySize = static_cast<size_t>(1) << l;
+	const size_t start = right ? arraySize : 0;
+	const int64_t* data = m_Layers[l].m_Data;
+
+	// Interpolate between the fences of large arrays
+	if (m_SearchPolicy == SearchPolicy::Interpolation && arraySize >= INTERPOLATION_MIN_SIZE)
+	{
+		const size_t f = (l << 1) | (right ? 0x1 : 0x0);
+		return data[interpolationSearch(value, data, start, start + arraySize, *m_Fences.min(f), *m_Fences.max(f))] == value;
+	}
+
+	// Perform simple binary search
+	return binarySearch(value, data, start, start + arraySize);
+}
+
+void DeamortizedCOLA::rebuildSmallLayerHash()
+{
+	m_SmallLayerHash.clear();
+
+	for (uint8_t l = 0; l < SMALL_LAYER_HASH_BITS && l < m_LayerCount; l++)
+	{
+		// Size of an array in the layer is half the layer size
+		const size_t arraySize = static_cast<size_t>(1) << l;
+		const int64_t* data = m_Layers[l].m_Data;
+
+		if ((m_LeftFullFlags >> l) & 0x1)
+		{
+			for (size_t i = 0; i != arraySize; i++)
+				m_SmallLayerHash.insert(data[i]);
+		}
+
+		if ((m_RightFullFlags >> l) & 0x1)
+		{
+			for (size_t i = arraySize; i != (arraySize << 1); i++)
+				m_SmallLayerHash.insert(data[i]);
+		}
+	}
+}
@@ -1,17 +1,31 @@
 #pragma once
 
 #include "./math_util.h"
+#include "./memory_util.h"
+#include "./neighbor_util.h"
+#include "./order_util.h"
+#include "./checkpoint.h"
+#include "./fence_util.h"
+#include "./interpolation_util.h"
+#include "./small_layer_hash.h"
 
 #include <cstdint>
 #include <iostream>
+#include <string>
 
 struct _DeamortizedCOLA_Layer
 {
+	// Data of the layer, which may be shared with clones.
+	std::shared_ptr<int64_t> m_Block;
 	int64_t* m_Data;
 
 	size_t m_MergeLeftIndex;
 	size_t m_MergeRightIndex;
 	size_t m_MergeDstIndex;
+
+	// Generation of the merge that filled each array.
+	uint64_t m_LeftGeneration;
+	uint64_t m_RightGeneration;
 };
 
 class _DeamortizedCOLA_ConstIterator
@@ -152,17 +166,65 @@ public:
 
 	DeamortizedCOLA(const DeamortizedCOLA& other);
 
+	DeamortizedCOLA(DeamortizedCOLA&& other) noexcept;
+
 	~DeamortizedCOLA();
 
+	DeamortizedCOLA& operator=(DeamortizedCOLA&& other) noexcept;
+
 public:
+	// Create a copy in constant time (per layer). Layers are shared until
+	// either of the colas writes to them, which copies only that layer.
+	DeamortizedCOLA clone() const;
+
 	void add(int64_t value);
 
 	bool contains(int64_t value) const;
 
+	// Largest element less than or equal to value.
+	inline bool predecessor(int64_t value, int64_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int64_t value, int64_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int64_t value, int64_t& result) const { return ::strictPredecessor(*this, value, result); }
+
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int64_t value, int64_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int64_t value, int64_t& result) const { return neighbors(value).nearest(value, result); }
+
+	// Number of elements less than value.
+	inline size_t rank(int64_t value) const { return (value != std::numeric_limits<int64_t>::min()) ? countLessEqual(value - 1) : 0; }
+
+	// Element of rank k, i.e. the k-th smallest element starting from zero.
+	bool select(size_t k, int64_t& result) const;
+
+	// Number of elements in the range [lo, hi].
+	inline size_t countRange(int64_t lo, int64_t hi) const { return (lo <= hi) ? countLessEqual(hi) - rank(lo) : 0; }
+
+	// Element at quantile q in [0, 1], which is the element of rank floor(q * (size - 1)).
+	inline bool quantile(double q, int64_t& result) const { return select(quantileRank(q, size()), result); }
+
 	size_t size() const;
 
 	size_t capacity() const;
 
+	// Persist the arrays filled since the last checkpoint into the
+	// directory, followed by a manifest describing the full structure.
+	bool checkpoint(const std::string& directory);
+
+	// Replace the contents with the latest checkpoint in the directory.
+	bool restore(const std::string& directory);
+
+	// Search large arrays with interpolation search if the keys are close
+	// to uniformly distributed. Defaults to binary search.
+	inline void setSearchPolicy(SearchPolicy policy) { m_SearchPolicy = policy; }
+
+	inline SearchPolicy searchPolicy() const { return m_SearchPolicy; }
+
 	ConstIterator begin() const
 	{
 		const uint8_t layer = popcount(leastZeroBits(m_LeftFullFlags | m_RightFullFlags));
@@ -176,9 +238,22 @@ public:
 	}
 
 private:
+	_Neighbors<int64_t> neighbors(int64_t value) const;
+
+	// Number of elements less than or equal to value.
+	size_t countLessEqual(int64_t value) const;
+
 	void prepareMerge(const uint8_t l);
 	void mergeLayers(uint_fast16_t m);
 	void reallocLayers(uint8_t layerCount);
+	void unshareLayer(uint8_t l);
+	void setFences(uint8_t l, bool right);
+
+	// True if the full left or right array of layer l contains value.
+	bool arrayContains(uint8_t l, bool right, int64_t value) const;
+
+	// Refill the hash set from the full arrays of the small layers.
+	void rebuildSmallLayerHash();
 
 private:
 	size_t m_LeftFullFlags;
@@ -187,4 +262,15 @@ private:
 
 	uint8_t m_LayerCount;
 	Layer* m_Layers;
+
+	// Fences of the full arrays, where the right array of layer l is 2l + 1.
+	_Fences<int64_t, sizeof(size_t) * 16> m_Fences;
+
+	SearchPolicy m_SearchPolicy;
+
+	// Elements of the full arrays of the layers below SMALL_LAYER_HASH_BITS.
+	_SmallLayerHash<int64_t> m_SmallLayerHash;
+
+	uint64_t m_Generation;
+	_Checkpoint_State m_Checkpoint;
 };
@@ -0,0 +1,208 @@
+#include "dedup_cola.h"
+
+#include <memory>
+#include <algorithm>
+
+DedupCOLA::DedupCOLA(bool counted, size_t initialCapacity) :
+	m_Data(),
+	m_Counts(),
+	m_Counted(counted),
+	m_Size(0),
+	m_Occupied(0),
+	m_Layers()
+{
+	// Capacity must be a power of two minus 1 (and greater than zero)
+	m_Data.resize(std::max(static_cast<size_t>(15), nextPO2MinusOne(initialCapacity)));
+	if (m_Counted)
+		m_Counts.resize(m_Data.size());
+}
+
+DedupCOLA::~DedupCOLA() { }
+
+void DedupCOLA::add(int64_t value)
+{
+	if (m_Counted)
+		insert<true>(value);
+	else
+		insert<false>(value);
+}
+
+template<bool COUNTED>
+void DedupCOLA::insert(int64_t value)
+{
+	// Find the first empty layer (merge-layer). All layers below it hold
+	// keys, at most 2^l in layer l, so they fit into it with the value.
+	const uint8_t m = popcount(leastZeroBits(m_Occupied + 1));
+	const size_t mEnd = (static_cast<size_t>(2) << m) - 1;
+	if (mEnd > m_Data.size())
+	{
+		// Allocate a new layer
+		m_Data.resize(mEnd);
+		if (COUNTED)
+			m_Counts.resize(mEnd);
+	}
+
+	// The merged run is kept at [runStart, runEnd) in the merge-layer, and
+	// each layer is merged in front of it. Since keys are only dropped, the
+	// output never overtakes the part of the run that is still to be read.
+	size_t runEnd = mEnd;
+	size_t runStart = mEnd - 1;
+	m_Data[runStart] = value;
+	if (COUNTED)
+		m_Counts[runStart] = 1;
+
+	size_t merged = 0;
+	for (uint8_t l = 0; l < m; l++)
+	{
+		Layer& layer = m_Layers[l];
+		const size_t k = runStart - layer.m_Count;
+		runEnd = mergeUnique<COUNTED>(layer.m_Start, layer.m_Start + layer.m_Count, runStart, runEnd, k);
+		runStart = k;
+
+		merged += layer.m_Count;
+		layer.m_Count = 0;
+	}
+
+	// Store the run in the smallest layer that fits it, which is below the
+	// merge-layer if enough keys were dropped. The layers below the
+	// merge-layer are all empty now, so the run is moved to the start of one.
+	const size_t count = runEnd - runStart;
+	const uint8_t t = popcount(nextPO2MinusOne(count - 1));
+	size_t start = runStart;
+	if (t < m)
+	{
+		start = (static_cast<size_t>(1) << t) - 1;
+		std::copy(&m_Data[runStart], &m_Data[runStart] + count, &m_Data[start]);
+		if (COUNTED)
+			std::copy(&m_Counts[runStart], &m_Counts[runStart] + count, &m_Counts[start]);
+	}
+
+	m_Layers[t] = { start, count };
+	m_Occupied = (m_Occupied & ~((static_cast<size_t>(1) << m) - 1)) | (static_cast<size_t>(1) << t);
+	m_Size = m_Size - merged + count;
+}
+
+template<bool COUNTED>
+size_t DedupCOLA::mergeUnique(size_t i, size_t iEnd, size_t j, size_t jEnd, size_t k)
+{
+	int64_t* data = m_Data.data();
+	size_t* counts = m_Counts.data();
+
+	// Perform simple merge sort (ascending order), where
+	// equal keys are stored once with the sum of their counts
+	while (i != iEnd && j != jEnd)
+	{
+		if (data[i] < data[j])
+		{
+			if (COUNTED)
+				counts[k] = counts[i];
+			data[k++] = data[i++];
+		}
+		else if (data[j] < data[i])
+		{
+			if (COUNTED)
+				counts[k] = counts[j];
+			data[k++] = data[j++];
+		}
+		else
+		{
+			if (COUNTED)
+				counts[k] = counts[i] + counts[j];
+			data[k++] = data[j++];
+			i++;
+		}
+	}
+
+	// Copy remaining elements of the first run
+	for (; i != iEnd; i++, k++)
+	{
+		if (COUNTED)
+			counts[k] = counts[i];
+		data[k] = data[i];
+	}
+
+	// Shift remaining elements of the second run, unless already in place
+	if (k != j)
+	{
+		for (; j != jEnd; j++, k++)
+		{
+			if (COUNTED)
+				counts[k] = counts[j];
+			data[k] = data[j];
+		}
+	}
+	else
+	{
+		k = jEnd;
+	}
+
+	return k;
+}
+
+bool DedupCOLA::contains(int64_t value) const
+{
+	const int64_t* data = m_Data.data();
+
+	for (size_t occupied = m_Occupied; occupied != 0; occupied &= occupied - 1)
+	{
+		const Layer& layer = m_Layers[popcount((occupied & (~occupied + 1)) - 1)];
+		const size_t end = layer.m_Start + layer.m_Count;
+
+		// Skip layers that can not contain the value
+		if (value < data[layer.m_Start] || value > data[end - 1])
+			continue;
+
+		if (binarySearch(value, data, layer.m_Start, end))
+			return true;
+	}
+
+	return false;
+}
+
+size_t DedupCOLA::count(int64_t value) const
+{
+	const int64_t* data = m_Data.data();
+	size_t count = 0;
+
+	for (size_t occupied = m_Occupied; occupied != 0; occupied &= occupied - 1)
+	{
+		const Layer& layer = m_Layers[popcount((occupied & (~occupied + 1)) - 1)];
+		const size_t end = layer.m_Start + layer.m_Count;
+
+		if (value < data[layer.m_Start] || value > data[end - 1])
+			continue;
+
+		// Each layer stores the key at most once
+		const size_t i = upperBound(value, data, layer.m_Start, end);
+		if (i != layer.m_Start && data[i - 1] == value)
+		{
+			if (!m_Counted)
+				return 1;
+			count += m_Counts[i - 1];
+		}
+	}
+
+	return count;
+}
+
+_Neighbors<int64_t> DedupCOLA::neighbors(int64_t value) const
+{
+	const int64_t* data = m_Data.data();
+	_Neighbors<int64_t> neighbors;
+
+	for (size_t occupied = m_Occupied; occupied != 0; occupied &= occupied - 1)
+	{
+		const Layer& layer = m_Layers[popcount((occupied & (~occupied + 1)) - 1)];
+		const size_t end = layer.m_Start + layer.m_Count;
+
+		// Layers are not of power of two size, so search for
+		// the first element greater than value instead.
+		const size_t i = upperBound(value, data, layer.m_Start, end);
+		neighbors.addSearchResult(value, data, (i == layer.m_Start) ? i : i - 1, end);
+
+		if (neighbors.isExact(value))
+			break;
+	}
+
+	return neighbors;
+}
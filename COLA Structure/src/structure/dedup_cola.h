@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "./math_util.h"
+#include "./neighbor_util.h"
+
+// Occupied part of a layer, which holds at most 2^l distinct keys.
+struct _DedupCOLA_Layer
+{
+	size_t m_Start;
+	size_t m_Count;
+};
+
+class _DedupCOLA_ConstIterator
+{
+private:
+	using Layer = _DedupCOLA_Layer;
+	static const uint8_t LAYER_COUNT = sizeof(size_t) * 8;
+public:
+	using PointerType = const int64_t*;
+	using ReferenceType = const int64_t&;
+
+public:
+	_DedupCOLA_ConstIterator(const int64_t* data, const Layer* layers, size_t occupied, uint8_t layer, size_t index) :
+		m_Data(data),
+		m_Layers(layers),
+		m_Occupied(occupied),
+		m_Layer(layer),
+		m_Index(index) { }
+
+	_DedupCOLA_ConstIterator& operator++()
+	{
+		m_Index++;
+
+		// Check if we are at the end of a layer
+		const Layer& layer = m_Layers[m_Layer];
+		if (m_Index == layer.m_Start + layer.m_Count)
+		{
+			// Go to the first element in the next occupied layer,
+			// or to the end if there are no layers left.
+			const size_t next = (m_Layer + 1 < LAYER_COUNT) ? (m_Occupied >> (m_Layer + 1)) : 0;
+			if (next == 0)
+			{
+				m_Layer = LAYER_COUNT;
+				m_Index = ~static_cast<size_t>(0);
+			}
+			else
+			{
+				m_Layer += 1 + popcount((next & (~next + 1)) - 1);
+				m_Index = m_Layers[m_Layer].m_Start;
+			}
+		}
+
+		return *this;
+	}
+
+	_DedupCOLA_ConstIterator operator++(int)
+	{
+		_DedupCOLA_ConstIterator itr = *this;
+		++(*this);
+		return itr;
+	}
+
+	_DedupCOLA_ConstIterator& operator--()
+	{
+		// Check if we are at the beginning of a layer (or at the end)
+		if (m_Layer == LAYER_COUNT || m_Index == m_Layers[m_Layer].m_Start)
+		{
+			// Go after the last element in the previous occupied layer
+			const size_t previous = (m_Layer == LAYER_COUNT) ? m_Occupied : (m_Occupied & ((static_cast<size_t>(1) << m_Layer) - 1));
+			m_Layer = popcount(nextPO2MinusOne(previous)) - 1;
+			m_Index = m_Layers[m_Layer].m_Start + m_Layers[m_Layer].m_Count;
+		}
+
+		m_Index--;
+
+		return *this;
+	}
+
+	_DedupCOLA_ConstIterator operator--(int)
+	{
+		_DedupCOLA_ConstIterator itr = *this;
+		--(*this);
+		return itr;
+	}
+
+	PointerType operator->() const
+	{
+		return &m_Data[m_Index];
+	}
+
+	ReferenceType operator*() const
+	{
+		return m_Data[m_Index];
+	}
+
+	bool operator==(const _DedupCOLA_ConstIterator& other) const
+	{
+		return (m_Data == other.m_Data && m_Index == other.m_Index);
+	}
+
+	bool operator!=(const _DedupCOLA_ConstIterator& other) const
+	{
+		return !(*this == other);
+	}
+
+protected:
+	const int64_t* m_Data;
+	const Layer* m_Layers;
+	const size_t m_Occupied;
+	uint8_t m_Layer;
+	size_t m_Index;
+};
+
+// Cola that stores each key once per layer. Equal keys are dropped when
+// layers are merged, such that the layers are of variable length, and each
+// merge only moves the distinct keys. In set mode only the keys are stored.
+// In multiset mode a count is stored for each key, and equal keys are
+// merged into one with the sum of their counts.
+//
+// A key is only stored in more than one layer until those layers are
+// merged, so size() and the iterators count it once per layer.
+class DedupCOLA
+{
+private:
+	using Layer = _DedupCOLA_Layer;
+public:
+	using ConstIterator = _DedupCOLA_ConstIterator;
+
+public:
+	DedupCOLA() :
+		DedupCOLA::DedupCOLA(false) { }
+
+	// Store a count of each key if counted (multiset mode), or only the
+	// keys otherwise (set mode).
+	DedupCOLA(bool counted, size_t initialCapacity = 15);
+
+	DedupCOLA(const DedupCOLA& other) = default;
+
+	~DedupCOLA();
+
+public:
+	void add(int64_t value);
+
+	bool contains(int64_t value) const;
+
+	// Number of times value was added in multiset mode, or
+	// whether it was added (zero or one) in set mode.
+	size_t count(int64_t value) const;
+
+	// Largest element less than or equal to value.
+	inline bool predecessor(int64_t value, int64_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int64_t value, int64_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int64_t value, int64_t& result) const { return ::strictPredecessor(*this, value, result); }
+
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int64_t value, int64_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int64_t value, int64_t& result) const { return neighbors(value).nearest(value, result); }
+
+	// Number of stored keys.
+	inline size_t size() const { return m_Size; }
+
+	inline size_t capacity() const { return m_Data.size(); }
+
+	inline bool isCounted() const { return m_Counted; }
+
+	ConstIterator begin() const
+	{
+		if (m_Occupied == 0)
+			return end();
+
+		// First element of the first occupied layer
+		const uint8_t l = popcount((m_Occupied & (~m_Occupied + 1)) - 1);
+		return ConstIterator(m_Data.data(), m_Layers, m_Occupied, l, m_Layers[l].m_Start);
+	}
+
+	ConstIterator end() const
+	{
+		return ConstIterator(m_Data.data(), m_Layers, m_Occupied, sizeof(size_t) * 8, ~static_cast<size_t>(0));
+	}
+
+private:
+	template<bool COUNTED>
+	void insert(int64_t value);
+
+	// Merge the sorted runs [i, iEnd) and [j, jEnd) into k onwards, storing
+	// equal keys once. Returns the end of the merged run. The output may
+	// overlap the second run as long as k + (iEnd - i) <= j.
+	template<bool COUNTED>
+	size_t mergeUnique(size_t i, size_t iEnd, size_t j, size_t jEnd, size_t k);
+
+	_Neighbors<int64_t> neighbors(int64_t value) const;
+
+private:
+	std::vector<int64_t> m_Data;
+
+	// Count of each key in multiset mode, at the same index as the key.
+	std::vector<size_t> m_Counts;
+	bool m_Counted;
+
+	size_t m_Size;
+
+	// Layers that hold at least one key, and the part of each that does.
+	size_t m_Occupied;
+	Layer m_Layers[sizeof(size_t) * 8];
+};
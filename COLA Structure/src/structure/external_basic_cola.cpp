@@ -0,0 +1,369 @@
+#include "./external_basic_cola.h"
+
+#include "./file_util.h"
+
+#include <memory>
+#include <algorithm>
+
+void _ExternalBasicCOLA_RunReader::open(FILE* file, uint64_t count)
+{
+	m_File = file;
+	m_Count = count;
+	m_ReadCount = 0;
+
+	m_Block = nullptr;
+	m_BlockSize = 0;
+	m_Index = 0;
+
+	m_Buffers[0].resize(EXTERNAL_BLOCK_SIZE);
+	m_Buffers[1].resize(EXTERNAL_BLOCK_SIZE);
+	m_PendingBuffer = 0;
+	m_Good = true;
+
+	// Start reading the first block and wait for it
+	readAsync();
+	nextBlock();
+}
+
+void _ExternalBasicCOLA_RunReader::open(const int64_t* data, uint64_t count)
+{
+	m_File = nullptr;
+	m_Count = m_ReadCount = count;
+
+	m_Block = data;
+	m_BlockSize = static_cast<size_t>(count);
+	m_Index = 0;
+
+	m_PendingSize = 0;
+	m_Good = true;
+}
+
+void _ExternalBasicCOLA_RunReader::nextBlock()
+{
+	m_Index = 0;
+	m_BlockSize = m_PendingSize;
+
+	if (m_PendingSize != 0)
+	{
+		if (!m_Pending.get())
+			m_Good = false;
+
+		// The block that was just consumed is reused for the next read
+		m_Block = m_Buffers[m_PendingBuffer].data();
+		m_PendingBuffer ^= 0x1;
+		readAsync();
+	}
+}
+
+void _ExternalBasicCOLA_RunReader::readAsync()
+{
+	m_PendingSize = static_cast<size_t>(std::min(static_cast<uint64_t>(EXTERNAL_BLOCK_SIZE), m_Count - m_ReadCount));
+	if (m_PendingSize == 0)
+		return;
+
+	FILE* file = m_File;
+	int64_t* buffer = m_Buffers[m_PendingBuffer].data();
+	const size_t size = m_PendingSize * sizeof(int64_t);
+	const uint64_t offset = m_ReadCount * sizeof(int64_t);
+
+	m_Pending = std::async(std::launch::async, [file, buffer, size, offset]() {
+		return readAt(file, buffer, size, offset);
+	});
+	m_ReadCount += m_PendingSize;
+}
+
+ExternalBasicCOLA::ExternalBasicCOLA(const std::string& directory, size_t memoryBudget) :
+	m_Data(nullptr),
+	m_Capacity(0),
+	m_Size(0),
+
+	m_MemoryLayerCount(0),
+	m_Directory(directory),
+
+	m_Generation(0),
+	m_Good(true)
+{
+	// Layers of size at most the budget are kept in memory (at least four).
+	m_MemoryLayerCount = popcount(nextPO2MinusOne(std::max(static_cast<size_t>(15), memoryBudget)));
+
+	for (Run& run : m_Runs)
+	{
+		run.m_File = nullptr;
+		run.m_Max = 0;
+	}
+
+	m_Capacity = 15;
+	m_Data = new int64_t[m_Capacity];
+}
+
+ExternalBasicCOLA::~ExternalBasicCOLA()
+{
+	// Spilled runs are temporary and removed with the cola
+	for (Run& run : m_Runs)
+	{
+		if (run.m_File != nullptr)
+		{
+			fclose(run.m_File);
+			std::remove(run.m_Path.c_str());
+		}
+	}
+
+	delete[] m_Data;
+}
+
+bool ExternalBasicCOLA::add(int64_t value)
+{
+	const size_t nSize = m_Size + 1;
+
+	// Find first position of empty array (merge-layer)
+	const size_t m = leastZeroBits(nSize);
+	const size_t memoryLayersEnd = (static_cast<size_t>(1) << m_MemoryLayerCount) - 1;
+
+	if (m < memoryLayersEnd)
+	{
+		// Merge into a layer that is kept in memory
+		mergeMemory(m, value);
+	}
+	else
+	{
+		// All layers in memory are full. Merge them into the staging layer
+		// after the last memory layer, and merge that with the spilled runs.
+		// The new run is created first, such that the layers are left
+		// unchanged if it can not be created.
+		const uint8_t l = popcount(m);
+		if (!createRun(l))
+		{
+			m_Good = false;
+			return false;
+		}
+
+		mergeMemory(memoryLayersEnd, value);
+		if (!mergeExternal(l))
+		{
+			// The spilled runs are kept, so only the layers in memory have to
+			// be restored. They were full and are refilled, as one sorted
+			// sequence, from the staging layer without the new value.
+			const size_t stagingSize = memoryLayersEnd + 1;
+			int64_t* staging = &m_Data[memoryLayersEnd];
+			int64_t* position = std::lower_bound(staging, staging + stagingSize, value);
+			std::copy(staging, position, m_Data);
+			std::copy(position + 1, staging + stagingSize, m_Data + (position - staging));
+
+			m_Good = false;
+			return false;
+		}
+	}
+
+	m_Size = nSize;
+	return true;
+}
+
+bool ExternalBasicCOLA::createRun(uint8_t l)
+{
+	Run& run = m_Runs[l];
+	run.m_Path = joinPath(m_Directory, "run_" + std::to_string(++m_Generation) + ".bin");
+	run.m_File = openFile(run.m_Path, "w+b");
+	return run.m_File != nullptr;
+}
+
+void ExternalBasicCOLA::mergeMemory(size_t m, int64_t value)
+{
+	const size_t mEnd = (m << 1) + 1;
+	while (mEnd > m_Capacity)
+	{
+		// Allocate a new layer
+		reallocData((m_Capacity << 1) + 1);
+	}
+
+	m_Data[mEnd - 1] = value;
+
+	// Iteratively merge arrays (see BasicCOLA::add)
+	size_t i = 0;
+	while (i != m)
+	{
+		const size_t iEnd = (i << 1) + 1;
+
+		size_t j = mEnd - i - 1;
+		size_t k = mEnd - iEnd - 1;
+
+		while (i != iEnd && j != mEnd)
+		{
+			if (m_Data[i] <= m_Data[j])
+				m_Data[k++] = m_Data[i++];
+			else
+				m_Data[k++] = m_Data[j++];
+		}
+
+		while (i != iEnd)
+			m_Data[k++] = m_Data[i++];
+	}
+}
+
+bool ExternalBasicCOLA::mergeExternal(uint8_t l)
+{
+	const uint8_t memoryLayerCount = m_MemoryLayerCount;
+	const size_t stagingSize = static_cast<size_t>(1) << memoryLayerCount;
+
+	// Inputs are the staging layer and all spilled runs below layer l,
+	// which are full since l is the first empty layer.
+	std::vector<RunReader> readers(l - memoryLayerCount + 1);
+	readers[0].open(&m_Data[stagingSize - 1], stagingSize);
+	for (uint8_t i = memoryLayerCount; i < l; i++)
+		readers[i - memoryLayerCount + 1].open(m_Runs[i].m_File, static_cast<uint64_t>(1) << i);
+
+	std::vector<RunReader*> active;
+	for (RunReader& reader : readers)
+		active.push_back(&reader);
+
+	// The file of the new run has been created by createRun
+	Run& dst = m_Runs[l];
+	dst.m_Fences.clear();
+	dst.m_Fences.reserve((static_cast<size_t>(1) << l) / EXTERNAL_FENCE_INTERVAL + 1);
+
+	// Output is double buffered as well, such that a block is being
+	// written while the next block is being merged.
+	std::vector<int64_t> buffers[2] = {
+		std::vector<int64_t>(EXTERNAL_BLOCK_SIZE),
+		std::vector<int64_t>(EXTERNAL_BLOCK_SIZE)
+	};
+	std::future<bool> pending;
+	uint8_t b = 0;
+	size_t k = 0;
+	uint64_t offset = 0;
+	uint64_t count = 0;
+	int64_t value = 0;
+	bool good = true;
+
+	auto writeAsync = [&]() {
+		if (pending.valid() && !pending.get())
+			good = false;
+
+		FILE* file = dst.m_File;
+		const int64_t* data = buffers[b].data();
+		const size_t size = k * sizeof(int64_t);
+		const uint64_t o = offset;
+		pending = std::async(std::launch::async, [file, data, size, o]() {
+			return writeAt(file, data, size, o);
+		});
+
+		offset += size;
+		b ^= 0x1;
+		k = 0;
+	};
+
+	// Multi-way merge of the inputs into the new run
+	while (good && !active.empty())
+	{
+		size_t best = 0;
+		for (size_t r = 1; r < active.size(); r++)
+		{
+			if (active[r]->value() < active[best]->value())
+				best = r;
+		}
+
+		value = active[best]->value();
+		active[best]->next();
+		if (!active[best]->good())
+		{
+			good = false;
+			break;
+		}
+		if (active[best]->empty())
+		{
+			active[best] = active.back();
+			active.pop_back();
+		}
+
+		// Build the fence index while writing the run
+		if (count % EXTERNAL_FENCE_INTERVAL == 0)
+			dst.m_Fences.push_back(value);
+		count++;
+
+		buffers[b][k++] = value;
+		if (k == EXTERNAL_BLOCK_SIZE)
+			writeAsync();
+	}
+
+	if (good && k != 0)
+		writeAsync();
+	if (pending.valid() && !pending.get())
+		good = false;
+
+	if (!good)
+	{
+		// Only the new run is discarded. The input runs are still complete.
+		fclose(dst.m_File);
+		std::remove(dst.m_Path.c_str());
+		dst.m_File = nullptr;
+		dst.m_Fences.clear();
+		return false;
+	}
+
+	dst.m_Max = value;
+
+	// Input runs have been merged away
+	for (uint8_t i = memoryLayerCount; i < l; i++)
+	{
+		Run& run = m_Runs[i];
+		fclose(run.m_File);
+		std::remove(run.m_Path.c_str());
+		run.m_File = nullptr;
+		run.m_Fences.clear();
+	}
+
+	return true;
+}
+
+bool ExternalBasicCOLA::contains(int64_t value) const
+{
+	// Search the layers in memory as in BasicCOLA::contains
+	const size_t memorySize = m_Size & ((static_cast<size_t>(1) << m_MemoryLayerCount) - 1);
+	size_t iEnd = nextPO2MinusOne(memorySize);
+
+	while (iEnd)
+	{
+		const size_t iStart = iEnd >> 1;
+		if ((iEnd & memorySize) > iStart)
+		{
+			if (binarySearch(value, m_Data, iStart, iEnd))
+				return true;
+		}
+		iEnd = iStart;
+	}
+
+	// Each spilled run is searched with a single read of the block
+	// that the fence index points to.
+	int64_t block[EXTERNAL_FENCE_INTERVAL];
+
+	for (uint8_t l = m_MemoryLayerCount; (m_Size >> l) != 0; l++)
+	{
+		const Run& run = m_Runs[l];
+		if (((m_Size >> l) & 0x1) == 0 || value < run.m_Fences.front() || value > run.m_Max)
+			continue;
+
+		const size_t b = (std::upper_bound(run.m_Fences.begin(), run.m_Fences.end(), value) - run.m_Fences.begin()) - 1;
+		const size_t start = b * EXTERNAL_FENCE_INTERVAL;
+		const size_t count = std::min(EXTERNAL_FENCE_INTERVAL, (static_cast<size_t>(1) << l) - start);
+
+		if (readAt(run.m_File, block, count * sizeof(int64_t), start * sizeof(int64_t)) &&
+			binarySearch(value, block, 0, count))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ExternalBasicCOLA::reallocData(size_t capacity)
+{
+	// Allocate and copy memory to new block
+	int64_t* newBlock = new int64_t[capacity];
+	const size_t c = (capacity > m_Capacity) ? m_Capacity : capacity;
+	memcpy(newBlock, m_Data, c * sizeof(int64_t));
+
+	// Delete and set old block
+	delete[] m_Data;
+	m_Data = newBlock;
+	m_Capacity = capacity;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <future>
+
+#include "./math_util.h"
+
+#ifndef EXTERNAL_BLOCK_SIZE
+// Number of elements transferred by each asynchronous read or write.
+#define EXTERNAL_BLOCK_SIZE (static_cast<size_t>(1) << 17)
+#endif // !EXTERNAL_BLOCK_SIZE
+
+#ifndef EXTERNAL_FENCE_INTERVAL
+// Number of elements between fence keys of a spilled run. A lookup
+// reads exactly one such block from each spilled run.
+#define EXTERNAL_FENCE_INTERVAL static_cast<size_t>(512)
+#endif // !EXTERNAL_FENCE_INTERVAL
+
+struct _ExternalBasicCOLA_Run
+{
+	// File containing the sorted run, or nullptr if the layer is empty.
+	FILE* m_File;
+	std::string m_Path;
+
+	// First key of every block of EXTERNAL_FENCE_INTERVAL elements.
+	std::vector<int64_t> m_Fences;
+	int64_t m_Max;
+};
+
+class _ExternalBasicCOLA_RunReader
+{
+public:
+	// Read from a file using double buffering, such that the next
+	// block is read while the current block is being merged.
+	void open(FILE* file, uint64_t count);
+
+	// Read from a sorted array in memory.
+	void open(const int64_t* data, uint64_t count);
+
+	inline bool empty() const { return m_Index == m_BlockSize; }
+
+	inline int64_t value() const { return m_Block[m_Index]; }
+
+	inline void next()
+	{
+		if (++m_Index == m_BlockSize && m_File != nullptr)
+			nextBlock();
+	}
+
+	inline bool good() const { return m_Good; }
+
+private:
+	void nextBlock();
+	void readAsync();
+
+private:
+	FILE* m_File;
+	uint64_t m_Count;
+	uint64_t m_ReadCount;
+
+	const int64_t* m_Block;
+	size_t m_BlockSize;
+	size_t m_Index;
+
+	std::vector<int64_t> m_Buffers[2];
+	uint8_t m_PendingBuffer;
+	std::future<bool> m_Pending;
+	size_t m_PendingSize;
+	bool m_Good;
+};
+
+class ExternalBasicCOLA
+{
+private:
+	using Run = _ExternalBasicCOLA_Run;
+	using RunReader = _ExternalBasicCOLA_RunReader;
+
+public:
+	// Layers with more than memoryBudget elements are stored as
+	// sorted runs in files in the given directory.
+	ExternalBasicCOLA(const std::string& directory, size_t memoryBudget);
+
+	ExternalBasicCOLA(const ExternalBasicCOLA& other) = delete;
+
+	~ExternalBasicCOLA();
+
+public:
+	// Returns false, leaving the cola unchanged, if a new spilled run
+	// can not be created, or reading or writing a run fails.
+	bool add(int64_t value);
+
+	bool contains(int64_t value) const;
+
+	inline size_t size() const { return m_Size; }
+
+	inline size_t capacity() const { return m_Capacity; }
+
+	// Number of layers kept in memory. Layers above are spilled.
+	inline uint8_t memoryLayerCount() const { return m_MemoryLayerCount; }
+
+	// False if reading or writing a spilled run has failed.
+	inline bool good() const { return m_Good; }
+
+private:
+	void mergeMemory(size_t m, int64_t value);
+	bool mergeExternal(uint8_t l);
+	bool createRun(uint8_t l);
+	void reallocData(size_t capacity);
+
+private:
+	int64_t* m_Data;
+	size_t m_Capacity;
+	size_t m_Size;
+
+	uint8_t m_MemoryLayerCount;
+	std::string m_Directory;
+	Run m_Runs[sizeof(size_t) * 8];
+
+	uint64_t m_Generation;
+	bool m_Good;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Smallest and largest element of each layer (or array) of a cola. Layers
+// only contain values in [min, max], so searches skip the layers whose
+// fences exclude the value. The fences are packed, such that those of all
+// layers fit in a few cache lines. The first PADDING entries are not used
+// by any layer, which allows loading vectors of fences ending at any layer.
+template<typename T, size_t COUNT, size_t PADDING = 0>
+struct _Fences
+{
+	T m_Min[PADDING + COUNT];
+	T m_Max[PADDING + COUNT];
+
+	_Fences() :
+		m_Min(),
+		m_Max() { }
+
+	inline void set(size_t l, T min, T max)
+	{
+		m_Min[PADDING + l] = min;
+		m_Max[PADDING + l] = max;
+	}
+
+	// True if layer l can not contain value.
+	inline bool excludes(size_t l, T value) const
+	{
+		return value < m_Min[PADDING + l] || value > m_Max[PADDING + l];
+	}
+
+	// True if all elements of layer l are less than or equal to value.
+	inline bool isAtMost(size_t l, T value) const
+	{
+		return m_Max[PADDING + l] <= value;
+	}
+
+	// True if all elements of layer l are greater than value.
+	inline bool isAbove(size_t l, T value) const
+	{
+		return m_Min[PADDING + l] > value;
+	}
+
+	// Packed fences from layer l onwards, where l may be as low as -PADDING.
+	inline const T* min(ptrdiff_t l) const { return &m_Min[PADDING + l]; }
+	inline const T* max(ptrdiff_t l) const { return &m_Max[PADDING + l]; }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static std::string joinPath(const std::string& directory, const std::string& name)
+{
+	if (directory.empty())
+		return name;
+
+	const char last = directory.back();
+	if (last == '/' || last == '\\')
+		return directory + name;
+	return directory + '/' + name;
+}
+
+static FILE* openFile(const std::string& path, const char* mode)
+{
+	FILE* file = nullptr;
+#ifdef _WIN32
+	if (fopen_s(&file, path.c_str(), mode) != 0)
+		return nullptr;
+#else
+	file = fopen(path.c_str(), mode);
+#endif
+	return file;
+}
+
+static bool syncFile(FILE* file)
+{
+	// Flush the user space buffer before forcing the
+	// operating system to write the file to disk.
+	if (fflush(file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool writeFile(const std::string& path, const void* data, size_t size)
+{
+	FILE* file = openFile(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	bool success = (size == 0 || fwrite(data, 1, size, file) == size);
+	success = syncFile(file) && success;
+	return (fclose(file) == 0) && success;
+}
+
+static bool readFile(const std::string& path, void* data, size_t size)
+{
+	FILE* file = openFile(path, "rb");
+	if (file == nullptr)
+		return false;
+
+	const bool success = (size == 0 || fread(data, 1, size, file) == size);
+	fclose(file);
+	return success;
+}
+
+static bool readAt(FILE* file, void* data, size_t size, uint64_t offset)
+{
+	// Files accessed with readAt/writeAt must only have a single
+	// outstanding operation, since the file position may be shared.
+#ifdef _WIN32
+	if (_fseeki64(file, static_cast<int64_t>(offset), SEEK_SET) != 0)
+		return false;
+	return fread(data, 1, size, file) == size;
+#else
+	char* dst = static_cast<char*>(data);
+	while (size != 0)
+	{
+		const ssize_t n = pread(fileno(file), dst, size, static_cast<off_t>(offset));
+		if (n <= 0)
+			return false;
+		dst += n;
+		size -= static_cast<size_t>(n);
+		offset += static_cast<uint64_t>(n);
+	}
+	return true;
+#endif
+}
+
+static bool fileSize(FILE* file, uint64_t& size)
+{
+	// The file position is moved back to the start of the file
+#ifdef _WIN32
+	if (_fseeki64(file, 0, SEEK_END) != 0)
+		return false;
+	const int64_t end = _ftelli64(file);
+#else
+	if (fseeko(file, 0, SEEK_END) != 0)
+		return false;
+	const off_t end = ftello(file);
+#endif
+	rewind(file);
+	if (end < 0)
+		return false;
+
+	size = static_cast<uint64_t>(end);
+	return true;
+}
+
+static bool writeAt(FILE* file, const void* data, size_t size, uint64_t offset)
+{
+#ifdef _WIN32
+	if (_fseeki64(file, static_cast<int64_t>(offset), SEEK_SET) != 0)
+		return false;
+	return fwrite(data, 1, size, file) == size && fflush(file) == 0;
+#else
+	const char* src = static_cast<const char*>(data);
+	while (size != 0)
+	{
+		const ssize_t n = pwrite(fileno(file), src, size, static_cast<off_t>(offset));
+		if (n <= 0)
+			return false;
+		src += n;
+		size -= static_cast<size_t>(n);
+		offset += static_cast<uint64_t>(n);
+	}
+	return true;
+#endif
+}
+
+static bool replaceFile(const std::string& srcPath, const std::string& dstPath)
+{
+	// Renaming onto an existing file is not allowed on every platform,
+	// so the destination must be removed first.
+	std::remove(dstPath.c_str());
+	return std::rename(srcPath.c_str(), dstPath.c_str()) == 0;
+}
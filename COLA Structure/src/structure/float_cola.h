@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <type_traits>
+
+// Map a floating point key onto an integer key of the same size, such that
+// the integers are ordered like the keys. Positive keys keep their bits,
+// which are already ordered, while negative keys have all bits but the sign
+// flipped, such that larger magnitudes become smaller integers.
+//
+// -0.0 is mapped to +0.0, such that keys are equal when they compare equal.
+// All NaNs are mapped to the same positive quiet NaN, which is greater than
+// +infinity, such that NaN keys are ordered and can be found.
+template<typename I, typename F>
+static inline I encodeFloatKey(F value)
+{
+	using U = typename std::make_unsigned<I>::type;
+	static_assert(sizeof(I) == sizeof(F), "The integer key must be of the same size as the floating point key");
+
+	if (value == static_cast<F>(0))
+		value = static_cast<F>(0);
+	else if (std::isnan(value))
+		value = std::numeric_limits<F>::quiet_NaN();
+
+	U bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const U sign = static_cast<U>(1) << (sizeof(U) * 8 - 1);
+	if (bits & sign)
+		bits ^= ~sign;
+	return static_cast<I>(bits);
+}
+
+template<typename F, typename I>
+static inline F decodeFloatKey(I key)
+{
+	using U = typename std::make_unsigned<I>::type;
+
+	// Flipping the bits but the sign again restores negative keys
+	U bits = static_cast<U>(key);
+	const U sign = static_cast<U>(1) << (sizeof(U) * 8 - 1);
+	if (bits & sign)
+		bits ^= ~sign;
+
+	F value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+template<typename C, typename F>
+class _FloatCOLA_ConstIterator
+{
+private:
+	using Iterator = typename C::ConstIterator;
+	using KeyType = typename std::decay<typename Iterator::ReferenceType>::type;
+public:
+	using PointerType = const F*;
+	using ReferenceType = F;
+
+public:
+	_FloatCOLA_ConstIterator(const Iterator& itr) :
+		m_Itr(itr) { }
+
+	_FloatCOLA_ConstIterator& operator++()
+	{
+		++m_Itr;
+		return *this;
+	}
+
+	_FloatCOLA_ConstIterator operator++(int)
+	{
+		_FloatCOLA_ConstIterator itr = *this;
+		++(*this);
+		return itr;
+	}
+
+	_FloatCOLA_ConstIterator& operator--()
+	{
+		--m_Itr;
+		return *this;
+	}
+
+	_FloatCOLA_ConstIterator operator--(int)
+	{
+		_FloatCOLA_ConstIterator itr = *this;
+		--(*this);
+		return itr;
+	}
+
+	// Keys are decoded on access, so they are returned by value.
+	ReferenceType operator*() const
+	{
+		return decodeFloatKey<F, KeyType>(*m_Itr);
+	}
+
+	bool operator==(const _FloatCOLA_ConstIterator& other) const
+	{
+		return m_Itr == other.m_Itr;
+	}
+
+	bool operator!=(const _FloatCOLA_ConstIterator& other) const
+	{
+		return !(*this == other);
+	}
+
+protected:
+	Iterator m_Itr;
+};
+
+// Cola of float or double keys, stored as order preserving integer keys in
+// a cola of int32_t or int64_t keys of the same size. The integer kernels
+// of the cola, such as the vectorized LEADBIT search and the bitonic merges
+// of AVXBasicCOLA, are thereby used for floating point keys unchanged.
+// E.g. FloatCOLA<AVXBasicCOLA, float> or FloatCOLA<BasicCOLA, double>.
+template<typename C, typename F>
+class FloatCOLA
+{
+public:
+	using ColaType = C;
+	using ValueType = F;
+	using ConstIterator = _FloatCOLA_ConstIterator<C, F>;
+
+private:
+	using KeyType = typename std::decay<typename C::ConstIterator::ReferenceType>::type;
+	static_assert(std::is_floating_point<F>::value, "Keys must be float or double");
+	static_assert(sizeof(KeyType) == sizeof(F), "Keys must be of the same size as the keys of the cola");
+
+public:
+	FloatCOLA() :
+		m_Cola() { }
+
+	FloatCOLA(const C& cola) :
+		m_Cola(cola) { }
+
+public:
+	inline void add(F value) { m_Cola.add(encode(value)); }
+
+	inline bool contains(F value) const { return m_Cola.contains(encode(value)); }
+
+	// Set results[j] to contains(values[j]) for each of the count values,
+	// for colas with a batched search.
+	void containsBatch(const F* values, size_t count, bool* results) const
+	{
+		std::vector<KeyType> keys(count);
+		for (size_t j = 0; j < count; j++)
+			keys[j] = encode(values[j]);
+		m_Cola.containsBatch(keys.data(), count, results);
+	}
+
+	// Largest key less than or equal to value.
+	inline bool predecessor(F value, F& result) const { KeyType key; return m_Cola.predecessor(encode(value), key) && decode(key, result); }
+
+	// Smallest key greater than or equal to value.
+	inline bool successor(F value, F& result) const { KeyType key; return m_Cola.successor(encode(value), key) && decode(key, result); }
+
+	// Largest key strictly less than value. Adjacent integer keys are
+	// adjacent floating point keys, so the integer neighbors are used.
+	inline bool strictPredecessor(F value, F& result) const { KeyType key; return m_Cola.strictPredecessor(encode(value), key) && decode(key, result); }
+
+	// Smallest key strictly greater than value.
+	inline bool strictSuccessor(F value, F& result) const { KeyType key; return m_Cola.strictSuccessor(encode(value), key) && decode(key, result); }
+
+	// Key closest to value, the smaller one on ties. The distances of the
+	// integer keys do not follow the distances of the floating point keys,
+	// so both neighbors are compared.
+	bool nearest(F value, F& result) const
+	{
+		F lo, hi;
+		const bool hasLo = predecessor(value, lo);
+		const bool hasHi = successor(value, hi);
+		if (!hasLo || !hasHi)
+		{
+			result = hasLo ? lo : hi;
+			return hasLo || hasHi;
+		}
+
+		result = (value - lo <= hi - value) ? lo : hi;
+		return true;
+	}
+
+	// Number of keys less than value.
+	inline size_t rank(F value) const { return m_Cola.rank(encode(value)); }
+
+	// Key of rank k, i.e. the k-th smallest key starting from zero.
+	inline bool select(size_t k, F& result) const { KeyType key; return m_Cola.select(k, key) && decode(key, result); }
+
+	// Number of keys in the range [lo, hi].
+	inline size_t countRange(F lo, F hi) const { return m_Cola.countRange(encode(lo), encode(hi)); }
+
+	// Key at quantile q in [0, 1].
+	inline bool quantile(double q, F& result) const { KeyType key; return m_Cola.quantile(q, key) && decode(key, result); }
+
+	inline size_t size() const { return m_Cola.size(); }
+
+	inline size_t capacity() const { return m_Cola.capacity(); }
+
+	// The cola of the integer keys.
+	inline const C& cola() const { return m_Cola; }
+
+	ConstIterator begin() const { return ConstIterator(m_Cola.begin()); }
+
+	ConstIterator end() const { return ConstIterator(m_Cola.end()); }
+
+private:
+	static inline KeyType encode(F value) { return encodeFloatKey<KeyType>(value); }
+
+	// Decode the integer result of a query that found one.
+	static inline bool decode(KeyType key, F& result)
+	{
+		result = decodeFloatKey<F>(key);
+		return true;
+	}
+
+private:
+	C m_Cola;
+};
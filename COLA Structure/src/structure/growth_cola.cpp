@@ -0,0 +1,177 @@
+#include "growth_cola.h"
+
+#include <memory>
+#include <algorithm>
+
+GrowthCOLA::GrowthCOLA(uint32_t growthFactor, size_t initialCapacity) :
+	m_GrowthFactor(std::max(static_cast<uint32_t>(2), growthFactor)),
+	m_Data(),
+	m_Size(0),
+	m_LevelCount(0)
+{
+	// Capacity must be g^L - 1 for some number of levels L (greater than zero)
+	do
+	{
+		addLevel();
+	} while (capacity() < initialCapacity);
+
+	m_Data.reserve(initialCapacity);
+}
+
+GrowthCOLA::~GrowthCOLA() { }
+
+void GrowthCOLA::add(int64_t value)
+{
+	const uint32_t maxArrayCount = m_GrowthFactor - 1;
+
+	// Find first level that is not full (merge-level). All levels
+	// below it are full and merged into a new array on that level.
+	uint8_t m = 0;
+	while (m < m_LevelCount && m_Levels[m].m_ArrayCount == maxArrayCount)
+		m++;
+
+	if (m == m_LevelCount)
+	{
+		// Allocate a new level
+		addLevel();
+	}
+
+	Level& mergeLevel = m_Levels[m];
+	const size_t start = mergeLevel.m_ArraySize - 1 + mergeLevel.m_ArrayCount * mergeLevel.m_ArraySize;
+
+	// Arrays are allocated one at a time when they are first filled, such
+	// that a new level does not take memory for all of its g - 1 arrays.
+	if (m_Data.size() < start + mergeLevel.m_ArraySize)
+	{
+		m_Data.reserve(start + mergeLevel.m_ArraySize);
+		m_Data.resize(start + mergeLevel.m_ArraySize);
+	}
+
+	int64_t* dst = &m_Data[start];
+
+	if (m == 0)
+	{
+		*dst = value;
+	}
+	else
+	{
+		// The new value and the arrays of lower levels sum up to exactly g^m
+		// elements. They are merged at once using a min-heap of runs, such that
+		// each element is only moved once instead of once per level.
+		m_Runs.clear();
+		m_Runs.push_back({ &value, &value + 1 });
+		for (uint8_t l = 0; l < m; l++)
+		{
+			const size_t arraySize = m_Levels[l].m_ArraySize;
+			const int64_t* array = &m_Data[arraySize - 1];
+			for (uint32_t a = 0; a < maxArrayCount; a++, array += arraySize)
+				m_Runs.push_back({ array, array + arraySize });
+		}
+
+		const auto greater = [](const Run& a, const Run& b) {
+			return *a.m_Begin > *b.m_Begin;
+		};
+		std::make_heap(m_Runs.begin(), m_Runs.end(), greater);
+
+		Run* heap = m_Runs.data();
+		size_t heapSize = m_Runs.size();
+
+		while (heapSize > 1)
+		{
+			*dst++ = *heap[0].m_Begin++;
+
+			// Remove the run if it is exhausted
+			if (heap[0].m_Begin == heap[0].m_End)
+				heap[0] = heap[--heapSize];
+
+			// Sift the top run down to restore the heap
+			size_t i = 0;
+			const Run run = heap[0];
+			while (true)
+			{
+				size_t c = (i << 1) + 1;
+				if (c >= heapSize)
+					break;
+				if (c + 1 < heapSize && *heap[c + 1].m_Begin < *heap[c].m_Begin)
+					c++;
+				if (*run.m_Begin <= *heap[c].m_Begin)
+					break;
+				heap[i] = heap[c];
+				i = c;
+			}
+			heap[i] = run;
+		}
+
+		// Copy remaining elements of the last run
+		dst = std::copy(heap[0].m_Begin, heap[0].m_End, dst);
+
+		// Lower levels are now empty
+		for (uint8_t l = 0; l < m; l++)
+			m_Levels[l].m_ArrayCount = 0;
+	}
+
+	mergeLevel.m_ArrayCount++;
+	m_Size++;
+}
+
+bool GrowthCOLA::contains(int64_t value) const
+{
+	const int64_t* data = m_Data.data();
+
+	for (uint8_t l = 0; l < m_LevelCount; l++)
+	{
+		const Level& level = m_Levels[l];
+		size_t start = level.m_ArraySize - 1;
+
+		for (uint32_t a = 0; a < level.m_ArrayCount; a++, start += level.m_ArraySize)
+		{
+			const size_t end = start + level.m_ArraySize;
+
+			// Skip arrays that can not contain the value
+			if (value < data[start] || value > data[end - 1])
+				continue;
+
+			if (binarySearch(value, data, start, end))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+_Neighbors<int64_t> GrowthCOLA::neighbors(int64_t value) const
+{
+	const int64_t* data = m_Data.data();
+	_Neighbors<int64_t> neighbors;
+
+	for (uint8_t l = 0; l < m_LevelCount; l++)
+	{
+		const Level& level = m_Levels[l];
+		size_t start = level.m_ArraySize - 1;
+
+		for (uint32_t a = 0; a < level.m_ArrayCount; a++, start += level.m_ArraySize)
+		{
+			const size_t end = start + level.m_ArraySize;
+
+			// Arrays are not of power of two size, so search for
+			// the first element greater than value instead.
+			const size_t i = upperBound(value, data, start, end);
+			neighbors.addSearchResult(value, data, (i == start) ? start : i - 1, end);
+
+			if (neighbors.isExact(value))
+				return neighbors;
+		}
+	}
+
+	return neighbors;
+}
+
+void GrowthCOLA::addLevel()
+{
+	// Levels are stored consecutively, so level L starts at
+	// index g^L - 1 and the capacity becomes g^(L + 1) - 1.
+	// The arrays of the level are allocated by add.
+	const size_t arraySize = (m_LevelCount == 0) ? 1 : m_Levels[m_LevelCount - 1].m_ArraySize * m_GrowthFactor;
+	m_Levels[m_LevelCount] = { arraySize, 0 };
+	m_LevelCount++;
+}
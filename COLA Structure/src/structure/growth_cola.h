@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "./math_util.h"
+#include "./neighbor_util.h"
+
+struct _GrowthCOLA_Level
+{
+	// Size of each array on the level, which is g^l. The level
+	// starts at index g^l - 1, right after all lower levels.
+	size_t m_ArraySize;
+	// Number of full arrays on the level (at most g - 1).
+	uint32_t m_ArrayCount;
+};
+
+class _GrowthCOLA_ConstIterator
+{
+private:
+	using Level = _GrowthCOLA_Level;
+public:
+	using PointerType = const int64_t*;
+	using ReferenceType = const int64_t&;
+
+public:
+	_GrowthCOLA_ConstIterator(const int64_t* data, const Level* levels, uint8_t levelCount, uint8_t level, size_t index) :
+		m_Data(data),
+		m_Levels(levels),
+		m_LevelCount(levelCount),
+		m_Level(level),
+		m_Index(index) { }
+
+	_GrowthCOLA_ConstIterator& operator++()
+	{
+		m_Index++;
+
+		// Check if we are at the end of the full arrays of a level
+		const Level& level = m_Levels[m_Level];
+		if (m_Index == level.m_ArraySize - 1 + level.m_ArrayCount * level.m_ArraySize)
+		{
+			// Go to the first element of the next non-empty level
+			// or all ones if there are no levels left.
+			m_Index = ~static_cast<size_t>(0);
+			for (m_Level++; m_Level < m_LevelCount; m_Level++)
+			{
+				if (m_Levels[m_Level].m_ArrayCount != 0)
+				{
+					m_Index = m_Levels[m_Level].m_ArraySize - 1;
+					break;
+				}
+			}
+		}
+
+		return *this;
+	}
+
+	_GrowthCOLA_ConstIterator operator++(int)
+	{
+		_GrowthCOLA_ConstIterator itr = *this;
+		++(*this);
+		return itr;
+	}
+
+	_GrowthCOLA_ConstIterator& operator--()
+	{
+		// Check if we are at the beginning of a level
+		if (m_Level == m_LevelCount || m_Index == m_Levels[m_Level].m_ArraySize - 1)
+		{
+			// Get index after the last element in the previous non-empty level
+			while (m_Level--)
+			{
+				const Level& level = m_Levels[m_Level];
+				if (level.m_ArrayCount != 0)
+				{
+					m_Index = level.m_ArraySize - 1 + level.m_ArrayCount * level.m_ArraySize;
+					break;
+				}
+			}
+		}
+
+		m_Index--;
+
+		return *this;
+	}
+
+	_GrowthCOLA_ConstIterator operator--(int)
+	{
+		_GrowthCOLA_ConstIterator itr = *this;
+		--(*this);
+		return itr;
+	}
+
+	PointerType operator->() const
+	{
+		return &m_Data[m_Index];
+	}
+
+	ReferenceType operator*() const
+	{
+		return m_Data[m_Index];
+	}
+
+	bool operator==(const _GrowthCOLA_ConstIterator& other) const
+	{
+		return (m_Data == other.m_Data && m_Index == other.m_Index);
+	}
+
+	bool operator!=(const _GrowthCOLA_ConstIterator& other) const
+	{
+		return !(*this == other);
+	}
+
+protected:
+	const int64_t* m_Data;
+	const Level* m_Levels;
+	const uint8_t m_LevelCount;
+	uint8_t m_Level;
+	size_t m_Index;
+};
+
+// Cache-oblivious lookahead array with growth factor g (g-COLA without
+// lookahead pointers). Level l holds up to g - 1 sorted arrays of size g^l,
+// so a larger g gives fewer levels and cheaper inserts, at the cost of
+// searching more arrays per level. A growth factor of 2 gives the same
+// layout as BasicCOLA.
+class GrowthCOLA
+{
+private:
+	using Level = _GrowthCOLA_Level;
+public:
+	using ConstIterator = _GrowthCOLA_ConstIterator;
+
+public:
+	GrowthCOLA() :
+		GrowthCOLA::GrowthCOLA(2) { }
+
+	GrowthCOLA(uint32_t growthFactor, size_t initialCapacity = 15);
+
+	GrowthCOLA(const GrowthCOLA& other) = default;
+
+	~GrowthCOLA();
+
+public:
+	void add(int64_t value);
+
+	bool contains(int64_t value) const;
+
+	// Largest element less than or equal to value.
+	inline bool predecessor(int64_t value, int64_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int64_t value, int64_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int64_t value, int64_t& result) const { return ::strictPredecessor(*this, value, result); }
+
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int64_t value, int64_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int64_t value, int64_t& result) const { return neighbors(value).nearest(value, result); }
+
+	inline size_t size() const { return m_Size; }
+
+	// Number of elements the levels hold before a new level is added.
+	inline size_t capacity() const { return m_Levels[m_LevelCount - 1].m_ArraySize * m_GrowthFactor - 1; }
+
+	inline uint32_t growthFactor() const { return m_GrowthFactor; }
+
+	inline uint8_t levelCount() const { return m_LevelCount; }
+
+	ConstIterator begin() const
+	{
+		// Find the first non-empty level
+		uint8_t l = 0;
+		while (l < m_LevelCount && m_Levels[l].m_ArrayCount == 0)
+			l++;
+		const size_t index = (l < m_LevelCount) ? m_Levels[l].m_ArraySize - 1 : ~static_cast<size_t>(0);
+		return ConstIterator(m_Data.data(), m_Levels, m_LevelCount, l, index);
+	}
+
+	ConstIterator end() const
+	{
+		return ConstIterator(m_Data.data(), m_Levels, m_LevelCount, m_LevelCount, ~static_cast<size_t>(0));
+	}
+
+private:
+	_Neighbors<int64_t> neighbors(int64_t value) const;
+
+	void addLevel();
+
+private:
+	struct Run
+	{
+		const int64_t* m_Begin;
+		const int64_t* m_End;
+	};
+
+	uint32_t m_GrowthFactor;
+
+	std::vector<int64_t> m_Data;
+	size_t m_Size;
+
+	uint8_t m_LevelCount;
+	Level m_Levels[sizeof(size_t) * 8];
+
+	// Runs of the current merge, kept to avoid allocating on each insert.
+	std::vector<Run> m_Runs;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+#include "./math_util.h"
+
+#ifndef INTERPOLATION_MIN_SIZE
+// Smallest layer that is searched with interpolation search. Smaller layers
+// only take a few more probes with binary search.
+#define INTERPOLATION_MIN_SIZE (static_cast<size_t>(1) << 10)
+#endif // !INTERPOLATION_MIN_SIZE
+
+#ifndef INTERPOLATION_STEPS
+// Number of interpolation steps before the remaining range is searched with
+// binary search, which bounds the probes on skewed keys to
+// 2 * INTERPOLATION_STEPS + log2(size). About log2(log2(size)) steps of two
+// probes are needed for uniformly distributed keys.
+#define INTERPOLATION_STEPS 4
+#endif // !INTERPOLATION_STEPS
+
+#ifndef INTERPOLATION_MIN_RANGE
+// Ranges of at most this many elements are searched with binary search,
+// since they span only a cache line or two.
+#define INTERPOLATION_MIN_RANGE 16
+#endif // !INTERPOLATION_MIN_RANGE
+
+// How the layers of a cola are searched.
+enum class SearchPolicy
+{
+	// Binary or LEADBIT search, which suits any distribution of keys.
+	Default,
+	// Interpolation search on layers of at least INTERPOLATION_MIN_SIZE
+	// elements, for keys that are close to uniformly distributed, such as
+	// hashed identifiers.
+	Interpolation
+};
+
+template <typename T>
+static size_t interpolationSearch(T value, const T* data, size_t start, size_t end, T first, T last)
+{
+	// Find the last element in range that is less than or equal to value
+	// (or start if there is none), like leadbitSearch. The first and last
+	// elements of the range are given, such that the fences of a layer
+	// guide the first probe without loading the ends of the layer.
+	if (value < first)
+		return start;
+	if (value >= last)
+		return end - 1;
+
+	// The range (lo, hi) is searched, where data[lo] <= value < data[hi],
+	// so the interpolated keys are never equal.
+	size_t lo = start, hi = end - 1;
+	T loValue = first, hiValue = last;
+
+	for (uint8_t step = 0; step < INTERPOLATION_STEPS && hi - lo > INTERPOLATION_MIN_RANGE; step++)
+	{
+		// Probe the position of value if the keys were evenly spaced
+		const double fraction = keyDistance(loValue, value) / keyDistance(loValue, hiValue);
+		const size_t offset = static_cast<size_t>(fraction * static_cast<double>(hi - lo));
+		const size_t m = std::min(hi - 1, lo + std::max(offset, static_cast<size_t>(1)));
+
+		// The probe of uniform keys is off by about the square root of the
+		// range, so a second probe that far towards value brackets it, and
+		// the range shrinks to its square root with each step. Only
+		// narrowing the range from the side of the probe would leave the
+		// other side far away.
+		const size_t guard = static_cast<size_t>(std::sqrt(static_cast<double>(hi - lo))) + 1;
+		if (data[m] <= value)
+		{
+			lo = m;
+			loValue = data[m];
+			if (hi - m > guard)
+			{
+				if (data[m + guard] <= value)
+				{
+					lo = m + guard;
+					loValue = data[lo];
+				}
+				else
+				{
+					hi = m + guard;
+					hiValue = data[hi];
+				}
+			}
+		}
+		else
+		{
+			hi = m;
+			hiValue = data[m];
+			if (m - lo > guard)
+			{
+				if (data[m - guard] > value)
+				{
+					hi = m - guard;
+					hiValue = data[hi];
+				}
+				else
+				{
+					lo = m - guard;
+					loValue = data[lo];
+				}
+			}
+		}
+	}
+
+	return upperBound(value, data, lo + 1, hi) - 1;
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "./math_util.h"
+
+#ifndef LAYER_MODEL_MIN_SIZE
+// Smallest layer that is fitted with a model. Smaller layers are searched
+// with LEADBIT search, which only touches a few cache lines for them. Zero
+// disables the models.
+#define LAYER_MODEL_MIN_SIZE (static_cast<size_t>(1) << 16)
+#endif // !LAYER_MODEL_MIN_SIZE
+
+#ifndef LAYER_MODEL_ERROR
+// Largest distance between the predicted and the actual position of a key.
+#define LAYER_MODEL_ERROR 16
+#endif // !LAYER_MODEL_ERROR
+
+#ifndef LAYER_MODEL_STRIDE
+// Distance between the keys that the model is fitted to, which must be less
+// than the error. The sampled keys are fitted within the remaining error.
+#define LAYER_MODEL_STRIDE 8
+#endif // !LAYER_MODEL_STRIDE
+
+#ifndef LAYER_MODEL_KEYS_PER_SEGMENT
+// Layers that need more than one segment per this many keys to stay within
+// the error are not modelled, and fall back to LEADBIT search.
+#define LAYER_MODEL_KEYS_PER_SEGMENT 64
+#endif // !LAYER_MODEL_KEYS_PER_SEGMENT
+
+#ifndef LAYER_MODEL_RADIX_BITS
+// Largest number of key bits used to find the segment of a key.
+#define LAYER_MODEL_RADIX_BITS 18
+#endif // !LAYER_MODEL_RADIX_BITS
+
+// Size and accuracy of the models of a cola, for all layers together.
+struct _LayerModel_Stats
+{
+	// Layers searched with a model, and layers that are large enough
+	// to be modelled but fell back to LEADBIT search.
+	size_t m_ModelLayers;
+	size_t m_FallbackLayers;
+
+	size_t m_Segments;
+	size_t m_Bytes;
+
+	// Largest distance between a predicted and an actual position, which
+	// is at most LAYER_MODEL_ERROR except near long runs of duplicates.
+	size_t m_MaxError;
+
+	_LayerModel_Stats() :
+		m_ModelLayers(0),
+		m_FallbackLayers(0),
+		m_Segments(0),
+		m_Bytes(0),
+		m_MaxError(0) { }
+};
+
+// Piecewise linear model of the position of the keys in a sorted layer, like
+// a radix spline. The segments are fitted in one pass over a sample of the
+// keys with a shrinking cone, such that each predicts the position of its
+// keys within LAYER_MODEL_ERROR. The segment of a key is found through a radix
+// table over the upper bits of the key, so a search touches the table, one
+// or two segments, and a window of 2 * LAYER_MODEL_ERROR + 3 elements.
+template<typename T>
+class _LayerModel
+{
+private:
+	struct Segment
+	{
+		size_t m_Position;
+		double m_Slope;
+	};
+
+public:
+	_LayerModel() :
+		m_Keys(),
+		m_Segments(),
+		m_Radix(),
+		m_Shift(0) { }
+
+	inline bool isEmpty() const { return m_Keys.empty(); }
+
+	inline size_t segmentCount() const { return m_Keys.size(); }
+
+	inline size_t bytes() const
+	{
+		return m_Keys.capacity() * sizeof(T) + m_Segments.capacity() * sizeof(Segment) + m_Radix.capacity() * sizeof(size_t);
+	}
+
+	void clear()
+	{
+		// Release the memory, since layers are rarely refitted to the same size
+		std::vector<T>().swap(m_Keys);
+		std::vector<Segment>().swap(m_Segments);
+		std::vector<size_t>().swap(m_Radix);
+	}
+
+	// Fit the model to the sorted layer data[start, end). Returns false and
+	// leaves the model empty if the layer is too small, or if it needs too
+	// many segments to be predicted within the error.
+	bool fit(const T* data, size_t start, size_t end)
+	{
+		// Layers of a cola that are too small are never modelled, so
+		// their models are already empty.
+		if (LAYER_MODEL_MIN_SIZE == 0 || end - start < LAYER_MODEL_MIN_SIZE)
+			return false;
+
+		clear();
+
+		const size_t maxSegments = (end - start) / LAYER_MODEL_KEYS_PER_SEGMENT;
+		const double error = LAYER_MODEL_ERROR - LAYER_MODEL_STRIDE;
+
+		// Slopes through the first key of the segment that keep all sampled
+		// keys of the segment within the error, which shrink with each key.
+		double lo = 0.0, hi = 0.0;
+		bool single = true;
+		T key = data[start];
+		T last = key;
+		m_Keys.push_back(key);
+		m_Segments.push_back({ start, 0.0 });
+
+		// The last key is always sampled, such that all keys lie between
+		// two samples, and are predicted within the stride of them.
+		for (size_t i = start; i != end - 1;)
+		{
+			i = std::min(i + LAYER_MODEL_STRIDE, end - 1);
+
+			// Only the first sample of duplicates is predicted
+			if (data[i] == last)
+				continue;
+			last = data[i];
+
+			const double dx = keyDistance(key, data[i]);
+			const double dy = static_cast<double>(i - m_Segments.back().m_Position);
+
+			if (single)
+			{
+				// Any slope through the first two keys within the error
+				lo = std::max(0.0, (dy - error) / dx);
+				hi = (dy + error) / dx;
+				single = false;
+				continue;
+			}
+
+			// Compare the slope of the key with the cone without dividing,
+			// and only divide when the cone shrinks.
+			const double loY = lo * dx, hiY = hi * dx;
+			if (dy >= loY && dy <= hiY)
+			{
+				if (dy - error > loY)
+					lo = (dy - error) / dx;
+				if (dy + error < hiY)
+					hi = (dy + error) / dx;
+				continue;
+			}
+
+			// The key is outside the cone, so it starts the next segment
+			m_Segments.back().m_Slope = (lo + hi) * 0.5;
+			if (m_Keys.size() == maxSegments)
+			{
+				clear();
+				return false;
+			}
+
+			key = data[i];
+			m_Keys.push_back(key);
+			m_Segments.push_back({ i, 0.0 });
+			lo = 0.0;
+			hi = 0.0;
+			single = true;
+		}
+
+		m_Segments.back().m_Slope = (lo + hi) * 0.5;
+		buildRadix();
+		return true;
+	}
+
+	// Find the last element in the modelled layer data[start, end) that is
+	// less than or equal to value (or start if there is none), like
+	// leadbitSearch. The window around the predicted position is verified,
+	// and the whole layer is searched with LEADBIT search if it does not
+	// contain the result, which only happens near long runs of duplicates.
+	size_t search(T value, const T* data, size_t start, size_t end) const
+	{
+		if (value < m_Keys.front())
+			return start;
+
+		const size_t s = findSegment(value);
+		const Segment& segment = m_Segments[s];
+		const size_t next = (s + 1 < m_Segments.size()) ? m_Segments[s + 1].m_Position : end;
+		const size_t p = predict(s, value, next);
+
+		const size_t lo = std::max(segment.m_Position, (p > LAYER_MODEL_ERROR + 1) ? p - (LAYER_MODEL_ERROR + 1) : 0);
+		const size_t hi = std::min(next, p + LAYER_MODEL_ERROR + 2);
+
+		if (data[lo] <= value && (hi == end || data[hi] > value))
+			return ::upperBound(value, data, lo + 1, hi) - 1;
+
+		// Layers are of power of two size
+		return leadbitSearch(value, data, start, end - start);
+	}
+
+	// Largest distance between the predicted position of a key and the
+	// positions of its occurrences in the layer the model was fitted to.
+	size_t maxError(const T* data, size_t start, size_t end) const
+	{
+		size_t maxError = 0;
+		for (size_t i = start, j = start; i < end; i = j)
+		{
+			// Duplicates of the key are in [i, j)
+			while (j < end && data[j] == data[i])
+				j++;
+
+			const size_t s = findSegment(data[i]);
+			const size_t next = (s + 1 < m_Segments.size()) ? m_Segments[s + 1].m_Position : end;
+			const size_t p = predict(s, data[i], next);
+
+			if (p < i)
+				maxError = std::max(maxError, i - p);
+			else if (p > j - 1)
+				maxError = std::max(maxError, p - (j - 1));
+		}
+		return maxError;
+	}
+
+private:
+	inline size_t predict(size_t s, T value, size_t next) const
+	{
+		// Keys of segment s are at positions up to next, the first
+		// position of the next segment
+		const Segment& segment = m_Segments[s];
+		const double offset = segment.m_Slope * keyDistance(m_Keys[s], value);
+		return segment.m_Position + static_cast<size_t>(std::min(std::max(offset, 0.0), static_cast<double>(next - segment.m_Position)));
+	}
+
+	inline uint64_t radixOf(T value) const
+	{
+		// Offset from the smallest key, which is not negative
+		return (static_cast<uint64_t>(value) - static_cast<uint64_t>(m_Keys.front())) >> m_Shift;
+	}
+
+	void buildRadix()
+	{
+		// Use about as many radix entries as segments, such that the table
+		// is no larger than the segments
+		uint8_t bits = 1;
+		while (bits < LAYER_MODEL_RADIX_BITS && (static_cast<size_t>(1) << bits) < m_Keys.size())
+			bits++;
+
+		const uint64_t range = static_cast<uint64_t>(m_Keys.back()) - static_cast<uint64_t>(m_Keys.front());
+		m_Shift = 0;
+		while (m_Shift < 64 && (range >> m_Shift) >= (static_cast<uint64_t>(1) << bits))
+			m_Shift++;
+
+		// Entry r is the first segment whose key has a radix of at least r,
+		// followed by an entry past the last segment.
+		const size_t entries = static_cast<size_t>((range >> m_Shift) + 2);
+		m_Radix.assign(entries, m_Keys.size());
+		for (size_t s = m_Keys.size(); s-- > 0;)
+			m_Radix[radixOf(m_Keys[s])] = s;
+		for (size_t r = entries - 1; r-- > 0;)
+			m_Radix[r] = std::min(m_Radix[r], m_Radix[r + 1]);
+	}
+
+	inline size_t findSegment(T value) const
+	{
+		// Last segment whose first key is not greater than value. All keys
+		// with a smaller radix are less than value, and all keys with a
+		// greater radix are greater.
+		if (value >= m_Keys.back())
+			return m_Keys.size() - 1;
+
+		const uint64_t r = radixOf(value);
+		const T* keys = m_Keys.data();
+		return static_cast<size_t>(std::upper_bound(keys + m_Radix[r], keys + m_Radix[r + 1], value) - keys) - 1;
+	}
+
+private:
+	// First key of each segment, separate from the segments to keep
+	// the search over them dense.
+	std::vector<T> m_Keys;
+	std::vector<Segment> m_Segments;
+	std::vector<size_t> m_Radix;
+	uint8_t m_Shift;
+};
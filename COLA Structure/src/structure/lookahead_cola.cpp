@@ -2,37 +2,209 @@
 
 #include <memory>
 #include <algorithm>
+#include <immintrin.h>
+
+#ifndef LOOKAHEAD_SIMD_SCAN
+#define LOOKAHEAD_SIMD_SCAN 1
+#endif // !LOOKAHEAD_SIMD_SCAN
+
+#ifndef LOOKAHEAD_PREFETCH
+// Prefetch the next layer while the current window is compared. Without it,
+// the SIMD scan is slower than the sequential scan, since the next pointer
+// depends on the entire window instead of being speculated by the processor.
+#define LOOKAHEAD_PREFETCH 1
+#endif // !LOOKAHEAD_PREFETCH
+
+#if LOOKAHEAD_SIMD_SCAN
+/* Helpers for the window scans */
+static const __m256i _lane_idx = _mm256_set_epi64x(3, 2, 1, 0);
+// Lane order of values gathered from two pairs of interleaved entries.
+static const __m256i _interleaved_lane_idx = _mm256_set_epi64x(3, 1, 2, 0);
+
+inline static uint32_t lessEqualMask(const __m256i& _window, const __m256i& _index,
+	const __m256i& _value, const __m256i& _count)
+{
+	// Lanes within the layer (index < count) that are not greater than value
+	const __m256i _greater = _mm256_cmpgt_epi64(_window, _value);
+	const __m256i _inLayer = _mm256_cmpgt_epi64(_count, _index);
+	return static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_andnot_si256(_greater, _inLayer))));
+}
+#endif
+
+template<size_t INTERVAL>
+size_t _LookaheadCOLA_InterleavedData::scan(size_t pointer, int64_t value) const
+{
+#if LOOKAHEAD_SIMD_SCAN
+	// Number of elements following pointer in the same layer (at most INTERVAL - 1)
+	const size_t count = std::min(INTERVAL - 1, nextPO2MinusOne(pointer + 1) - pointer - 1);
+
+#if LOOKAHEAD_PREFETCH
+	// The chosen element is one of the elements in the window, so its
+	// lookahead pointer lies between the pointers of the first and last.
+	_mm_prefetch((const char*)&m_Entries[m_Entries[pointer].m_Pointer & realPointerMask<IndexType>()], _MM_HINT_T0);
+	_mm_prefetch((const char*)&m_Entries[m_Entries[pointer + count].m_Pointer & realPointerMask<IndexType>()], _MM_HINT_T0);
+#endif
+
+	// Compare the entire window at once. Elements are sorted within a layer,
+	// so the elements that are not greater than value form a prefix.
+	const __m256i _value = _mm256_set1_epi64x(value);
+	const __m256i _count = _mm256_set1_epi64x(static_cast<int64_t>(count));
+	uint32_t mask = 0;
+	for (size_t i = 0; i < INTERVAL - 1; i += 4)
+	{
+		// Gather the values of four entries (in lane order 0, 2, 1, 3)
+		const __m256i _a = _mm256_loadu_si256((const __m256i*)&m_Entries[pointer + 1 + i]);
+		const __m256i _b = _mm256_loadu_si256((const __m256i*)&m_Entries[pointer + 3 + i]);
+		const __m256i _window = _mm256_unpacklo_epi64(_a, _b);
+		const __m256i _index = _mm256_add_epi64(_interleaved_lane_idx, _mm256_set1_epi64x(static_cast<int64_t>(i)));
+		mask |= lessEqualMask(_window, _index, _value, _count) << i;
+	}
+
+	return pointer + popcount(mask);
+#else
+	for (size_t i = 1; i < INTERVAL; i++)
+	{
+		// Check if next element is the first element in the next layer, or if the
+		// next element can not be a predecessor. In either case, previous element
+		// was the predecessor in the current layer.
+		if (isPO2MinusOne(pointer + 1) || m_Entries[pointer + 1].m_Value > value)
+			break;
+
+		pointer++;
+	}
+
+	return pointer;
+#endif
+}
+
+template<typename P>
+template<size_t INTERVAL>
+size_t _LookaheadCOLA_SplitData<P>::scan(size_t pointer, int64_t value) const
+{
+#if LOOKAHEAD_SIMD_SCAN
+	// Number of elements following pointer in the same layer (at most INTERVAL - 1)
+	const size_t count = std::min(INTERVAL - 1, nextPO2MinusOne(pointer + 1) - pointer - 1);
+
+#if LOOKAHEAD_PREFETCH
+	_mm_prefetch((const char*)&m_Values[m_Pointers[pointer] & realPointerMask<P>()], _MM_HINT_T0);
+	_mm_prefetch((const char*)&m_Values[m_Pointers[pointer + count] & realPointerMask<P>()], _MM_HINT_T0);
+#endif
+
+	const __m256i _value = _mm256_set1_epi64x(value);
+	const __m256i _count = _mm256_set1_epi64x(static_cast<int64_t>(count));
+	uint32_t mask = 0;
+	for (size_t i = 0; i < INTERVAL - 1; i += 4)
+	{
+		const __m256i _window = _mm256_loadu_si256((const __m256i*)&m_Values[pointer + 1 + i]);
+		const __m256i _index = _mm256_add_epi64(_lane_idx, _mm256_set1_epi64x(static_cast<int64_t>(i)));
+		mask |= lessEqualMask(_window, _index, _value, _count) << i;
+	}
+
+	return pointer + popcount(mask);
+#else
+	for (size_t i = 1; i < INTERVAL; i++)
+	{
+		if (isPO2MinusOne(pointer + 1) || m_Values[pointer + 1] > value)
+			break;
+
+		pointer++;
+	}
+
+	return pointer;
+#endif
+}
 
-LookaheadCOLA::LookaheadCOLA(size_t initialCapacity) :
-	m_Data(nullptr),
+template<typename Data>
+static const Data& emptyData()
+{
+	// Data of minimum capacity left behind by moves. It is always
+	// shared, so it is copied before anything is written to it.
+	static const Data data = []() {
+		Data d;
+		d.allocate(15);
+		d.setPointer(0, 0 | fakeElementFlag<typename Data::IndexType>());
+		return d;
+	}();
+	return data;
+}
+
+template<size_t INTERVAL, typename Data>
+GenericLookaheadCOLA<INTERVAL, Data>::GenericLookaheadCOLA(size_t initialCapacity) :
+	m_Data(),
 	m_Capacity(0),
 	m_Size(0)
 {
 	// Capacity must be a power of two minus one (and greater than zero).
 	m_Capacity = std::max(static_cast<size_t>(15), nextPO2MinusOne(initialCapacity));
-	m_Data = new Entry[m_Capacity];
+	m_Data.allocate(m_Capacity);
 
 	// Store fake element with offset zero to ensure adding and
 	// searching works correctly when the cola is empty.
-	m_Data[0].m_Pointer = 0 | FAKE_ELEMENT_FLAG;
+	m_Data.setPointer(0, 0 | fakeElementFlag<IndexType>());
 }
 
-LookaheadCOLA::LookaheadCOLA(const LookaheadCOLA& other) :
-	m_Data(new Entry[other.m_Capacity]),
+template<size_t INTERVAL, typename Data>
+GenericLookaheadCOLA<INTERVAL, Data>::GenericLookaheadCOLA(const GenericLookaheadCOLA& other) :
+	m_Data(),
 	m_Capacity(other.m_Capacity),
 	m_Size(other.m_Size)
 {
 	// Copy instead of pointing to the same memory.
-	memcpy(m_Data, other.m_Data, other.m_Capacity * sizeof(Entry));
+	m_Data.allocate(m_Capacity);
+	m_Data.copy(other.m_Data, m_Capacity);
+}
+
+template<size_t INTERVAL, typename Data>
+GenericLookaheadCOLA<INTERVAL, Data>::GenericLookaheadCOLA(GenericLookaheadCOLA&& other) noexcept :
+	m_Data(std::move(other.m_Data)),
+	m_Capacity(other.m_Capacity),
+	m_Size(other.m_Size)
+{
+	// Leave the other cola empty, but still usable.
+	other.m_Data = emptyData<Data>();
+	other.m_Capacity = 15;
+	other.m_Size = 0;
+}
+
+template<size_t INTERVAL, typename Data>
+GenericLookaheadCOLA<INTERVAL, Data>::~GenericLookaheadCOLA() { }
+
+template<size_t INTERVAL, typename Data>
+GenericLookaheadCOLA<INTERVAL, Data>& GenericLookaheadCOLA<INTERVAL, Data>::operator=(GenericLookaheadCOLA&& other) noexcept
+{
+	if (this != &other)
+	{
+		m_Data = std::move(other.m_Data);
+		m_Capacity = other.m_Capacity;
+		m_Size = other.m_Size;
+
+		other.m_Data = emptyData<Data>();
+		other.m_Capacity = 15;
+		other.m_Size = 0;
+	}
+
+	return *this;
 }
 
-LookaheadCOLA::~LookaheadCOLA()
+template<size_t INTERVAL, typename Data>
+GenericLookaheadCOLA<INTERVAL, Data> GenericLookaheadCOLA<INTERVAL, Data>::clone() const
 {
-	delete[] m_Data;
+	GenericLookaheadCOLA cola(0);
+
+	// Share the data blocks instead of copying them.
+	cola.m_Data = m_Data;
+	cola.m_Capacity = m_Capacity;
+	cola.m_Size = m_Size;
+
+	return cola;
 }
 
-void LookaheadCOLA::add(int64_t value)
+template<size_t INTERVAL, typename Data>
+void GenericLookaheadCOLA<INTERVAL, Data>::add(int64_t value)
 {
+	const IndexType fakeFlag = fakeElementFlag<IndexType>();
+	const IndexType realMask = realPointerMask<IndexType>();
+
 	const size_t nSize = m_Size + 1;
 	// Note: at most half of the elements of a full cola are fake, so
 	//       2N + 1 is the upper bound on the actual amount of elements.
@@ -41,6 +213,12 @@ void LookaheadCOLA::add(int64_t value)
 		// Allocate a new layer
 		reallocData((m_Capacity << 1) + 1);
 	}
+	else if (m_Data.shared())
+	{
+		// The merge would overwrite layers of a clone, copy the data first.
+		// Layers are stored contiguously, so the entire block is copied.
+		reallocData(m_Capacity);
+	}
 
 	// Find first position of empty array (merge-layer)
 	const size_t m = leastZeroBits(nSize << 1);
@@ -49,16 +227,16 @@ void LookaheadCOLA::add(int64_t value)
 	// Store the start of the current merge. The starting position
 	// of lookahead pointers is stored as the pointer of the first
 	// element in the layer.
-	size_t s = isPO2(nSize) ? mEnd : (m + m_Data[m].m_Pointer);
+	size_t s = isPO2(nSize) ? mEnd : (m + m_Data.pointer(m));
 
 	// In case we do not have any fake elements to the left.
-	m_Data[s - 1].m_Pointer = 0;
+	m_Data.setPointer(s - 1, 0);
 	// Make space for and insert value into correct position.
 	size_t j = s;
-	for (; j < mEnd && m_Data[j].m_Value < value; j++)
-		m_Data[j - 1] = m_Data[j];
-	m_Data[j - 1].m_Value = value;
-	m_Data[j - 1].m_Pointer &= REAL_POINTER_MASK;
+	for (; j < mEnd && m_Data.value(j) < value; j++)
+		m_Data.move(j - 1, j);
+	m_Data.setValue(j - 1, value);
+	m_Data.setPointer(j - 1, m_Data.pointer(j - 1) & realMask);
 
 	// We have inserted one element.
 	s--;
@@ -76,26 +254,26 @@ void LookaheadCOLA::add(int64_t value)
 		s = k;
 
 		// Set i to the first element in layer
-		if ((m_Data[i].m_Pointer & FAKE_ELEMENT_FLAG) == 0)
-			i += m_Data[i].m_Pointer;
+		if ((m_Data.pointer(i) & fakeFlag) == 0)
+			i += m_Data.pointer(i);
 
 		// Keep track of closest fake lookahead pointer to the left.
-		size_t p = 0;
+		IndexType p = 0;
 
 		// Simple merge sort (ascending order)
 		while (i != iEnd && j != mEnd)
 		{
-			if (m_Data[i].m_Pointer & FAKE_ELEMENT_FLAG)
+			if (m_Data.pointer(i) & fakeFlag)
 				i++;
 			else
 			{
-				if (m_Data[i].m_Value <= m_Data[j].m_Value)
-					m_Data[k++] = { m_Data[i++].m_Value, p };
+				if (m_Data.value(i) <= m_Data.value(j))
+					m_Data.set(k++, m_Data.value(i++), p);
 				else
 				{
 					// Set real lookahead pointer for next merged element
-					p = m_Data[j].m_Pointer & REAL_POINTER_MASK;	
-					m_Data[k++] = m_Data[j++];
+					p = m_Data.pointer(j) & realMask;
+					m_Data.move(k++, j++);
 				}
 			}
 		}
@@ -103,28 +281,27 @@ void LookaheadCOLA::add(int64_t value)
 		// Copy remaining elements in current layer
 		while (i != iEnd)
 		{
-			if (m_Data[i].m_Pointer & FAKE_ELEMENT_FLAG)
+			if (m_Data.pointer(i) & fakeFlag)
 				i++;
 			else
-				m_Data[k++] = { m_Data[i++].m_Value, p };
+				m_Data.set(k++, m_Data.value(i++), p);
 		}
 	}
 
 	// Store relative pointer for the first element in layer.
-	if (s != m || (m_Data[m].m_Pointer & FAKE_ELEMENT_FLAG) == 0)
-		m_Data[m].m_Pointer = s - m;
+	if (s != m || (m_Data.pointer(m) & fakeFlag) == 0)
+		m_Data.setPointer(m, static_cast<IndexType>(s - m));
 
 	// Copy lookahead pointers to layers below
 	for (i = m; i != 0; )
 	{
 		// Compute number of fake elements in the previous layer.
-		const size_t c = ceilDiv((i << 1) + 1 - s, FAKE_ELEMENT_INTERVAL);
-	
+		const size_t c = ceilDiv((i << 1) + 1 - s, INTERVAL);
+
 		for (j = i - c; j < i; j++)
 		{
-			m_Data[j].m_Value   = m_Data[s].m_Value;
-			m_Data[j].m_Pointer = s | FAKE_ELEMENT_FLAG;
-			s += FAKE_ELEMENT_INTERVAL;
+			m_Data.set(j, m_Data.value(s), static_cast<IndexType>(s) | fakeFlag);
+			s += INTERVAL;
 		}
 
 		s = i - c;
@@ -132,86 +309,116 @@ void LookaheadCOLA::add(int64_t value)
 
 		// Store relative pointer to first fake lookahead pointer.
 		if (s != i)
-			m_Data[i].m_Pointer = s - i;
+			m_Data.setPointer(i, static_cast<IndexType>(s - i));
 	}
 
 	m_Size = nSize;
 }
 
-bool LookaheadCOLA::contains(int64_t value) const
+template<size_t INTERVAL, typename Data>
+bool GenericLookaheadCOLA<INTERVAL, Data>::contains(int64_t value) const
 {
 	// First element (fake or not) is always the smallest
 	// element in the cola.
-	if (m_Size > 0 && m_Data[0].m_Value >= value)
-		return (value == m_Data[0].m_Value);
+	if (m_Size > 0 && m_Data.value(0) >= value)
+		return (value == m_Data.value(0));
 
-	size_t pointer = m_Data[0].m_Pointer & REAL_POINTER_MASK;
+	size_t pointer = m_Data.pointer(0) & realPointerMask<IndexType>();
 
 	while (pointer)
 	{
 		// Search for the best predecessor in current layer
-		for (size_t i = 1; i < FAKE_ELEMENT_INTERVAL; i++)
-		{
-			// Check if next element is the first element in the next layer, or if the
-			// next element can not be a predecessor. In either case, previous element
-			// was the predecessor in the current layer.
-			if (isPO2MinusOne(pointer + 1) || m_Data[pointer + 1].m_Value > value)
-				break;
-
-			pointer++;
-		}
+		pointer = m_Data.template scan<INTERVAL>(pointer, value);
 
 		// Check if we found the value
-		if (m_Data[pointer].m_Value == value)
+		if (m_Data.value(pointer) == value)
 			return true;
 
 		// Follow predecessor pointer to next layer
-		pointer = m_Data[pointer].m_Pointer & REAL_POINTER_MASK;
+		pointer = m_Data.pointer(pointer) & realPointerMask<IndexType>();
 	}
 
 	return false;
 }
 
-bool LookaheadCOLA::predecessor(int64_t value, int64_t& result) const
+template<size_t INTERVAL, typename Data>
+_Neighbors<int64_t> GenericLookaheadCOLA<INTERVAL, Data>::neighbors(int64_t value) const
 {
-	if (m_Size > 0 && m_Data[0].m_Value <= value)
+	_Neighbors<int64_t> neighbors;
+
+	if (m_Size == 0)
+		return neighbors;
+
+	// First element (fake or not) is always the smallest
+	// element in the cola.
+	if (m_Data.value(0) >= value)
 	{
-		int64_t best = m_Data[0].m_Value;
-		size_t pointer = m_Data[0].m_Pointer & REAL_POINTER_MASK;
+		neighbors.addSuccessor(m_Data.value(0));
+		if (m_Data.value(0) == value)
+			neighbors.addPredecessor(value);
+		return neighbors;
+	}
+
+	neighbors.addPredecessor(m_Data.value(0));
+	size_t pointer = m_Data.pointer(0) & realPointerMask<IndexType>();
 
-		while (pointer && value != best)
+	while (pointer)
+	{
+		// Search for the best predecessor in current layer
+		pointer = m_Data.template scan<INTERVAL>(pointer, value);
+
+		const int64_t x = m_Data.value(pointer);
+		if (x > value)
+		{
+			neighbors.addSuccessor(x);
+		}
+		else
 		{
-			// Search for the best predecessor in current layer
-			for (size_t i = 1; i < FAKE_ELEMENT_INTERVAL; i++)
+			neighbors.addPredecessor(x);
+			if (x == value)
 			{
-				if (isPO2MinusOne(pointer + 1) || m_Data[pointer + 1].m_Value > value)
-					break;
-
-				pointer++;
+				neighbors.addSuccessor(x);
+				break;
 			}
-			// Check if result is better than current best
-			if (m_Data[pointer].m_Value > best)
-				best = m_Data[pointer].m_Value;
-			// Follow predecessor pointer to next layer
-			pointer = m_Data[pointer].m_Pointer & REAL_POINTER_MASK;
+
+			// The next element in the layer is greater than value. Even if it is
+			// a fake element, it is a copy of an element in a later layer.
+			if (!isPO2MinusOne(pointer + 1))
+				neighbors.addSuccessor(m_Data.value(pointer + 1));
 		}
 
-		result = best;
-		return true;
+		// Follow predecessor pointer to next layer
+		pointer = m_Data.pointer(pointer) & realPointerMask<IndexType>();
 	}
 
-	return false;
+	return neighbors;
 }
 
-void LookaheadCOLA::reallocData(size_t capacity)
+template<size_t INTERVAL, typename Data>
+void GenericLookaheadCOLA<INTERVAL, Data>::reallocData(size_t capacity)
 {
 	// Allocate and copy memory to new block
-	Entry* newBlock = new Entry[capacity];
+	Data newData;
+	newData.allocate(capacity);
 	const size_t c = (capacity > m_Capacity) ? m_Capacity : capacity;
-	memcpy(newBlock, m_Data, c * sizeof(Entry));
+	newData.copy(m_Data, c);
 
-	// Delete and set old block
-	delete[] m_Data;
-	m_Data = newBlock;
+	// Release old block (it is deleted unless shared with a clone)
+	m_Data = std::move(newData);
 	m_Capacity = capacity;
 }
+
+template class GenericLookaheadCOLA<4, _LookaheadCOLA_InterleavedData>;
+template class GenericLookaheadCOLA<8, _LookaheadCOLA_InterleavedData>;
+template class GenericLookaheadCOLA<16, _LookaheadCOLA_InterleavedData>;
+template class GenericLookaheadCOLA<32, _LookaheadCOLA_InterleavedData>;
+
+template class GenericLookaheadCOLA<4, _LookaheadCOLA_SplitData<uint32_t>>;
+template class GenericLookaheadCOLA<8, _LookaheadCOLA_SplitData<uint32_t>>;
+template class GenericLookaheadCOLA<16, _LookaheadCOLA_SplitData<uint32_t>>;
+template class GenericLookaheadCOLA<32, _LookaheadCOLA_SplitData<uint32_t>>;
+
+template class GenericLookaheadCOLA<4, _LookaheadCOLA_SplitData<uint64_t>>;
+template class GenericLookaheadCOLA<8, _LookaheadCOLA_SplitData<uint64_t>>;
+template class GenericLookaheadCOLA<16, _LookaheadCOLA_SplitData<uint64_t>>;
+template class GenericLookaheadCOLA<32, _LookaheadCOLA_SplitData<uint64_t>>;
@@ -1,27 +1,130 @@
 #pragma once
 
-#include<cstdint>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
 #include "./math_util.h"
+#include "./memory_util.h"
+#include "./neighbor_util.h"
 
+// Default distance between fake lookahead elements. Intervals of 4, 8, 16
+// and 32 are instantiated, see GenericLookaheadCOLA.
 #define FAKE_ELEMENT_INTERVAL static_cast<size_t>(4)
-#define REAL_POINTER_MASK (SIZE_MAX >> 1)
-#define FAKE_ELEMENT_FLAG (~(SIZE_MAX >> 1))
+
+template<typename P>
+inline static constexpr P realPointerMask()
+{
+	// Cast before shifting, as narrow types are promoted to int by ~
+	return static_cast<P>(static_cast<P>(~static_cast<P>(0)) >> 1);
+}
+
+template<typename P>
+inline static constexpr P fakeElementFlag()
+{
+	return static_cast<P>(~realPointerMask<P>());
+}
 
 struct _LookaheadCOLA_Entry {
 	int64_t m_Value;
 	size_t m_Pointer;
 };
 
+// Layout storing each value next to its lookahead pointer.
+struct _LookaheadCOLA_InterleavedData
+{
+	using Entry = _LookaheadCOLA_Entry;
+	using IndexType = size_t;
+
+	std::shared_ptr<Entry> m_Block;
+	Entry* m_Entries;
+
+	void allocate(size_t capacity)
+	{
+		// Scans may read a full window past the last element of a layer.
+		m_Block = allocateShared<Entry>(capacity + 32);
+		m_Entries = m_Block.get();
+	}
+
+	void copy(const _LookaheadCOLA_InterleavedData& other, size_t count)
+	{
+		memcpy(m_Entries, other.m_Entries, count * sizeof(Entry));
+	}
+
+	inline bool shared() const { return isShared(m_Block); }
+
+	inline const int64_t& value(size_t i) const { return m_Entries[i].m_Value; }
+	inline IndexType pointer(size_t i) const { return m_Entries[i].m_Pointer; }
+
+	inline void setValue(size_t i, int64_t value) { m_Entries[i].m_Value = value; }
+	inline void setPointer(size_t i, IndexType pointer) { m_Entries[i].m_Pointer = pointer; }
+	inline void set(size_t i, int64_t value, IndexType pointer) { m_Entries[i] = { value, pointer }; }
+	inline void move(size_t dst, size_t src) { m_Entries[dst] = m_Entries[src]; }
+
+	// Advance pointer past the following elements of its layer (at most
+	// INTERVAL - 1) that are not greater than value.
+	template<size_t INTERVAL>
+	size_t scan(size_t pointer, int64_t value) const;
+};
+
+// Layout storing values and lookahead pointers in separate arrays, such
+// that scans only touch values. Pointers of type P store the fake element
+// flag in their most significant bit, so with 32-bit pointers the capacity
+// is limited to 2^31 - 1 elements (about 2^30 values).
+template<typename P>
+struct _LookaheadCOLA_SplitData
+{
+	using IndexType = P;
+
+	std::shared_ptr<int64_t> m_ValueBlock;
+	std::shared_ptr<P> m_PointerBlock;
+	int64_t* m_Values;
+	P* m_Pointers;
+
+	void allocate(size_t capacity)
+	{
+		// Fails before the cola is changed, like a failed allocation.
+		if (capacity > static_cast<size_t>(realPointerMask<P>()))
+			throw std::length_error("Capacity exceeds the range of the lookahead pointers");
+
+		// Scans may read a full window past the last element of a layer.
+		m_ValueBlock = allocateShared<int64_t>(capacity + 32);
+		m_PointerBlock = allocateShared<P>(capacity);
+		m_Values = m_ValueBlock.get();
+		m_Pointers = m_PointerBlock.get();
+	}
+
+	void copy(const _LookaheadCOLA_SplitData& other, size_t count)
+	{
+		memcpy(m_Values, other.m_Values, count * sizeof(int64_t));
+		memcpy(m_Pointers, other.m_Pointers, count * sizeof(P));
+	}
+
+	inline bool shared() const { return isShared(m_ValueBlock); }
+
+	inline const int64_t& value(size_t i) const { return m_Values[i]; }
+	inline IndexType pointer(size_t i) const { return m_Pointers[i]; }
+
+	inline void setValue(size_t i, int64_t value) { m_Values[i] = value; }
+	inline void setPointer(size_t i, IndexType pointer) { m_Pointers[i] = pointer; }
+	inline void set(size_t i, int64_t value, IndexType pointer) { m_Values[i] = value; m_Pointers[i] = pointer; }
+	inline void move(size_t dst, size_t src) { m_Values[dst] = m_Values[src]; m_Pointers[dst] = m_Pointers[src]; }
+
+	template<size_t INTERVAL>
+	size_t scan(size_t pointer, int64_t value) const;
+};
+
+template<typename Data>
 class _LookaheadCOLA_ConstIterator
 {
+private:
+	using IndexType = typename Data::IndexType;
 public:
-	using Entry = _LookaheadCOLA_Entry;
 	using PointerType = const int64_t*;
 	using ReferenceType = const int64_t&;
 
 public:
-	_LookaheadCOLA_ConstIterator(const Entry* data, size_t size, size_t index) :
+	_LookaheadCOLA_ConstIterator(const Data* data, size_t size, size_t index) :
 		m_Data(data),
 		m_Size(size),
 		m_Index(index)
@@ -42,11 +145,11 @@ public:
 				// or all ones if there are no layers left.
 				m_LayerStartIndex = m_Index = leastZeroBits((m_Size << 1) & (~m_Index));
 				// Skip empty elements by following the first pointer.
-				if (m_Index != ~0 && (m_Data[m_Index].m_Pointer & FAKE_ELEMENT_FLAG) == 0)
-					m_Index += m_Data[m_Index].m_Pointer;
+				if (m_Index != ~0 && (m_Data->pointer(m_Index) & fakeElementFlag<IndexType>()) == 0)
+					m_Index += m_Data->pointer(m_Index);
 			}
 			// Skip fake elements
-		} while (m_Index != ~0 && (m_Data[m_Index].m_Pointer & FAKE_ELEMENT_FLAG));
+		} while (m_Index != ~0 && (m_Data->pointer(m_Index) & fakeElementFlag<IndexType>()));
 
 		return *this;
 	}
@@ -64,8 +167,8 @@ public:
 			if (m_LayerStartIndex != ~0)
 			{
 				// Make sure we do not iterate empty elements
-				size_t firstIndex = (m_Data[m_LayerStartIndex].m_Pointer & FAKE_ELEMENT_FLAG) ?
-					m_LayerStartIndex : m_LayerStartIndex + m_Data[m_LayerStartIndex].m_Pointer;	
+				size_t firstIndex = (m_Data->pointer(m_LayerStartIndex) & fakeElementFlag<IndexType>()) ?
+					m_LayerStartIndex : m_LayerStartIndex + m_Data->pointer(m_LayerStartIndex);
 				if (m_Index <= firstIndex)
 					m_Index = m_LayerStartIndex;
 			}
@@ -79,7 +182,7 @@ public:
 			}
 
 			m_Index--;
-		} while (m_Index != 0 && (m_Data[m_Index].m_Pointer & FAKE_ELEMENT_FLAG));
+		} while (m_Index != 0 && (m_Data->pointer(m_Index) & fakeElementFlag<IndexType>()));
 
 		return *this;
 	}
@@ -93,12 +196,12 @@ public:
 
 	PointerType operator->() const
 	{
-		return &m_Data[m_Index].m_Value;
+		return &m_Data->value(m_Index);
 	}
 
 	ReferenceType operator*() const
 	{
-		return m_Data[m_Index].m_Value;
+		return m_Data->value(m_Index);
 	}
 
 	bool operator==(const _LookaheadCOLA_ConstIterator& other) const
@@ -112,34 +215,65 @@ public:
 	}
 
 protected:
-	const Entry* m_Data;
+	const Data* m_Data;
 	const size_t m_Size;
 	size_t m_Index;
 	size_t m_LayerStartIndex;
 };
 
-class LookaheadCOLA
+// Cache-oblivious lookahead array with a fake lookahead element for every
+// INTERVAL elements of the next layer. The Data layout is either
+// _LookaheadCOLA_InterleavedData or _LookaheadCOLA_SplitData.
+template<size_t INTERVAL, typename Data>
+class GenericLookaheadCOLA
 {
+	// Layer l holds 2^(l - 1) real elements, so the fake elements pointing into
+	// the next layer only fit if there is at most one for every four elements.
+	static_assert(INTERVAL >= 4, "Fake elements must fit next to the real elements of a layer");
+
 private:
-	using Entry = _LookaheadCOLA_Entry;
-	using ConstIterator = _LookaheadCOLA_ConstIterator;
+	using IndexType = typename Data::IndexType;
+	using ConstIterator = _LookaheadCOLA_ConstIterator<Data>;
 
 public:
-	LookaheadCOLA() :
-		LookaheadCOLA::LookaheadCOLA(15) { }
+	GenericLookaheadCOLA() :
+		GenericLookaheadCOLA::GenericLookaheadCOLA(15) { }
 
-	LookaheadCOLA(size_t initialCapacity);
+	GenericLookaheadCOLA(size_t initialCapacity);
 
-	LookaheadCOLA(const LookaheadCOLA& other);
+	GenericLookaheadCOLA(const GenericLookaheadCOLA& other);
 
-	~LookaheadCOLA();
+	GenericLookaheadCOLA(GenericLookaheadCOLA&& other) noexcept;
+
+	~GenericLookaheadCOLA();
+
+	GenericLookaheadCOLA& operator=(GenericLookaheadCOLA&& other) noexcept;
 
 public:
+	// Create a copy in constant time. The data is shared until either
+	// of the colas inserts an element, which copies it for that cola.
+	GenericLookaheadCOLA clone() const;
+
+	// Throws std::length_error, leaving the cola unchanged, if the new
+	// capacity does not fit in the lookahead pointers.
 	void add(int64_t value);
 
 	bool contains(int64_t value) const;
 
-	bool predecessor(int64_t value, int64_t& result) const;
+	// Largest element less than or equal to value.
+	inline bool predecessor(int64_t value, int64_t& result) const { return neighbors(value).predecessor(result); }
+
+	// Smallest element greater than or equal to value.
+	inline bool successor(int64_t value, int64_t& result) const { return neighbors(value).successor(result); }
+
+	// Largest element strictly less than value.
+	inline bool strictPredecessor(int64_t value, int64_t& result) const { return ::strictPredecessor(*this, value, result); }
+
+	// Smallest element strictly greater than value.
+	inline bool strictSuccessor(int64_t value, int64_t& result) const { return ::strictSuccessor(*this, value, result); }
+
+	// Element closest to value, the smaller one on ties.
+	inline bool nearest(int64_t value, int64_t& result) const { return neighbors(value).nearest(value, result); }
 
 	inline size_t size() const { return m_Size; }
 
@@ -149,23 +283,33 @@ public:
 	{
 		size_t index = leastZeroBits(m_Size << 1);
 		// Skip empty elements
-		if ((m_Data[index].m_Pointer & FAKE_ELEMENT_FLAG) == 0)
-			index += m_Data[index].m_Pointer;
+		if ((m_Data.pointer(index) & fakeElementFlag<IndexType>()) == 0)
+			index += m_Data.pointer(index);
 		// Skip fake elements
-		while (m_Data[index].m_Pointer & FAKE_ELEMENT_FLAG)
+		while (m_Data.pointer(index) & fakeElementFlag<IndexType>())
 			index++;
-		return ConstIterator(m_Data, m_Size, index);
+		return ConstIterator(&m_Data, m_Size, index);
 	}
 
 	ConstIterator end() const
 	{
-		return ConstIterator(m_Data, m_Size, ~0);
+		return ConstIterator(&m_Data, m_Size, ~0);
 	}
 private:
+	_Neighbors<int64_t> neighbors(int64_t value) const;
+
 	void reallocData(size_t capacity);
 
 private:
-	Entry* m_Data;
+	Data m_Data;
 	size_t m_Capacity;
 	size_t m_Size;
-};
\ No newline at end of file
+};
+
+using LookaheadCOLA = GenericLookaheadCOLA<FAKE_ELEMENT_INTERVAL, _LookaheadCOLA_InterleavedData>;
+
+template<size_t INTERVAL>
+using IntervalLookaheadCOLA = GenericLookaheadCOLA<INTERVAL, _LookaheadCOLA_InterleavedData>;
+
+template<size_t INTERVAL = FAKE_ELEMENT_INTERVAL, typename P = uint32_t>
+using SplitLookaheadCOLA = GenericLookaheadCOLA<INTERVAL, _LookaheadCOLA_SplitData<P>>;
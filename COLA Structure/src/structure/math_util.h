@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
 
 template<class T>
 static T nextPO2MinusOne(T x)
@@ -101,7 +102,7 @@ static uint8_t popcount(T x)
 }
 
 template <typename T>
-static bool binarySearch(T value, T* data, size_t start, size_t end)
+static bool binarySearch(T value, const T* data, size_t start, size_t end)
 {
 	// Perform basic binary search
 	while (start < end)
@@ -119,8 +120,73 @@ static bool binarySearch(T value, T* data, size_t start, size_t end)
 	return false;
 }
 
+template <typename T>
+static size_t leadbitSearch(T value, const T* data, size_t start, size_t size)
+{
+	// Find the last element in the range of power of two size that
+	// is less than or equal to value (or start if there is none), by
+	// setting the bits of the offset from the most significant down.
+	size_t i = start;
+	for (size_t k = size >> 1; k != 0; k >>= 1)
+	{
+		if (value >= data[i + k])
+			i += k;
+	}
+	return i;
+}
+
+template <typename T>
+static size_t upperBound(T value, const T* data, size_t start, size_t end)
+{
+	// Find the first element in range that is greater than value
+	while (start < end)
+	{
+		const size_t m = start + ((end - start) >> 1);
+
+		if (value >= data[m])
+			start = m + 1;
+		else
+			end = m;
+	}
+
+	return start;
+}
+
+template <typename T>
+static bool mergeDisjoint(T* data, size_t i, size_t j, size_t k, size_t n)
+{
+	// Merge the sorted runs data[i, i + n) and data[j, j + n) into data[k,
+	// k + 2n), with j = k + n, by copying them if their ranges are disjoint,
+	// as for keys inserted in increasing or decreasing order. The first and
+	// last elements of a run are its fences. Returns false if the runs must
+	// be merged by comparing elements.
+	if (data[i + n - 1] <= data[j])
+	{
+		std::copy(&data[i], &data[i + n], &data[k]);
+		return true;
+	}
+
+	if (data[j + n - 1] < data[i])
+	{
+		std::copy(&data[j], &data[j + n], &data[k]);
+		std::copy(&data[i], &data[i + n], &data[j]);
+		return true;
+	}
+
+	return false;
+}
+
 template <typename T>
 inline static T ceilDiv(T a, T b)
 {
 	return (a + b - 1) / b;
 }
+
+template <typename T>
+inline static double keyDistance(T lo, T hi)
+{
+	// Distance between the integers lo <= hi, which is exact even if it
+	// exceeds the range of T. Converting both to double first would lose
+	// the distance between nearby keys of large magnitude.
+	return static_cast<double>(static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo));
+}
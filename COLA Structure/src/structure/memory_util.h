@@ -0,0 +1,17 @@
+#pragma once
+
+#include <memory>
+
+template<typename T>
+static std::shared_ptr<T> allocateShared(size_t count)
+{
+	// Blocks are reference counted, such that clones can share
+	// them until either of the colas has to write to them.
+	return std::shared_ptr<T>(new T[count], std::default_delete<T[]>());
+}
+
+template<typename T>
+inline static bool isShared(const std::shared_ptr<T>& block)
+{
+	return block.use_count() > 1;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+template<typename T>
+struct _Neighbors
+{
+	// Largest element less than or equal to the searched value
+	// and smallest element greater than or equal to it.
+	T m_Predecessor;
+	T m_Successor;
+	bool m_HasPredecessor;
+	bool m_HasSuccessor;
+
+	_Neighbors() :
+		m_Predecessor(),
+		m_Successor(),
+		m_HasPredecessor(false),
+		m_HasSuccessor(false) { }
+
+	inline void addPredecessor(T x)
+	{
+		if (!m_HasPredecessor || x > m_Predecessor)
+		{
+			m_Predecessor = x;
+			m_HasPredecessor = true;
+		}
+	}
+
+	inline void addSuccessor(T x)
+	{
+		if (!m_HasSuccessor || x < m_Successor)
+		{
+			m_Successor = x;
+			m_HasSuccessor = true;
+		}
+	}
+
+	// Add the candidates of a sorted range [.., end), where i is the last
+	// element that is less than or equal to value, or the first element
+	// of the range if there is none.
+	inline void addSearchResult(T value, const T* data, size_t i, size_t end)
+	{
+		const T x = data[i];
+		if (x > value)
+		{
+			addSuccessor(x);
+			return;
+		}
+
+		addPredecessor(x);
+		if (x == value)
+			addSuccessor(x);
+		else if (i + 1 < end)
+			addSuccessor(data[i + 1]);
+	}
+
+	// True if the value itself was found, such that no closer
+	// neighbors exist and the search can stop.
+	inline bool isExact(T value) const
+	{
+		return m_HasPredecessor && m_Predecessor == value;
+	}
+
+	inline bool predecessor(T& result) const
+	{
+		if (m_HasPredecessor)
+			result = m_Predecessor;
+		return m_HasPredecessor;
+	}
+
+	inline bool successor(T& result) const
+	{
+		if (m_HasSuccessor)
+			result = m_Successor;
+		return m_HasSuccessor;
+	}
+
+	bool nearest(T value, T& result) const
+	{
+		using U = typename std::make_unsigned<T>::type;
+
+		if (!m_HasPredecessor)
+			return successor(result);
+		if (!m_HasSuccessor)
+			return predecessor(result);
+
+		// Distances are computed unsigned to not overflow. Ties
+		// are resolved towards the smaller element.
+		const U predecessorDistance = static_cast<U>(value) - static_cast<U>(m_Predecessor);
+		const U successorDistance = static_cast<U>(m_Successor) - static_cast<U>(value);
+		result = (predecessorDistance <= successorDistance) ? m_Predecessor : m_Successor;
+		return true;
+	}
+};
+
+// Strict neighbor queries in terms of the inclusive ones of a cola.
+template<typename C, typename T>
+inline static bool strictPredecessor(const C& cola, T value, T& result)
+{
+	return value != std::numeric_limits<T>::min() && cola.predecessor(value - 1, result);
+}
+
+template<typename C, typename T>
+inline static bool strictSuccessor(const C& cola, T value, T& result)
+{
+	return value != std::numeric_limits<T>::max() && cola.successor(value + 1, result);
+}
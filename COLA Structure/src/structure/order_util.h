@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+template<typename T, typename S, typename CountLessEqual>
+static T selectByValue(S k, T lo, T hi, CountLessEqual countLessEqual)
+{
+	using U = typename std::make_unsigned<T>::type;
+
+	// Binary search for the smallest value with more than k elements less
+	// than or equal to it, which is always an element. Midpoints are
+	// computed unsigned to not overflow.
+	while (lo < hi)
+	{
+		const T m = static_cast<T>(static_cast<U>(lo) + ((static_cast<U>(hi) - static_cast<U>(lo)) >> 1));
+
+		if (countLessEqual(m) > k)
+			hi = m;
+		else
+			lo = m + 1;
+	}
+
+	return lo;
+}
+
+template<typename S>
+static S quantileRank(double q, S size)
+{
+	// Rank floor(q * (size - 1)) with q clamped to [0, 1]
+	if (size == 0 || !(q > 0.0))
+		return 0;
+	if (q >= 1.0)
+		return size - 1;
+	return static_cast<S>(q * static_cast<double>(size - 1));
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+template <typename T>
+static size_t gallopLowerBound(T value, const T* data, size_t start, size_t end)
+{
+	// Find the first element in range that is not less than value, probing
+	// at doubling distances from start first, such that short skips of a
+	// cursor take few probes.
+	if (start == end || !(data[start] < value))
+		return start;
+
+	size_t bound = 1;
+	while (start + bound < end && data[start + bound] < value)
+		bound <<= 1;
+
+	// The element at start + bound / 2 is less than value
+	size_t lo = start + (bound >> 1) + 1, hi = std::min(start + bound, end);
+	while (lo < hi)
+	{
+		const size_t m = lo + ((hi - lo) >> 1);
+
+		if (data[m] < value)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+
+	return lo;
+}
+
+// Cursor over the elements of sorted runs, such as the layers of a cola,
+// in ascending order. The cursor only moves forward, and seeks skip ahead
+// in each run with galloping search. It points into the runs, so it is
+// invalidated by changes to them.
+template<typename T>
+class _SetCursor
+{
+private:
+	static const uint8_t MAX_RUNS = sizeof(size_t) * 8;
+
+	struct Run
+	{
+		const T* m_Data;
+		size_t m_Index;
+		size_t m_End;
+	};
+
+public:
+	_SetCursor() :
+		m_RunCount(0),
+		m_Current(0) { }
+
+	// Add the sorted run [start, end) of data.
+	void addRun(const T* data, size_t start, size_t end)
+	{
+		if (start != end && m_RunCount < MAX_RUNS)
+		{
+			m_Runs[m_RunCount++] = { data, start, end };
+			findCurrent();
+		}
+	}
+
+	inline bool valid() const { return m_Current != m_RunCount; }
+
+	// Current element, the smallest one that has not been passed.
+	inline T value() const { return m_Runs[m_Current].m_Data[m_Runs[m_Current].m_Index]; }
+
+	void next()
+	{
+		m_Runs[m_Current].m_Index++;
+		findCurrent();
+	}
+
+	// Move to the first element not less than value, unless already past it.
+	void seek(T value)
+	{
+		for (uint8_t r = 0; r < m_RunCount; r++)
+		{
+			Run& run = m_Runs[r];
+			run.m_Index = gallopLowerBound(value, run.m_Data, run.m_Index, run.m_End);
+		}
+		findCurrent();
+	}
+
+private:
+	void findCurrent()
+	{
+		// Runs are few (one per layer), so they are scanned for the smallest
+		m_Current = m_RunCount;
+		for (uint8_t r = 0; r < m_RunCount; r++)
+		{
+			const Run& run = m_Runs[r];
+			if (run.m_Index != run.m_End && (m_Current == m_RunCount || run.m_Data[run.m_Index] < value()))
+				m_Current = r;
+		}
+	}
+
+private:
+	Run m_Runs[MAX_RUNS];
+	uint8_t m_RunCount;
+
+	// Run of the current element, or m_RunCount at the end.
+	uint8_t m_Current;
+};
+
+// Cursor over the elements of a that are also in b, in ascending order.
+// Like std::set_intersection, an element stored i times in a and j times
+// in b is visited min(i, j) times. Each cursor seeks to the current
+// element of the other, so runs of elements in only one of them are
+// skipped with galloping search instead of being visited.
+template<typename T>
+class IntersectCursor
+{
+public:
+	IntersectCursor(const _SetCursor<T>& a, const _SetCursor<T>& b) :
+		m_A(a),
+		m_B(b)
+	{
+		align();
+	}
+
+	inline bool valid() const { return m_A.valid() && m_B.valid(); }
+
+	inline T value() const { return m_A.value(); }
+
+	void next()
+	{
+		m_A.next();
+		m_B.next();
+		align();
+	}
+
+private:
+	void align()
+	{
+		while (m_A.valid() && m_B.valid())
+		{
+			if (m_A.value() < m_B.value())
+				m_A.seek(m_B.value());
+			else if (m_B.value() < m_A.value())
+				m_B.seek(m_A.value());
+			else
+				return;
+		}
+	}
+
+private:
+	_SetCursor<T> m_A;
+	_SetCursor<T> m_B;
+};
+
+// Cursor over the elements of a that are not in b, in ascending order.
+// Like std::set_difference, an element stored i times in a and j times in
+// b is visited max(i - j, 0) times.
+template<typename T>
+class DifferenceCursor
+{
+public:
+	DifferenceCursor(const _SetCursor<T>& a, const _SetCursor<T>& b) :
+		m_A(a),
+		m_B(b)
+	{
+		align();
+	}
+
+	inline bool valid() const { return m_A.valid(); }
+
+	inline T value() const { return m_A.value(); }
+
+	void next()
+	{
+		m_A.next();
+		align();
+	}
+
+private:
+	void align()
+	{
+		// Skip the elements of a that match an element of b
+		while (m_A.valid())
+		{
+			m_B.seek(m_A.value());
+			if (!m_B.valid() || m_A.value() < m_B.value())
+				return;
+
+			m_A.next();
+			m_B.next();
+		}
+	}
+
+private:
+	_SetCursor<T> m_A;
+	_SetCursor<T> m_B;
+};
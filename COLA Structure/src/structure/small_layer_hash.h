@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <emmintrin.h>
+
+#include "./math_util.h"
+
+#ifndef SMALL_LAYER_HASH_BITS
+// Layers of less than 2^SMALL_LAYER_HASH_BITS elements, which hold the most
+// recently inserted elements, are covered by a hash set. Lookups of recent
+// elements then take a single probe, and other lookups skip the small
+// layers. Zero disables the hash set.
+#define SMALL_LAYER_HASH_BITS 10
+#endif // !SMALL_LAYER_HASH_BITS
+
+// Open addressing hash set of the elements of the small layers, like a Swiss
+// table. Slots are probed in groups of 16, whose control bytes are compared
+// with the 7-bit tag of the key at once. The set is only cleared as a whole,
+// so there are no tombstones, and it holds at most half as many keys as
+// slots, so the probes always reach an empty slot.
+template<typename T>
+class _SmallLayerHash
+{
+private:
+	// Control byte of empty slots, while used slots hold a tag below it.
+	enum : uint8_t { EMPTY = 0x80 };
+	static const size_t GROUP_SIZE = 16;
+
+public:
+	// The set is allocated on the first insert, for at most maxCount keys.
+	_SmallLayerHash(size_t maxCount) :
+		m_Control(),
+		m_Keys(),
+		m_GroupMask(0),
+		m_GroupShift(0),
+		m_Count(0),
+		m_MaxCount(maxCount) { }
+
+	_SmallLayerHash(const _SmallLayerHash& other) = default;
+
+	_SmallLayerHash(_SmallLayerHash&& other) noexcept :
+		m_Control(std::move(other.m_Control)),
+		m_Keys(std::move(other.m_Keys)),
+		m_GroupMask(other.m_GroupMask),
+		m_GroupShift(other.m_GroupShift),
+		m_Count(other.m_Count),
+		m_MaxCount(other.m_MaxCount)
+	{
+		// Leave the other set empty, to be allocated again on insert.
+		other.m_Count = 0;
+	}
+
+	_SmallLayerHash& operator=(const _SmallLayerHash& other) = default;
+
+	_SmallLayerHash& operator=(_SmallLayerHash&& other) noexcept
+	{
+		if (this != &other)
+		{
+			m_Control = std::move(other.m_Control);
+			m_Keys = std::move(other.m_Keys);
+			m_GroupMask = other.m_GroupMask;
+			m_GroupShift = other.m_GroupShift;
+			m_Count = other.m_Count;
+			m_MaxCount = other.m_MaxCount;
+
+			other.m_Control.clear();
+			other.m_Keys.clear();
+			other.m_Count = 0;
+		}
+
+		return *this;
+	}
+
+	inline size_t size() const { return m_Count; }
+
+	void clear()
+	{
+		if (m_Count != 0)
+		{
+			std::fill(m_Control.begin(), m_Control.end(), EMPTY);
+			m_Count = 0;
+		}
+	}
+
+	void insert(T key)
+	{
+		if (m_Control.empty())
+			allocate();
+
+		const uint64_t h = hash(key);
+		const __m128i _tag = _mm_set1_epi8(static_cast<char>(h >> 57));
+		const __m128i _empty = _mm_set1_epi8(static_cast<char>(EMPTY));
+
+		for (size_t g = (h >> m_GroupShift) & m_GroupMask;; g = (g + 1) & m_GroupMask)
+		{
+			const __m128i _control = _mm_loadu_si128((const __m128i*)&m_Control[g * GROUP_SIZE]);
+			if (matchGroup(g, _control, _tag, key))
+				return;
+
+			// Take the first empty slot of the first group that has one
+			const uint32_t empty = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_control, _empty)));
+			if (empty != 0)
+			{
+				const size_t i = g * GROUP_SIZE + popcount((empty & (~empty + 1)) - 1);
+				m_Control[i] = static_cast<uint8_t>(h >> 57);
+				m_Keys[i] = key;
+				m_Count++;
+				return;
+			}
+		}
+	}
+
+	bool contains(T key) const
+	{
+		if (m_Count == 0)
+			return false;
+
+		const uint64_t h = hash(key);
+		const __m128i _tag = _mm_set1_epi8(static_cast<char>(h >> 57));
+		const __m128i _empty = _mm_set1_epi8(static_cast<char>(EMPTY));
+
+		for (size_t g = (h >> m_GroupShift) & m_GroupMask;; g = (g + 1) & m_GroupMask)
+		{
+			const __m128i _control = _mm_loadu_si128((const __m128i*)&m_Control[g * GROUP_SIZE]);
+			if (matchGroup(g, _control, _tag, key))
+				return true;
+
+			// The key would be in the first group with an empty slot
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(_control, _empty)) != 0)
+				return false;
+		}
+	}
+
+private:
+	static inline uint64_t hash(T key)
+	{
+		// Fibonacci hashing, whose upper bits depend on all bits of the key.
+		// The top 7 bits are the tag, and the bits below select the group.
+		return static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+	}
+
+	inline bool matchGroup(size_t g, __m128i _control, __m128i _tag, T key) const
+	{
+		// Compare the keys of the slots whose tag matches
+		uint32_t match = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_control, _tag)));
+		for (; match != 0; match &= match - 1)
+		{
+			if (m_Keys[g * GROUP_SIZE + popcount((match & (~match + 1)) - 1)] == key)
+				return true;
+		}
+		return false;
+	}
+
+	void allocate()
+	{
+		// At least twice as many slots as keys
+		const size_t groups = static_cast<size_t>(nextPO2MinusOne(static_cast<uint64_t>(ceilDiv(m_MaxCount * 2, GROUP_SIZE) - 1)) + 1);
+		m_Control.assign(groups * GROUP_SIZE, EMPTY);
+		m_Keys.resize(groups * GROUP_SIZE);
+		m_GroupMask = groups - 1;
+
+		// Select the group with the bits below the tag
+		m_GroupShift = 57 - popcount(m_GroupMask);
+	}
+
+private:
+	std::vector<uint8_t> m_Control;
+	std::vector<T> m_Keys;
+	size_t m_GroupMask;
+	uint8_t m_GroupShift;
+	size_t m_Count;
+	size_t m_MaxCount;
+};
@@ -0,0 +1,169 @@
+#include "static_search_tree.h"
+
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "./file_util.h"
+
+#define STATIC_TREE_MAGIC 0x45525453u
+#define STATIC_TREE_VERSION 1u
+
+#ifndef STATIC_TREE_SIMD_SEARCH
+#define STATIC_TREE_SIMD_SEARCH 1
+#endif // !STATIC_TREE_SIMD_SEARCH
+
+static uint32_t countLess(const int32_t* node, int32_t value)
+{
+#if STATIC_TREE_SIMD_SEARCH
+	// Compare all keys of the node at once. The node is a single cache
+	// line, so it is loaded as two aligned 256 bit vectors.
+	const __m256i _z = _mm256_set1_epi32(value);
+	const __m256i _lo = _mm256_load_si256((const __m256i*)node);
+	const __m256i _hi = _mm256_load_si256((const __m256i*)(node + 8));
+	const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_z, _lo)))) |
+		(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_z, _hi)))) << 8);
+	return popcount(mask);
+#else
+	// Sequential fallback implementation
+	uint32_t count = 0;
+	while (count < STATIC_TREE_NODE_SIZE && node[count] < value)
+		count++;
+	return count;
+#endif
+}
+
+StaticSearchTree::StaticSearchTree() :
+	m_Block(),
+	m_Nodes(nullptr),
+	m_Leaves(nullptr),
+	m_NodeCount(0),
+	m_Size(0),
+	m_LayerCount(0) { }
+
+StaticSearchTree::~StaticSearchTree() { }
+
+int32_t* StaticSearchTree::reset(size_t size)
+{
+	// Number of nodes in each layer, from the leaves up to the root
+	size_t counts[sizeof(size_t) * 8];
+	size_t nodes = std::max(static_cast<size_t>(1), ceilDiv(size, static_cast<size_t>(STATIC_TREE_NODE_SIZE)));
+
+	m_LayerCount = 0;
+	counts[m_LayerCount++] = nodes;
+	while (nodes > 1)
+	{
+		nodes = ceilDiv(nodes, static_cast<size_t>(STATIC_TREE_FANOUT));
+		counts[m_LayerCount++] = nodes;
+	}
+
+	// Layers are stored from the root down, such that the leaves are last
+	m_NodeCount = 1;
+	for (uint8_t h = m_LayerCount; h-- > 0;)
+	{
+		m_LayerOffsets[h] = m_NodeCount * STATIC_TREE_NODE_SIZE;
+		m_NodeCount += counts[h];
+	}
+
+	// Allocate an extra node to be able to align the data to 64 bytes
+	m_Block = allocateShared<int32_t>((m_NodeCount + 1) * STATIC_TREE_NODE_SIZE);
+	m_Nodes = (int32_t*)(((uintptr_t)m_Block.get() + 63) & ~(uintptr_t)0x3F);
+	m_Leaves = &m_Nodes[m_LayerOffsets[0]];
+	m_Size = size;
+
+	// Padding keys are never less than a searched value
+	std::fill(m_Nodes, &m_Nodes[STATIC_TREE_NODE_SIZE], std::numeric_limits<int32_t>::max());
+	std::fill(&m_Leaves[size], &m_Leaves[counts[0] * STATIC_TREE_NODE_SIZE], std::numeric_limits<int32_t>::max());
+
+	return m_Leaves;
+}
+
+void StaticSearchTree::build()
+{
+	// Number of leaf keys below a node of the layer below the current one
+	size_t span = STATIC_TREE_NODE_SIZE;
+
+	for (uint8_t h = 1; h < m_LayerCount; h++, span *= STATIC_TREE_FANOUT)
+	{
+		int32_t* layer = &m_Nodes[m_LayerOffsets[h]];
+		const size_t count = (m_LayerOffsets[h - 1] - m_LayerOffsets[h]) / STATIC_TREE_NODE_SIZE;
+
+		for (size_t k = 0; k < count; k++)
+		{
+			for (uint32_t j = 0; j < STATIC_TREE_NODE_SIZE; j++)
+			{
+				// Smallest key of child j + 1 is the first key of its leftmost leaf
+				const size_t first = (k * STATIC_TREE_FANOUT + j + 1) * span;
+				layer[k * STATIC_TREE_NODE_SIZE + j] = (first < m_Size) ? m_Leaves[first] : std::numeric_limits<int32_t>::max();
+			}
+		}
+	}
+}
+
+size_t StaticSearchTree::lowerBound(int32_t value) const
+{
+	if (m_Size == 0)
+		return 0;
+
+	// The number of keys less than value in a node is the child to descend
+	// into. If the lower bound is the first key of the next child, the
+	// search ends right after the last key of the current child instead,
+	// which is the same index since the leaves are stored consecutively.
+	size_t k = 0;
+	for (uint8_t h = m_LayerCount - 1; h > 0; h--)
+		k = k * STATIC_TREE_FANOUT + countLess(&m_Nodes[m_LayerOffsets[h] + k * STATIC_TREE_NODE_SIZE], value);
+
+	return k * STATIC_TREE_NODE_SIZE + countLess(&m_Leaves[k * STATIC_TREE_NODE_SIZE], value);
+}
+
+bool StaticSearchTree::save(const std::string& path) const
+{
+	FILE* file = openFile(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	const uint64_t header[2] = { (static_cast<uint64_t>(STATIC_TREE_VERSION) << 32) | STATIC_TREE_MAGIC, m_Size };
+	bool success = fwrite(header, sizeof(uint64_t), 2, file) == 2;
+
+	if (success && m_Size > 0)
+	{
+		// All nodes except the padding node
+		const size_t count = (m_NodeCount - 1) * STATIC_TREE_NODE_SIZE;
+		success = fwrite(&m_Nodes[STATIC_TREE_NODE_SIZE], sizeof(int32_t), count, file) == count;
+	}
+
+	success = syncFile(file) && success;
+	return (fclose(file) == 0) && success;
+}
+
+bool StaticSearchTree::load(const std::string& path)
+{
+	FILE* file = openFile(path, "rb");
+	if (file == nullptr)
+		return false;
+
+	uint64_t header[2];
+	bool success = fread(header, sizeof(uint64_t), 2, file) == 2 &&
+		header[0] == ((static_cast<uint64_t>(STATIC_TREE_VERSION) << 32) | STATIC_TREE_MAGIC) &&
+		header[1] <= std::numeric_limits<size_t>::max();
+
+	// Read into a new tree such that a failed load leaves the tree unchanged
+	StaticSearchTree tree;
+	if (success)
+	{
+		tree.reset(static_cast<size_t>(header[1]));
+
+		if (tree.m_Size > 0)
+		{
+			const size_t count = (tree.m_NodeCount - 1) * STATIC_TREE_NODE_SIZE;
+			success = fread(&tree.m_Nodes[STATIC_TREE_NODE_SIZE], sizeof(int32_t), count, file) == count;
+		}
+	}
+
+	fclose(file);
+
+	if (success)
+		*this = std::move(tree);
+	return success;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "./math_util.h"
+#include "./memory_util.h"
+
+// Number of keys in a node, which fills a 64 byte cache line.
+#define STATIC_TREE_NODE_SIZE static_cast<uint32_t>(16)
+#define STATIC_TREE_FANOUT (STATIC_TREE_NODE_SIZE + 1)
+
+// Static implicit B+-tree over a sorted run of keys (S+ tree). The leaves are
+// the run itself, padded to full nodes, and key j of an internal node is the
+// smallest key of child j + 1. Node k of a layer has the children 17k, ...,
+// 17k + 16 in the layer below, so no pointers are stored and a search only
+// touches one cache line per layer, i.e. about log_17 N cache misses.
+class StaticSearchTree
+{
+public:
+	StaticSearchTree();
+
+	StaticSearchTree(const StaticSearchTree& other) = default;
+
+	StaticSearchTree(StaticSearchTree&& other) noexcept = default;
+
+	~StaticSearchTree();
+
+	StaticSearchTree& operator=(const StaticSearchTree& other) = default;
+
+	StaticSearchTree& operator=(StaticSearchTree&& other) noexcept = default;
+
+public:
+	// Allocate a tree for size keys, and return the leaves to be filled
+	// with the sorted keys before calling build().
+	int32_t* reset(size_t size);
+
+	// Build the internal layers from the leaves.
+	void build();
+
+	// Index of the first key that is greater than or equal to value, or
+	// size() if there is none.
+	size_t lowerBound(int32_t value) const;
+
+	inline bool contains(int32_t value) const
+	{
+		const size_t i = lowerBound(value);
+		return i < m_Size && m_Leaves[i] == value;
+	}
+
+	// Sorted keys, i.e. the leaves of the tree.
+	inline const int32_t* data() const { return m_Leaves; }
+
+	inline size_t size() const { return m_Size; }
+
+	// Write all nodes of the tree, such that it can be loaded without
+	// rebuilding it.
+	bool save(const std::string& path) const;
+
+	// Replace the tree with one that was saved to the file. The tree is
+	// left unchanged if the file can not be read.
+	bool load(const std::string& path);
+
+private:
+	std::shared_ptr<int32_t> m_Block;
+	// Nodes aligned to cache lines. A padding node is followed by the
+	// layers from the root down to the leaves.
+	int32_t* m_Nodes;
+	int32_t* m_Leaves;
+	size_t m_NodeCount;
+	size_t m_Size;
+
+	// Offset of the first key of each layer, with the leaves as layer 0.
+	uint8_t m_LayerCount;
+	size_t m_LayerOffsets[sizeof(size_t) * 8];
+};
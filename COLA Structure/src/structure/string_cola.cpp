@@ -0,0 +1,252 @@
+#include "string_cola.h"
+
+#include <algorithm>
+
+// Compare keys like std::string, i.e. bytewise and unsigned, with a shorter
+// key before a longer key that starts with it.
+static inline int compareKeys(const char* a, size_t aLength, const char* b, size_t bLength)
+{
+	// Empty keys may point into an empty arena, i.e. be null, which
+	// memcmp does not allow even for a length of zero.
+	const size_t length = std::min(aLength, bLength);
+	if (length != 0)
+	{
+		const int c = memcmp(a, b, length);
+		if (c != 0)
+			return c;
+	}
+	return (aLength < bLength) ? -1 : (aLength > bLength) ? 1 : 0;
+}
+
+static inline int compareKeys(const _StringCOLA_Layer& a, size_t i, const _StringCOLA_Layer& b, size_t j)
+{
+	// Keys with a different prefix differ in their first 8 bytes
+	if (a.m_Prefixes[i] != b.m_Prefixes[j])
+		return (a.m_Prefixes[i] < b.m_Prefixes[j]) ? -1 : 1;
+	return compareKeys(a.key(i), a.length(i), b.key(j), b.length(j));
+}
+
+// Append all keys of layer b to layer a, copying the arena at once.
+static void appendLayer(_StringCOLA_Layer& a, const _StringCOLA_Layer& b)
+{
+	const size_t offset = a.m_Arena.size();
+	a.m_Prefixes.insert(a.m_Prefixes.end(), b.m_Prefixes.begin(), b.m_Prefixes.end());
+	a.m_Arena.insert(a.m_Arena.end(), b.m_Arena.begin(), b.m_Arena.end());
+	for (size_t i = 1; i < b.m_Offsets.size(); i++)
+		a.m_Offsets.push_back(offset + b.m_Offsets[i]);
+}
+
+// Index after the last prefix in the layer that is less than or equal to
+// prefix (or zero if there is none). Layers are of power of two size.
+static inline size_t prefixUpperBound(uint64_t prefix, const uint64_t* prefixes, size_t size)
+{
+	const size_t i = leadbitSearch(prefix, prefixes, 0, size);
+	return (prefixes[i] <= prefix) ? i + 1 : 0;
+}
+
+StringCOLA::StringCOLA() :
+	m_Size(0),
+	m_Layers(),
+	m_Run(),
+	m_Merged() { }
+
+StringCOLA::~StringCOLA() { }
+
+uint64_t StringCOLA::prefix(const char* key, size_t length)
+{
+	uint64_t prefix = 0;
+	for (size_t i = 0; i < 8; i++)
+	{
+		prefix <<= 8;
+		if (i < length)
+			prefix |= static_cast<uint8_t>(key[i]);
+	}
+	return prefix;
+}
+
+void StringCOLA::add(const char* key, size_t length)
+{
+	// Find first empty layer (merge-layer)
+	const uint8_t m = popcount(leastZeroBits(m_Size + 1));
+	if (m >= m_Layers.size())
+	{
+		// Allocate a new layer
+		m_Layers.resize(m + 1);
+	}
+
+	m_Run.clear();
+	m_Run.append(prefix(key, length), key, length);
+
+	// Iteratively merge the layers below the merge-layer into the run
+	for (uint8_t l = 0; l < m; l++)
+	{
+		m_Merged.clear();
+		mergeLayers(m_Layers[l], m_Run, m_Merged);
+		std::swap(m_Run, m_Merged);
+		m_Layers[l].clear();
+	}
+
+	// The merge-layer is empty, so it takes the run and
+	// leaves its memory to the next run.
+	std::swap(m_Layers[m], m_Run);
+	m_Size++;
+}
+
+void StringCOLA::mergeLayers(const Layer& a, const Layer& b, Layer& c)
+{
+	c.m_Prefixes.reserve(a.size() + b.size());
+	c.m_Offsets.reserve(a.size() + b.size() + 1);
+	c.m_Arena.reserve(a.m_Arena.size() + b.m_Arena.size());
+
+	// Layers that do not overlap are appended as a whole
+	if (compareKeys(a, a.size() - 1, b, 0) <= 0)
+	{
+		appendLayer(c, a);
+		appendLayer(c, b);
+		return;
+	}
+	if (compareKeys(b, b.size() - 1, a, 0) < 0)
+	{
+		appendLayer(c, b);
+		appendLayer(c, a);
+		return;
+	}
+
+	// Perform simple merge sort (ascending order)
+	size_t i = 0, j = 0;
+	while (i != a.size() && j != b.size())
+	{
+		if (compareKeys(a, i, b, j) <= 0)
+		{
+			c.append(a.m_Prefixes[i], a.key(i), a.length(i));
+			i++;
+		}
+		else
+		{
+			c.append(b.m_Prefixes[j], b.key(j), b.length(j));
+			j++;
+		}
+	}
+
+	// Copy remaining keys
+	for (; i != a.size(); i++)
+		c.append(a.m_Prefixes[i], a.key(i), a.length(i));
+	for (; j != b.size(); j++)
+		c.append(b.m_Prefixes[j], b.key(j), b.length(j));
+}
+
+template<bool UPPER>
+size_t StringCOLA::bound(const Layer& layer, uint64_t prefix, const char* key, size_t length)
+{
+	// Keys with a smaller prefix are less than key, and keys with a
+	// greater prefix are greater, so the prefixes are searched first.
+	const uint64_t* prefixes = layer.m_Prefixes.data();
+	size_t lo = (prefix != 0) ? prefixUpperBound(prefix - 1, prefixes, layer.size()) : 0;
+	size_t hi = prefixUpperBound(prefix, prefixes, layer.size());
+
+	// Compare the keys only for equal prefixes
+	while (lo < hi)
+	{
+		const size_t m = lo + ((hi - lo) >> 1);
+		const int c = compareKeys(layer.key(m), layer.length(m), key, length);
+
+		if (UPPER ? (c <= 0) : (c < 0))
+			lo = m + 1;
+		else
+			hi = m;
+	}
+
+	return lo;
+}
+
+bool StringCOLA::contains(const char* key, size_t length) const
+{
+	const uint64_t p = prefix(key, length);
+
+	for (size_t full = m_Size; full != 0; full &= full - 1)
+	{
+		const Layer& layer = m_Layers[popcount((full & (~full + 1)) - 1)];
+
+		// Skip layers that can not contain the key
+		if (p < layer.m_Prefixes.front() || p > layer.m_Prefixes.back())
+			continue;
+
+		const size_t i = bound<false>(layer, p, key, length);
+		if (i != layer.size() && layer.m_Prefixes[i] == p && compareKeys(layer.key(i), layer.length(i), key, length) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+template<bool PREDECESSOR, bool STRICT>
+bool StringCOLA::neighbor(const std::string& key, std::string& result) const
+{
+	const uint64_t p = prefix(key.data(), key.size());
+
+	// Layer and index of the best neighbor so far
+	const Layer* best = nullptr;
+	size_t bestIndex = 0;
+
+	for (size_t full = m_Size; full != 0; full &= full - 1)
+	{
+		const Layer& layer = m_Layers[popcount((full & (~full + 1)) - 1)];
+
+		// The predecessor is before the first key greater than key (or not
+		// less if strict), and the successor is the first key not less than
+		// key (or greater if strict).
+		const size_t i = bound<PREDECESSOR != STRICT>(layer, p, key.data(), key.size());
+		if (PREDECESSOR ? (i == 0) : (i == layer.size()))
+			continue;
+
+		const size_t j = PREDECESSOR ? i - 1 : i;
+		if (best == nullptr)
+		{
+			best = &layer;
+			bestIndex = j;
+		}
+		else
+		{
+			const int c = compareKeys(layer, j, *best, bestIndex);
+			if (PREDECESSOR ? (c > 0) : (c < 0))
+			{
+				best = &layer;
+				bestIndex = j;
+			}
+		}
+	}
+
+	if (best == nullptr)
+		return false;
+
+	result.assign(best->key(bestIndex), best->length(bestIndex));
+	return true;
+}
+
+bool StringCOLA::predecessor(const std::string& key, std::string& result) const
+{
+	return neighbor<true, false>(key, result);
+}
+
+bool StringCOLA::successor(const std::string& key, std::string& result) const
+{
+	return neighbor<false, false>(key, result);
+}
+
+bool StringCOLA::strictPredecessor(const std::string& key, std::string& result) const
+{
+	return neighbor<true, true>(key, result);
+}
+
+bool StringCOLA::strictSuccessor(const std::string& key, std::string& result) const
+{
+	return neighbor<false, true>(key, result);
+}
+
+size_t StringCOLA::arenaSize() const
+{
+	size_t size = 0;
+	for (const Layer& layer : m_Layers)
+		size += layer.m_Arena.size();
+	return size;
+}
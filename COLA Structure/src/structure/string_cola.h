@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "./math_util.h"
+
+// Layer of string keys. The first 8 bytes of each key are stored as a big
+// endian prefix (padded with zeros) in a dense array, such that prefixes
+// are ordered like their keys and most comparisons only touch the prefix
+// array. The keys themselves are stored one after another in an arena.
+struct _StringCOLA_Layer
+{
+	std::vector<uint64_t> m_Prefixes;
+
+	// Start of each key in the arena, and the end of the last key.
+	std::vector<size_t> m_Offsets;
+	std::vector<char> m_Arena;
+
+	_StringCOLA_Layer() :
+		m_Prefixes(),
+		m_Offsets(1, 0),
+		m_Arena() { }
+
+	inline size_t size() const { return m_Prefixes.size(); }
+
+	inline const char* key(size_t i) const { return m_Arena.data() + m_Offsets[i]; }
+
+	inline size_t length(size_t i) const { return m_Offsets[i + 1] - m_Offsets[i]; }
+
+	inline std::string string(size_t i) const { return std::string(key(i), length(i)); }
+
+	void clear()
+	{
+		m_Prefixes.clear();
+		m_Offsets.resize(1);
+		m_Arena.clear();
+	}
+
+	void append(uint64_t prefix, const char* key, size_t length)
+	{
+		m_Prefixes.push_back(prefix);
+		m_Arena.insert(m_Arena.end(), key, key + length);
+		m_Offsets.push_back(m_Arena.size());
+	}
+};
+
+class _StringCOLA_ConstIterator
+{
+private:
+	using Layer = _StringCOLA_Layer;
+	static const uint8_t LAYER_COUNT = sizeof(size_t) * 8;
+public:
+	using PointerType = const std::string*;
+	using ReferenceType = std::string;
+
+public:
+	_StringCOLA_ConstIterator(const Layer* layers, size_t occupied, uint8_t layer, size_t index) :
+		m_Layers(layers),
+		m_Occupied(occupied),
+		m_Layer(layer),
+		m_Index(index) { }
+
+	_StringCOLA_ConstIterator& operator++()
+	{
+		m_Index++;
+
+		// Check if we are at the end of a layer
+		if (m_Index == m_Layers[m_Layer].size())
+		{
+			// Go to the first key in the next full layer,
+			// or to the end if there are no layers left.
+			const size_t next = (m_Layer + 1 < LAYER_COUNT) ? (m_Occupied >> (m_Layer + 1)) : 0;
+			if (next == 0)
+				m_Layer = LAYER_COUNT;
+			else
+				m_Layer += 1 + popcount((next & (~next + 1)) - 1);
+			m_Index = 0;
+		}
+
+		return *this;
+	}
+
+	_StringCOLA_ConstIterator operator++(int)
+	{
+		_StringCOLA_ConstIterator itr = *this;
+		++(*this);
+		return itr;
+	}
+
+	_StringCOLA_ConstIterator& operator--()
+	{
+		// Check if we are at the beginning of a layer (or at the end)
+		if (m_Layer == LAYER_COUNT || m_Index == 0)
+		{
+			// Go after the last key in the previous full layer
+			const size_t previous = (m_Layer == LAYER_COUNT) ? m_Occupied : (m_Occupied & ((static_cast<size_t>(1) << m_Layer) - 1));
+			m_Layer = popcount(nextPO2MinusOne(previous)) - 1;
+			m_Index = m_Layers[m_Layer].size();
+		}
+
+		m_Index--;
+
+		return *this;
+	}
+
+	_StringCOLA_ConstIterator operator--(int)
+	{
+		_StringCOLA_ConstIterator itr = *this;
+		--(*this);
+		return itr;
+	}
+
+	// Keys are copied out of the arena on access, so they are returned by value.
+	ReferenceType operator*() const
+	{
+		return m_Layers[m_Layer].string(m_Index);
+	}
+
+	bool operator==(const _StringCOLA_ConstIterator& other) const
+	{
+		return (m_Layers == other.m_Layers && m_Layer == other.m_Layer && m_Index == other.m_Index);
+	}
+
+	bool operator!=(const _StringCOLA_ConstIterator& other) const
+	{
+		return !(*this == other);
+	}
+
+protected:
+	const Layer* m_Layers;
+	const size_t m_Occupied;
+	uint8_t m_Layer;
+	size_t m_Index;
+};
+
+// Cola of variable length string keys, ordered like std::string (bytewise
+// and unsigned). Layer l is full and holds 2^l keys when bit l of the size
+// is set, like in BasicCOLA. Layers are searched and merged on their prefix
+// arrays, and the keys are only compared when their prefixes are equal.
+class StringCOLA
+{
+private:
+	using Layer = _StringCOLA_Layer;
+public:
+	using ConstIterator = _StringCOLA_ConstIterator;
+
+public:
+	StringCOLA();
+
+	StringCOLA(const StringCOLA& other) = default;
+
+	~StringCOLA();
+
+public:
+	void add(const char* key, size_t length);
+
+	inline void add(const std::string& key) { add(key.data(), key.size()); }
+
+	bool contains(const char* key, size_t length) const;
+
+	inline bool contains(const std::string& key) const { return contains(key.data(), key.size()); }
+
+	// Largest key less than or equal to key.
+	bool predecessor(const std::string& key, std::string& result) const;
+
+	// Smallest key greater than or equal to key.
+	bool successor(const std::string& key, std::string& result) const;
+
+	// Largest key strictly less than key.
+	bool strictPredecessor(const std::string& key, std::string& result) const;
+
+	// Smallest key strictly greater than key.
+	bool strictSuccessor(const std::string& key, std::string& result) const;
+
+	inline size_t size() const { return m_Size; }
+
+	// Number of bytes of the keys.
+	size_t arenaSize() const;
+
+	ConstIterator begin() const
+	{
+		if (m_Size == 0)
+			return end();
+
+		// First key of the first full layer
+		return ConstIterator(m_Layers.data(), m_Size, popcount((m_Size & (~m_Size + 1)) - 1), 0);
+	}
+
+	ConstIterator end() const
+	{
+		return ConstIterator(m_Layers.data(), m_Size, sizeof(size_t) * 8, 0);
+	}
+
+	// Big endian value of the first 8 bytes of key, padded with zeros.
+	static uint64_t prefix(const char* key, size_t length);
+
+private:
+	// Merge layer a and layer b into the empty layer c.
+	static void mergeLayers(const Layer& a, const Layer& b, Layer& c);
+
+	// Index of the first key in the layer that is not less than key, or
+	// greater than key if UPPER.
+	template<bool UPPER>
+	static size_t bound(const Layer& layer, uint64_t prefix, const char* key, size_t length);
+
+	// Neighbor of key, the predecessor if PREDECESSOR or the successor
+	// otherwise, which must not be equal to key if STRICT.
+	template<bool PREDECESSOR, bool STRICT>
+	bool neighbor(const std::string& key, std::string& result) const;
+
+private:
+	// Layer l holds keys if bit l of m_Size is set.
+	size_t m_Size;
+	std::vector<Layer> m_Layers;
+
+	// Layers that the merged runs are built in, which keep their
+	// memory from one insert to the next.
+	Layer m_Run;
+	Layer m_Merged;
+};
@@ -0,0 +1,286 @@
+#include "./write_ahead_log.h"
+
+#include <chrono>
+#include <limits>
+
+static uint64_t checksum(const char* data, size_t size)
+{
+	// FNV-1a over 64-bit words (and remaining bytes), used to detect
+	// groups that were only partially written before a crash.
+	uint64_t hash = 0xCBF29CE484222325ull;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, &data[i], sizeof(uint64_t));
+		hash = (hash ^ word) * 0x100000001B3ull;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001B3ull;
+	return hash;
+}
+
+static bool writeGroup(FILE* file, const char* data, size_t size, size_t recordSize)
+{
+	// Each group commit is written as: record count, checksum, records.
+	const uint64_t header[2] = { size / recordSize, checksum(data, size) };
+	return fwrite(header, sizeof(uint64_t), 2, file) == 2 &&
+		fwrite(data, 1, size, file) == size;
+}
+
+WriteAheadLog::WriteAheadLog(size_t recordSize) :
+	m_RecordSize(recordSize),
+	m_File(nullptr),
+
+	m_AppendedSequence(0),
+	m_DurableSequence(0),
+	m_Waiters(0),
+	m_Flushing(false),
+	m_Failed(false),
+	m_Stop(false) { }
+
+WriteAheadLog::~WriteAheadLog()
+{
+	close();
+}
+
+bool WriteAheadLog::open(const std::string& path, uint64_t& base, std::vector<char>& records)
+{
+	close();
+
+	base = 0;
+	records.clear();
+
+	// Fall back to the temporary log in case we crashed after removing
+	// the old log but before renaming.
+	const std::string tmpPath = path + ".tmp";
+	bool temporary = false;
+	FILE* file = openFile(path, "rb");
+	if (file == nullptr)
+	{
+		file = openFile(tmpPath, "rb");
+		temporary = true;
+	}
+
+	if (file != nullptr)
+	{
+		uint64_t header[2];
+		uint64_t remaining = 0;
+		const bool valid = fileSize(file, remaining) &&
+			fread(header, sizeof(uint64_t), 2, file) == 2 && header[0] == WAL_MAGIC;
+		if (valid)
+		{
+			base = header[1];
+			remaining -= sizeof(header);
+
+			// Read groups until the end of the file or the first group that
+			// was not completely written (which was never acknowledged).
+			// A torn group header may hold any count, so the count is
+			// checked against the bytes left before allocating records.
+			uint64_t groupHeader[2];
+			while (remaining >= sizeof(groupHeader) && fread(groupHeader, sizeof(uint64_t), 2, file) == 2)
+			{
+				remaining -= sizeof(groupHeader);
+				const size_t offset = records.size();
+				if (groupHeader[0] > remaining / m_RecordSize ||
+					groupHeader[0] > (std::numeric_limits<size_t>::max() - offset) / m_RecordSize)
+				{
+					break;
+				}
+
+				const size_t size = static_cast<size_t>(groupHeader[0]) * m_RecordSize;
+				remaining -= size;
+				records.resize(offset + size);
+
+				if (fread(&records[offset], 1, size, file) != size ||
+					checksum(&records[offset], size) != groupHeader[1])
+				{
+					records.resize(offset);
+					break;
+				}
+			}
+		}
+		fclose(file);
+
+		// A log with a bad or short header is not replaced by an empty log,
+		// as its records would be lost. The old log is only removed once
+		// the temporary log is synced, so a temporary log with a bad
+		// header was never committed and is ignored.
+		if (!valid && !temporary)
+			return false;
+	}
+
+	// Rewrite the durable records as a single group, such that new groups
+	// are never appended after a partially written group.
+	FILE* tmpFile = openFile(tmpPath, "wb");
+	if (tmpFile == nullptr)
+		return false;
+
+	const uint64_t header[2] = { WAL_MAGIC, base };
+	bool success = fwrite(header, sizeof(uint64_t), 2, tmpFile) == 2;
+	if (success && !records.empty())
+		success = writeGroup(tmpFile, records.data(), records.size(), m_RecordSize);
+	success = syncFile(tmpFile) && success;
+	success = (fclose(tmpFile) == 0) && success;
+
+	if (!success || !replaceFile(tmpPath, path))
+		return false;
+
+	m_File = openFile(path, "ab");
+	if (m_File == nullptr)
+		return false;
+
+	m_Path = path;
+	m_AppendedSequence = m_DurableSequence = base + records.size() / m_RecordSize;
+	m_Failed = false;
+	m_Stop = false;
+	m_Thread = std::thread(&WriteAheadLog::flushLoop, this);
+	return true;
+}
+
+uint64_t WriteAheadLog::append(const void* record)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	// Apply back pressure if the flush thread can not keep up
+	if (m_AppendBuffer.size() >= WAL_GROUP_COMMIT_BYTES)
+	{
+		m_DurableCondition.wait(lock, [this]() {
+			return m_AppendBuffer.size() < WAL_GROUP_COMMIT_BYTES || m_Failed;
+		});
+	}
+
+	const bool wasEmpty = m_AppendBuffer.empty();
+	const char* data = static_cast<const char*>(record);
+	m_AppendBuffer.insert(m_AppendBuffer.end(), data, data + m_RecordSize);
+
+	// Wake the flush thread if it is idle. Appends arriving while a group is
+	// being synced are collected and committed together in the next group.
+	if ((wasEmpty && !m_Flushing) || (m_AppendBuffer.size() << 1) >= WAL_GROUP_COMMIT_BYTES)
+		m_FlushCondition.notify_one();
+
+	return ++m_AppendedSequence;
+}
+
+bool WriteAheadLog::waitDurable(uint64_t sequence)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	if (m_DurableSequence >= sequence)
+		return true;
+
+	// Let the flush thread know that it should not delay the group commit
+	m_Waiters++;
+	m_FlushCondition.notify_one();
+	m_DurableCondition.wait(lock, [this, sequence]() {
+		return m_DurableSequence >= sequence || m_Failed || m_File == nullptr;
+	});
+	m_Waiters--;
+
+	return m_DurableSequence >= sequence;
+}
+
+bool WriteAheadLog::truncate(uint64_t base)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	if (m_File == nullptr)
+		return false;
+
+	// Wait for all pending groups to be written to the old log
+	m_DurableCondition.wait(lock, [this]() {
+		return (m_AppendBuffer.empty() && !m_Flushing) || m_Failed;
+	});
+	if (m_Failed)
+		return false;
+
+	const std::string tmpPath = m_Path + ".tmp";
+	FILE* tmpFile = openFile(tmpPath, "wb");
+	if (tmpFile == nullptr)
+		return false;
+
+	const uint64_t header[2] = { WAL_MAGIC, base };
+	bool success = fwrite(header, sizeof(uint64_t), 2, tmpFile) == 2;
+	success = syncFile(tmpFile) && success;
+	success = (fclose(tmpFile) == 0) && success;
+	if (!success)
+		return false;
+
+	// The old log must be closed before it can be replaced
+	fclose(m_File);
+	m_File = nullptr;
+	if (replaceFile(tmpPath, m_Path))
+		m_File = openFile(m_Path, "ab");
+
+	if (m_File == nullptr)
+	{
+		m_Failed = true;
+		m_DurableCondition.notify_all();
+		return false;
+	}
+
+	m_AppendedSequence = m_DurableSequence = base;
+	return true;
+}
+
+void WriteAheadLog::close()
+{
+	if (m_Thread.joinable())
+	{
+		// The flush thread writes all remaining records before stopping
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stop = true;
+		}
+		m_FlushCondition.notify_one();
+		m_Thread.join();
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_File != nullptr)
+	{
+		fclose(m_File);
+		m_File = nullptr;
+	}
+	m_DurableCondition.notify_all();
+}
+
+void WriteAheadLog::flushLoop()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	while (true)
+	{
+		m_FlushCondition.wait(lock, [this]() {
+			return !m_AppendBuffer.empty() || m_Stop;
+		});
+
+		if (m_AppendBuffer.empty())
+			break;
+
+		// Give more records the chance to join the group, unless a caller is
+		// blocked on durability or the buffer is already large.
+		m_FlushCondition.wait_for(lock, std::chrono::microseconds(WAL_GROUP_COMMIT_DELAY), [this]() {
+			return m_Waiters != 0 || m_Stop || (m_AppendBuffer.size() << 1) >= WAL_GROUP_COMMIT_BYTES;
+		});
+
+		// Take all buffered records as one group, and let
+		// appends continue in the other buffer meanwhile.
+		m_FlushBuffer.swap(m_AppendBuffer);
+		const uint64_t sequence = m_AppendedSequence;
+		const bool failed = m_Failed;
+		m_Flushing = true;
+		lock.unlock();
+
+		const bool success = !failed &&
+			writeGroup(m_File, m_FlushBuffer.data(), m_FlushBuffer.size(), m_RecordSize) &&
+			syncFile(m_File);
+		m_FlushBuffer.clear();
+
+		lock.lock();
+		m_Flushing = false;
+		if (success)
+			m_DurableSequence = sequence;
+		else
+			m_Failed = true;
+		m_DurableCondition.notify_all();
+	}
+}
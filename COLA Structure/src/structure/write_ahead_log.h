@@ -0,0 +1,201 @@
+#pragma once
+
+#include "./file_util.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#ifndef WAL_GROUP_COMMIT_BYTES
+// Appends block when this many bytes are waiting for the flush thread.
+#define WAL_GROUP_COMMIT_BYTES (static_cast<size_t>(1) << 22)
+#endif // !WAL_GROUP_COMMIT_BYTES
+
+#ifndef WAL_GROUP_COMMIT_DELAY
+// Time in microseconds the flush thread waits for more records to join a
+// group, unless a caller is already blocked waiting for durability.
+#define WAL_GROUP_COMMIT_DELAY 1000
+#endif // !WAL_GROUP_COMMIT_DELAY
+
+#define WAL_MAGIC 0x4C41574C4F43ull
+
+class WriteAheadLog
+{
+public:
+	WriteAheadLog(size_t recordSize);
+
+	WriteAheadLog(const WriteAheadLog& other) = delete;
+
+	~WriteAheadLog();
+
+public:
+	// Open the log at the given path, creating it if it does not exist. The
+	// durable records of an existing log are returned for replay, along with
+	// the sequence number preceding the first record. Fails if an existing
+	// log has a bad header.
+	bool open(const std::string& path, uint64_t& base, std::vector<char>& records);
+
+	// Buffer a record and return its sequence number. The record
+	// is durable once waitDurable has returned for that number.
+	uint64_t append(const void* record);
+
+	// Block until all records up to and including the sequence number
+	// have been written and synced by the flush thread.
+	bool waitDurable(uint64_t sequence);
+
+	// Replace the log with an empty log whose first record will get the
+	// sequence number base + 1. Used after a checkpoint has been written.
+	bool truncate(uint64_t base);
+
+	void close();
+
+	inline uint64_t sequence() const { return m_AppendedSequence; }
+
+private:
+	void flushLoop();
+
+private:
+	const size_t m_RecordSize;
+
+	std::string m_Path;
+	FILE* m_File;
+
+	// Records are appended to one buffer while the other is being flushed.
+	std::vector<char> m_AppendBuffer;
+	std::vector<char> m_FlushBuffer;
+
+	uint64_t m_AppendedSequence;
+	uint64_t m_DurableSequence;
+	uint32_t m_Waiters;
+	bool m_Flushing;
+	bool m_Failed;
+	bool m_Stop;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_FlushCondition;
+	std::condition_variable m_DurableCondition;
+	std::thread m_Thread;
+};
+
+template<typename T, typename V = int64_t>
+class DurableCOLA
+{
+public:
+	using ColaType = T;
+	using ValueType = V;
+
+public:
+	DurableCOLA() :
+		m_Log(sizeof(V)) { }
+
+	DurableCOLA(const DurableCOLA& other) = delete;
+
+public:
+	// Open the log in the directory and replay its durable records.
+	bool open(const std::string& directory)
+	{
+		uint64_t base;
+		std::vector<char> records;
+		if (!m_Log.open(joinPath(directory, "wal.log"), base, records))
+			return false;
+
+		if (!replay(base, records))
+		{
+			m_Log.close();
+			return false;
+		}
+		return true;
+	}
+
+	// Restore the latest checkpoint in the directory (if any) and replay
+	// the records of the log that were not part of the checkpoint.
+	bool recover(const std::string& directory)
+	{
+		// Without a checkpoint, e.g. before the first one, the cola stays
+		// empty and replay checks that the log still holds all records.
+		if (!m_Cola.restore(directory) && m_Cola.size() != 0)
+			return false;
+		return open(directory);
+	}
+
+	// Insert the value without waiting for the log to be synced.
+	// Returns the sequence number to pass to waitDurable.
+	uint64_t add(V value)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Cola.add(value);
+		return m_Log.append(&value);
+	}
+
+	// Insert the value and block until it has been made durable. Concurrent
+	// callers are synced together by a single group commit.
+	bool addDurable(V value)
+	{
+		return m_Log.waitDurable(add(value));
+	}
+
+	bool waitDurable(uint64_t sequence)
+	{
+		return m_Log.waitDurable(sequence);
+	}
+
+	bool contains(V value) const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Cola.contains(value);
+	}
+
+	// Write a checkpoint of the cola and truncate the log. The log is only
+	// truncated after the checkpoint has been committed, and records already
+	// contained in a checkpoint are skipped on replay.
+	bool checkpoint(const std::string& directory)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Log.waitDurable(m_Log.sequence()))
+			return false;
+		if (!m_Cola.checkpoint(directory))
+			return false;
+		return m_Log.truncate(m_Cola.size());
+	}
+
+	inline size_t size() const { return m_Cola.size(); }
+
+	// The cola is not synchronized, so it must only be
+	// accessed directly when no other thread is inserting.
+	inline const T& cola() const { return m_Cola; }
+
+private:
+	bool replay(uint64_t base, const std::vector<char>& records)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// Record n of the log was the insert that gave the cola size base + n,
+		// so records covered by a restored checkpoint are skipped. A log that
+		// was truncated after a checkpoint which was not restored is missing
+		// the records up to its base.
+		if (m_Cola.size() < base)
+			return false;
+
+		const uint64_t count = records.size() / sizeof(V);
+		uint64_t n = (m_Cola.size() > base) ? (m_Cola.size() - base) : 0;
+
+		for (; n < count; n++)
+		{
+			V value;
+			memcpy(&value, &records[static_cast<size_t>(n) * sizeof(V)], sizeof(V));
+			m_Cola.add(value);
+		}
+
+		return true;
+	}
+
+private:
+	T m_Cola;
+	WriteAheadLog m_Log;
+	mutable std::mutex m_Mutex;
+};